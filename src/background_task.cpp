@@ -0,0 +1,111 @@
+#include "background_task.hpp"
+
+static thread_local TaskControl* current_control = nullptr;
+
+TaskControl* TaskControl::current() {
+    return current_control;
+}
+
+void TaskControl::set_stage(std::string s) {
+    {
+        std::lock_guard<std::mutex> lock(stage_mutex);
+        stage = s;
+        source.reset();
+    }
+    done = 0;
+    total = 0;
+}
+
+std::string TaskControl::get_stage() const {
+    std::lock_guard<std::mutex> lock(stage_mutex);
+    return stage;
+}
+
+void TaskControl::set_progress(long d, long t) {
+    total = t;
+    done = d;
+}
+
+void TaskControl::set_progress_source(std::shared_ptr<const ProgressSource> s) {
+    std::lock_guard<std::mutex> lock(stage_mutex);
+    source = std::move(s);
+}
+
+float TaskControl::get_progress() const {
+    long t = total;
+    long d = done;
+    {
+        std::lock_guard<std::mutex> lock(stage_mutex);
+        if (source) {
+            t = source->total;
+            d = source->done.value();
+        }
+    }
+    if (t <= 0) return 0.0f;
+    return d >= t ? 1.0f : (float)d / t;
+}
+
+ScopedTaskControl::ScopedTaskControl(TaskControl* control) {
+    previous = current_control;
+    current_control = control;
+}
+
+ScopedTaskControl::~ScopedTaskControl() {
+    current_control = previous;
+}
+
+BackgroundTask::~BackgroundTask() {
+    if (thread.joinable()) {
+        control.cancel();
+        thread.join();
+    }
+}
+
+void BackgroundTask::start(std::string task_name, std::function<Commit(TaskControl&)> job) {
+    if (thread.joinable()) {
+        throw std::runtime_error("Cannot start " + task_name + " while " + name + " is running");
+    }
+
+    // The control is reused, so reset it before the new thread can see it
+    control.reset();
+    control.set_stage(task_name);
+
+    name = task_name;
+    commit = nullptr;
+    error = nullptr;
+    finished = false;
+    thread = std::thread([this, job] {
+        ScopedTaskControl scope(&control);
+        try {
+            commit = job(control);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        finished = true;
+    });
+}
+
+bool BackgroundTask::poll() {
+    if (!thread.joinable() || !finished) return false;
+    thread.join();
+
+    Commit step = std::move(commit);
+    std::exception_ptr failure = error;
+    commit = nullptr;
+    error = nullptr;
+
+    if (failure) {
+        try {
+            std::rethrow_exception(failure);
+        } catch (const TaskCancelled&) {
+            return true;
+        }
+    }
+
+    if (step) step();
+    return true;
+}
+
+void BackgroundTask::cancel() {
+    control.cancel();
+}
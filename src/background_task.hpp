@@ -0,0 +1,92 @@
+#ifndef EVA_BACKGROUND_TASK
+#define EVA_BACKGROUND_TASK
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "metrics.hpp"
+
+//! Thrown by a worker loop that noticed its task was cancelled
+class TaskCancelled : public std::runtime_error {
+public:
+    TaskCancelled() : std::runtime_error("Task cancelled") {}
+};
+
+/*! Shared between a running task and whoever watches it. The task reports its stage and progress, the
+ * watcher may ask it to stop. Cancellation is cooperative: long loops poll cancelled() and give up by
+ * throwing TaskCancelled once they are out of their parallel section.
+ */
+class TaskControl {
+public:
+    void        cancel()                        { cancel_requested = true;  }
+    bool        cancelled() const               { return cancel_requested;  }
+    void        throw_if_cancelled() const      { if (cancel_requested) throw TaskCancelled(); }
+    void        reset()                         { cancel_requested = false; set_stage(""); }
+
+    void        set_stage(std::string stage);   //!< Also resets the progress
+    std::string get_stage() const;
+    void        set_progress(long done, long total);
+    void        set_progress_source(std::shared_ptr<const ProgressSource> source); //!< Progress is read from the source's counter when it is polled, until the next stage or a null source
+    float       get_progress() const;           //!< 0 to 1
+
+    static TaskControl* current();              //!< Control of the task running on this thread, nullptr outside tasks
+
+private:
+    std::atomic<bool>  cancel_requested{false};
+    std::atomic<long>  done{0};
+    std::atomic<long>  total{0};
+    mutable std::mutex stage_mutex;
+    std::string        stage;
+    std::shared_ptr<const ProgressSource> source;   //!< Guarded by stage_mutex
+};
+
+//! Makes control the TaskControl::current() of the calling thread until it goes out of scope
+class ScopedTaskControl {
+public:
+    ScopedTaskControl(TaskControl* control);
+    ~ScopedTaskControl();
+    ScopedTaskControl(const ScopedTaskControl&) = delete;
+    ScopedTaskControl& operator=(const ScopedTaskControl&) = delete;
+
+private:
+    TaskControl* previous;
+};
+
+/*! Runs one job at a time on its own thread so that an interactive caller stays responsive. The job
+ * returns a commit step, which poll() runs on the caller's thread once the job is done, so results are
+ * swapped in by the thread that owns them (and e.g. its GL context) in one go. A job that throws or is
+ * cancelled commits nothing.
+ */
+class BackgroundTask {
+public:
+    using Commit = std::function<void()>;
+
+    BackgroundTask() = default;
+    ~BackgroundTask();                  //!< Cancels a running job and waits for it
+    BackgroundTask(const BackgroundTask&) = delete;
+    BackgroundTask& operator=(const BackgroundTask&) = delete;
+
+    void start(std::string name, std::function<Commit(TaskControl&)> job); //!< Throws if a job is still running
+    bool poll();                        //!< Commits a finished job, returns true if one finished. Rethrows its exception, except TaskCancelled
+    void cancel();
+
+    bool        busy() const            { return thread.joinable(); }
+    std::string get_name() const        { return name;              }
+    std::string get_stage() const       { return control.get_stage();    }
+    float       get_progress() const    { return control.get_progress(); }
+
+private:
+    std::thread        thread;
+    std::atomic<bool>  finished{false};
+    TaskControl        control;
+    std::string        name;
+    Commit             commit;
+    std::exception_ptr error;
+};
+
+#endif
@@ -0,0 +1,548 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "graph.hpp"
+#include "graph_generator.hpp"
+#include "csr_graph.hpp"
+#include "graph_loader.hpp"
+#include "simd_random.hpp"
+#include "keyword_distance_matrix.hpp"
+#include "distance_index.hpp"
+#include "keyword_search.hpp"
+#include "csv_writer.hpp"
+#include "binary_matrix.hpp"
+#include "thread_config.hpp"
+
+// Benchmarks of the generator, the RNG, keyword lookups, the matrix engines and the writers. Every
+// benchmark reports a throughput, results are saved as JSON and can be compared against a saved baseline
+
+const char* BENCH_FORMAT_VERSION = "1";
+
+struct BenchOptions {
+    std::string filter;                         //!< Only run benchmarks whose name contains this
+    std::string json = "bench_results.json";
+    std::string compare;                        //!< Baseline to compare against, empty skips the comparison
+    double      threshold = 10;                 //!< Percent of throughput a benchmark may lose before it counts as a regression
+    double      min_time = 0.5;                 //!< Seconds each benchmark is repeated for
+    int         min_repetitions = 3;
+    bool        quick = false;                  //!< Small scales only, for a fast sanity run
+    int         threads = 0;                    //!< 0 keeps the default
+    std::string scratch = std::filesystem::temp_directory_path().string();
+};
+
+struct BenchResult {
+    std::string name;                           //!< Unique, includes the parameters, e.g. matrix_cpu/V=10000,deg=5,W=100
+    std::string unit;                           //!< What the throughput counts, e.g. edges or bytes
+    int         repetitions = 0;
+    double      median_seconds = 0;
+    double      min_seconds = 0;
+    double      throughput = 0;                 //!< unit per second in the median repetition
+};
+
+/*! One benchmark: setup runs once outside the timing and returns the body, the body runs once per
+ * repetition and returns how many units it processed
+ */
+struct Benchmark {
+    std::string name;
+    std::string unit;
+    std::function<std::function<double()>()> setup;
+    bool        quick;                          //!< Part of the --quick set
+};
+
+// Writers and engines report to the console; the measurements should not include the terminal
+class QuietConsole {
+public:
+    QuietConsole() : previous(std::cout.rdbuf(sink.rdbuf())) {}
+    ~QuietConsole() { std::cout.rdbuf(previous); }
+
+private:
+    std::ostringstream sink;
+    std::streambuf*    previous;
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static BenchResult measure(const Benchmark& bench, const BenchOptions& o) {
+    std::function<double()> body;
+    {
+        QuietConsole quiet;
+        body = bench.setup();
+        body(); // Warm-up: page faults, thread pool start-up, caches
+    }
+
+    std::vector<double> times;
+    double units = 0;
+    double total = 0;
+    {
+        QuietConsole quiet;
+        while ((int)times.size() < o.min_repetitions || total < o.min_time) {
+            auto start = std::chrono::steady_clock::now();
+            units = body();
+            times.push_back(secondsSince(start));
+            total += times.back();
+        }
+    }
+
+    std::sort(times.begin(), times.end());
+    BenchResult r;
+    r.name = bench.name;
+    r.unit = bench.unit;
+    r.repetitions = times.size();
+    r.median_seconds = times[times.size() / 2];
+    r.min_seconds = times.front();
+    r.throughput = r.median_seconds > 0 ? units / r.median_seconds : 0;
+    return r;
+}
+
+static SparseGraph<int>* makeGraph(int V, int W, int degree, unsigned seed = 1) {
+    GraphGenerator<int> gen(seed, 5, 5);
+    return gen.generate(V, W, 1, 3, degree / 2, degree + degree / 2, 1, 10);
+}
+
+static std::string scale(int V, int degree, int W) {
+    return "V=" + std::to_string(V) + ",deg=" + std::to_string(degree) + ",W=" + std::to_string(W);
+}
+
+static std::vector<Benchmark> makeBenchmarks(const BenchOptions& o) {
+    std::vector<Benchmark> benches;
+
+    benches.push_back({"philox/draws", "draws", [] {
+        auto rng = std::make_shared<CachedPhiloxAVX2>(1);
+        return std::function<double()>([rng] {
+            const int n = 1 << 24;
+            uint32_t sink = 0;
+            for (int i = 0; i < n; i++) sink += (*rng)(1000);
+            if (sink == 1) std::cout << sink; // Keeps the loop from being optimized away
+            return (double)n;
+        });
+    }, true});
+
+    for (int V : {10000, 100000}) {
+        benches.push_back({"generate/" + scale(V, 5, 100), "edges", [V] {
+            return std::function<double()>([V] {
+                std::unique_ptr<SparseGraph<int>> graph(makeGraph(V, 100, 5));
+                return (double)graph->adjacency_list.size();
+            });
+        }, V <= 10000});
+    }
+
+    benches.push_back({"csr_build/" + scale(100000, 5, 100), "edges", [] {
+        std::shared_ptr<SparseGraph<int>> graph(makeGraph(100000, 100, 5));
+        return std::function<double()>([graph] {
+            CSRGraph<int> csr(*graph, 100);
+            return (double)csr.n_edges();
+        });
+    }, false});
+
+    // The multimap lookups of SparseGraph against the flat holder lists of CSRGraph
+    benches.push_back({"keyword_lookup/sparse_graph", "lookups", [] {
+        std::shared_ptr<SparseGraph<int>> graph(makeGraph(20000, 500, 5));
+        return std::function<double()>([graph] {
+            size_t found = 0;
+            for (int w = 0; w < 500; w++) found += graph->get_vertices_with_keyword(w).size();
+            for (int v = 0; v < 20000; v++) found += graph->keyword_is_in(v % 500, v);
+            if (found == 1) std::cout << found;
+            return 500.0 + 20000.0;
+        });
+    }, true});
+
+    benches.push_back({"keyword_lookup/csr", "lookups", [] {
+        std::shared_ptr<SparseGraph<int>> graph(makeGraph(20000, 500, 5));
+        auto csr = std::make_shared<CSRGraph<int>>(*graph, 500);
+        return std::function<double()>([csr] {
+            size_t found = 0;
+            for (int w = 0; w < 500; w++) found += csr->holders_end(w) - csr->holders_begin(w);
+            for (int v = 0; v < 20000; v++) {
+                int w = v % 500;
+                found += std::binary_search(csr->keyword_vertices.begin() + csr->holders_begin(w), csr->keyword_vertices.begin() + csr->holders_end(w), v);
+            }
+            if (found == 1) std::cout << found;
+            return 500.0 + 20000.0;
+        });
+    }, true});
+
+    struct Scale { int V, degree, W; bool quick; };
+    for (Scale s : {Scale{10000, 5, 100, true}, Scale{50000, 5, 200, false}, Scale{100000, 10, 100, false}}) {
+        benches.push_back({"matrix_cpu/" + scale(s.V, s.degree, s.W), "cells", [s] {
+            std::shared_ptr<SparseGraph<int>> graph(makeGraph(s.V, s.W, s.degree));
+            auto csr = std::make_shared<CSRGraph<int>>(*graph, s.W);
+            return std::function<double()>([csr, s] {
+                KeywordDistanceMatrix mat(s.W, s.V, 10);
+                mat.calculate_matrix_cpu(*csr);
+                return (double)s.V * s.W;
+            });
+        }, s.quick});
+    }
+
+    benches.push_back({"matrix_cpu_sparse/" + scale(100000, 5, 200) + ",radius=20", "cells", [] {
+        std::shared_ptr<SparseGraph<int>> graph(makeGraph(100000, 200, 5));
+        auto csr = std::make_shared<CSRGraph<int>>(*graph, 200);
+        return std::function<double()>([csr] {
+            KeywordDistanceMatrix mat(200, 100000, 10, 20);
+            mat.calculate_matrix_cpu(*csr);
+            return 100000.0 * 200;
+        });
+    }, false});
+
+    benches.push_back({"matrix_approx/" + scale(50000, 5, 200) + ",landmarks=16", "cells", [] {
+        std::shared_ptr<SparseGraph<int>> graph(makeGraph(50000, 200, 5));
+        auto csr = std::make_shared<CSRGraph<int>>(*graph, 200);
+        return std::function<double()>([csr] {
+            KeywordDistanceMatrix mat(200, 50000, 10);
+            mat.calculate_matrix_approx(*csr, 16);
+            return 50000.0 * 200;
+        });
+    }, false});
+
+    // Batches of three-keyword queries against one matrix, with both search methods
+    for (bool scan : {false, true}) {
+        benches.push_back({std::string(scan ? "keyword_search_scan/" : "keyword_search_ta/") + scale(20000, 5, 200) + ",q=3,k=10", "queries", [scan] {
+            std::shared_ptr<SparseGraph<int>> graph(makeGraph(20000, 200, 5));
+            auto mat = std::make_shared<KeywordDistanceMatrix>(200, 20000, 10);
+            mat->calculate_matrix_cpu(graph.get());
+            auto engine = std::make_shared<KeywordSearchEngine>(*mat);
+            auto queries = std::make_shared<std::vector<std::vector<int>>>();
+            for (int i = 0; i < 1000; i++) queries->push_back({i % 200, (i * 7 + 3) % 200, (i * 13 + 5) % 200});
+            return std::function<double()>([mat, engine, queries, scan] {
+                std::vector<std::vector<SearchResult>> results;
+                engine->query_batch(*queries, 10, results, scan);
+                return (double)queries->size();
+            });
+        }, true});
+    }
+
+    // The on-demand indexes: building them, and the queries they answer instead of a stored matrix
+    benches.push_back({"index_pll_build/" + scale(5000, 3, 100), "vertices", [] {
+        std::shared_ptr<SparseGraph<int>> graph(makeGraph(5000, 100, 3));
+        auto csr = std::make_shared<CSRGraph<int>>(*graph, 100);
+        return std::function<double()>([csr] {
+            PrunedLandmarkLabeling pll;
+            pll.build(*csr);
+            pll.build_keyword_labels(*csr);
+            return 5000.0;
+        });
+    }, false});
+
+    benches.push_back({"index_pll_keyword_query/" + scale(5000, 3, 100), "queries", [] {
+        std::shared_ptr<SparseGraph<int>> graph(makeGraph(5000, 100, 3));
+        CSRGraph<int> csr(*graph, 100);
+        auto pll = std::make_shared<PrunedLandmarkLabeling>();
+        pll->build(csr);
+        pll->build_keyword_labels(csr);
+        return std::function<double()>([pll] {
+            long sink = 0;
+            for (int v = 0; v < 5000; v++) {
+                for (int w = 0; w < 100; w += 10) sink += pll->keyword_distance(w, v);
+            }
+            if (sink == 1) std::cout << sink;
+            return 5000.0 * 10;
+        });
+    }, false});
+
+    benches.push_back({"index_alt_query/" + scale(10000, 5, 100) + ",landmarks=16", "queries", [] {
+        std::shared_ptr<SparseGraph<int>> graph(makeGraph(10000, 100, 5));
+        auto csr = std::make_shared<CSRGraph<int>>(*graph, 100);
+        auto alt = std::make_shared<ALTIndex>();
+        alt->build(*csr, 16);
+        return std::function<double()>([csr, alt] {
+            long sink = 0;
+            for (int i = 0; i < 1000; i++) sink += alt->query(*csr, (i * 7919) % 10000, (i * 104729) % 10000);
+            if (sink == 1) std::cout << sink;
+            return 1000.0;
+        });
+    }, true});
+
+    // Writers are fed one matrix and measured in output bytes
+    std::string scratch = (std::filesystem::path(o.scratch) / ("graphgen_bench_" + std::to_string(getpid()))).string();
+    auto writer = [scratch](std::string name, std::function<void(const std::string&, const KeywordDistanceMatrix&)> write, bool quick) {
+        return Benchmark{name, "bytes", [scratch, write] {
+            std::shared_ptr<SparseGraph<int>> graph(makeGraph(20000, 200, 5));
+            auto mat = std::make_shared<KeywordDistanceMatrix>(200, 20000, 10);
+            mat->calculate_matrix_cpu(graph.get());
+            return std::function<double()>([scratch, write, mat] {
+                write(scratch, *mat);
+                double bytes = std::filesystem::file_size(scratch);
+                std::remove(scratch.c_str());
+                return bytes;
+            });
+        }, quick};
+    };
+    benches.push_back(writer("csv_writer/" + scale(20000, 5, 200), [](const std::string& path, const KeywordDistanceMatrix& mat) { CSVWriter().write(path, mat); }, true));
+    benches.push_back(writer("binary_writer/int32/" + scale(20000, 5, 200), [](const std::string& path, const KeywordDistanceMatrix& mat) { BinaryMatrixWriter(DTYPE_INT32).write(path, mat); }, false));
+    benches.push_back(writer("binary_writer/varint/" + scale(20000, 5, 200), [](const std::string& path, const KeywordDistanceMatrix& mat) { BinaryMatrixWriter(DTYPE_VARINT).write(path, mat); }, false));
+
+    // The importer reads a generated graph written as an edge list and a keyword list, which are removed
+    // with the benchmark
+    benches.push_back({"graph_loader/" + scale(100000, 5, 200), "edges", [scratch] {
+        std::unique_ptr<SparseGraph<int>> graph(makeGraph(100000, 200, 5));
+        CSRGraph<int> csr(*graph, 200);
+        auto files = std::shared_ptr<std::string>(new std::string(scratch), [](std::string* path) {
+            std::remove((*path + ".edges").c_str());
+            std::remove((*path + ".keywords").c_str());
+            delete path;
+        });
+        std::ofstream edges(*files + ".edges"), keywords(*files + ".keywords");
+        for (int v = 0; v < csr.n_vertices; v++) {
+            for (int e = csr.edges_begin(v); e < csr.edges_end(v); e++) edges << v << ' ' << csr.targets[e] << ' ' << csr.weights[e] << '\n';
+        }
+        std::vector<std::vector<int>> held(csr.n_vertices);
+        for (int w = 0; w < csr.n_keywords; w++) {
+            for (int i = csr.holders_begin(w); i < csr.holders_end(w); i++) held[csr.keyword_vertices[i]].push_back(w);
+        }
+        for (int v = 0; v < csr.n_vertices; v++) {
+            keywords << v;
+            for (int w : held[v]) keywords << ' ' << w;
+            keywords << '\n';
+        }
+        if (!edges.flush() || !keywords.flush()) throw std::runtime_error("Unable to write the graph files in " + scratch);
+        return std::function<double()>([files] {
+            GraphLoader loader;
+            CSRGraph<int> loaded = loader.load(*files + ".edges", *files + ".keywords");
+            return (double)loaded.n_edges();
+        });
+    }, false});
+
+    return benches;
+}
+
+static std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static void writeJSON(const std::string& filepath, const std::vector<BenchResult>& results) {
+    std::ofstream file(filepath);
+    if (!file) {
+        throw std::runtime_error("Unable to create file " + filepath);
+    }
+
+    file << std::setprecision(9);
+    file << "{\n  \"format\": " << BENCH_FORMAT_VERSION << ",\n"
+         << "  \"timestamp\": " << std::time(nullptr) << ",\n"
+         << "  \"threads\": " << get_num_threads() << ",\n"
+         << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        file << "    {\"name\": " << jsonString(r.name) << ", \"unit\": " << jsonString(r.unit)
+             << ", \"repetitions\": " << r.repetitions << ", \"median_seconds\": " << r.median_seconds
+             << ", \"min_seconds\": " << r.min_seconds << ", \"throughput\": " << r.throughput << "}"
+             << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+}
+
+/*! Reads back the result objects of a file written by writeJSON(). Only what that writer produces is
+ * understood: flat objects of strings and numbers inside the "results" array
+ */
+static std::map<std::string, BenchResult> readJSON(const std::string& filepath) {
+    std::ifstream file(filepath);
+    if (!file) {
+        throw std::runtime_error("Unable to open baseline " + filepath);
+    }
+    std::stringstream ss;
+    ss << file.rdbuf();
+    std::string text = ss.str();
+
+    size_t pos = text.find("\"results\"");
+    if (pos == std::string::npos) {
+        throw std::runtime_error("No results in baseline " + filepath);
+    }
+
+    std::map<std::string, BenchResult> results;
+    while ((pos = text.find('{', pos)) != std::string::npos) {
+        size_t end = text.find('}', pos);
+        if (end == std::string::npos) break;
+        std::string object = text.substr(pos + 1, end - pos - 1);
+        pos = end + 1;
+
+        std::map<std::string, std::string> fields;
+        size_t i = 0;
+        while ((i = object.find('"', i)) != std::string::npos) {
+            size_t key_end = object.find('"', i + 1);
+            size_t colon = object.find(':', key_end);
+            if (key_end == std::string::npos || colon == std::string::npos) break;
+            std::string key = object.substr(i + 1, key_end - i - 1);
+
+            size_t value_start = object.find_first_not_of(" \t\n", colon + 1);
+            std::string value;
+            if (value_start != std::string::npos && object[value_start] == '"') {
+                size_t j = value_start + 1;
+                for (; j < object.size() && object[j] != '"'; j++) {
+                    if (object[j] == '\\') j++;
+                    if (j < object.size()) value += object[j];
+                }
+                i = j + 1;
+            } else {
+                size_t value_end = object.find(',', colon);
+                value = object.substr(colon + 1, value_end == std::string::npos ? std::string::npos : value_end - colon - 1);
+                i = value_end == std::string::npos ? object.size() : value_end;
+            }
+            fields[key] = value;
+        }
+
+        if (!fields.count("name") || !fields.count("throughput")) {
+            throw std::runtime_error("Malformed result in baseline " + filepath);
+        }
+        BenchResult r;
+        r.name = fields["name"];
+        r.unit = fields["unit"];
+        r.throughput = std::atof(fields["throughput"].c_str());
+        r.median_seconds = std::atof(fields["median_seconds"].c_str());
+        results[r.name] = r;
+    }
+    return results;
+}
+
+static std::string rate(double throughput, const std::string& unit) {
+    const char* prefixes[] = {"", "k", "M", "G", "T"};
+    int p = 0;
+    while (throughput >= 1000 && p < 4) {
+        throughput /= 1000;
+        p++;
+    }
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(2) << throughput << " " << prefixes[p] << (unit == "bytes" ? "B" : unit) << "/s";
+    return ss.str();
+}
+
+//! Returns the number of regressions
+static int compareResults(const std::vector<BenchResult>& results, const std::map<std::string, BenchResult>& baseline, double threshold) {
+    int regressions = 0;
+    std::cout << std::defaultfloat << "\nComparison against baseline (regression: more than " << threshold << "% slower)\n";
+    for (const BenchResult& r : results) {
+        auto it = baseline.find(r.name);
+        std::cout << std::left << std::setw(58) << r.name << std::right;
+        if (it == baseline.end() || it->second.throughput <= 0) {
+            std::cout << "  new\n";
+            continue;
+        }
+
+        double change = (r.throughput / it->second.throughput - 1) * 100;
+        bool regressed = change < -threshold;
+        regressions += regressed;
+        std::cout << std::setw(16) << rate(it->second.throughput, r.unit) << " -> " << std::setw(16) << rate(r.throughput, r.unit)
+                  << std::showpos << std::fixed << std::setprecision(1) << std::setw(9) << change << "%" << std::noshowpos
+                  << (regressed ? "  REGRESSION" : "") << "\n";
+    }
+    for (auto& [name, b] : baseline) {
+        bool ran = std::any_of(results.begin(), results.end(), [&](const BenchResult& r) { return r.name == name; });
+        if (!ran) std::cout << std::left << std::setw(58) << name << std::right << "  not run\n";
+    }
+    return regressions;
+}
+
+static void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "\n"
+              << "  --filter TEXT         Only run benchmarks whose name contains TEXT\n"
+              << "  --quick               Small scales only\n"
+              << "  --list                Print the benchmark names and exit\n"
+              << "  --json FILE           Where to save the results (default bench_results.json)\n"
+              << "  --compare FILE        Compare against a saved results file, exits with 1 on regressions\n"
+              << "  --threshold PCT       Throughput loss that counts as a regression (default 10)\n"
+              << "  --min-time S          Seconds to repeat each benchmark for (default 0.5)\n"
+              << "  --repetitions N       Minimum repetitions per benchmark (default 3)\n"
+              << "  --threads N           Worker threads (default " << get_num_threads() << ")\n"
+              << "  --scratch DIR         Directory for the writer benchmarks' files (default the temp directory)\n"
+              << "  --help\n";
+}
+
+static double parseNumber(const std::string& flag, const std::string& value, double min) {
+    size_t used = 0;
+    double n = 0;
+    try {
+        n = std::stod(value, &used);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    if (used == 0 || used != value.size() || !(n >= min)) {
+        throw std::runtime_error("Invalid value '" + value + "' for " + flag);
+    }
+    return n;
+}
+
+int main(int argc, char** argv) {
+    try {
+        BenchOptions o;
+        bool list = false;
+        for (int i = 1; i < argc; i++) {
+            std::string flag = argv[i];
+            if (flag == "--help" || flag == "-h") {
+                printUsage(argv[0]);
+                return 0;
+            }
+            if (flag == "--quick") { o.quick = true; continue; }
+            if (flag == "--list")  { list = true; continue; }
+
+            if (i + 1 >= argc) {
+                throw std::runtime_error("Missing value for " + flag);
+            }
+            std::string value = argv[++i];
+            if      (flag == "--filter")      o.filter = value;
+            else if (flag == "--json")        o.json = value;
+            else if (flag == "--compare")     o.compare = value;
+            else if (flag == "--scratch")     o.scratch = value;
+            else if (flag == "--threshold")   o.threshold = parseNumber(flag, value, 0);
+            else if (flag == "--min-time")    o.min_time = parseNumber(flag, value, 0);
+            else if (flag == "--repetitions") o.min_repetitions = (int)parseNumber(flag, value, 1);
+            else if (flag == "--threads")     o.threads = (int)parseNumber(flag, value, 1);
+            else throw std::runtime_error("Unknown option " + flag);
+        }
+        if (o.threads > 0) set_num_threads(o.threads);
+
+        // Read the baseline first so a bad path fails before minutes of benchmarking
+        std::map<std::string, BenchResult> baseline;
+        if (!o.compare.empty()) baseline = readJSON(o.compare);
+
+        std::vector<BenchResult> results;
+        for (const Benchmark& bench : makeBenchmarks(o)) {
+            if (o.quick && !bench.quick) continue;
+            if (!o.filter.empty() && bench.name.find(o.filter) == std::string::npos) continue;
+            if (list) {
+                std::cout << bench.name << "\n";
+                continue;
+            }
+
+            BenchResult r = measure(bench, o);
+            std::cout << std::left << std::setw(58) << r.name << std::right << std::setw(18) << rate(r.throughput, r.unit)
+                      << std::fixed << std::setprecision(4) << std::setw(10) << r.median_seconds << " s  x" << r.repetitions << std::endl;
+            results.push_back(r);
+        }
+        if (list) return 0;
+
+        writeJSON(o.json, results);
+        std::cout << "Results written to " << o.json << std::endl;
+
+        if (!o.compare.empty()) {
+            int regressions = compareResults(results, baseline, o.threshold);
+            std::cout << regressions << " regression" << (regressions == 1 ? "" : "s") << std::endl;
+            if (regressions) return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 2;
+    }
+    return 0;
+}
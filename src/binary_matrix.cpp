@@ -0,0 +1,568 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef GRAPHGEN_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "binary_matrix.hpp"
+#include "hash_util.hpp"
+#include "thread_config.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+const size_t BATCH_BYTES = 64 << 20; // Encoded bytes kept in memory at once by the compressed writer
+const int ZSTD_LEVEL = 3;
+
+// Returns false instead of throwing so it can be called from inside OpenMP regions
+static bool pwrite_all(int fd, const void* buffer, size_t n, off_t offset) {
+    static Counter& bytes_written = Metrics::global().counter("bytes_written");
+    bytes_written.add(n);
+    const char* bytes = static_cast<const char*>(buffer);
+    while (n > 0) {
+        ssize_t written = pwrite(fd, bytes, n, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += written;
+        offset += written;
+        n -= written;
+    }
+    return true;
+}
+
+static inline uint64_t zigzag(int64_t x)   { return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63); }
+static inline int64_t  unzigzag(uint64_t x) { return (int64_t)(x >> 1) ^ -(int64_t)(x & 1); }
+
+static inline char* put_varint(char* p, uint64_t x) {
+    while (x >= 0x80) {
+        *p++ = (char)(x | 0x80);
+        x >>= 7;
+    }
+    *p++ = (char)x;
+    return p;
+}
+
+// Returns nullptr if the varint runs past end or is longer than ten bytes
+static inline const char* get_varint(const char* p, const char* end, uint64_t& x) {
+    x = 0;
+    for (int shift = 0; p < end && shift < 70; shift += 7) {
+        unsigned char byte = *p++;
+        x |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return p;
+    }
+    return nullptr;
+}
+
+static size_t max_record_size(size_t cells, bool sparse) {
+    return sparse ? 10 + cells * 30 : cells * 20;
+}
+
+static size_t encode_row(const Pair* row, int V, char* out) {
+    char* p = out;
+    int64_t prev = 0;
+    for (int v = 0; v < V; v++) {
+        int64_t d = row[v].dist == BIG_NUMBER ? 0 : (int64_t)row[v].dist + 1;
+        p = put_varint(p, zigzag(d - prev));
+        p = put_varint(p, zigzag(d == 0 ? (int64_t)row[v].pred + 1 : (int64_t)row[v].pred - v));
+        prev = d;
+    }
+    return p - out;
+}
+
+static size_t encode_row(const SparseEntry* row, size_t n, char* out) {
+    char* p = put_varint(out, n);
+    int64_t prev = -1;
+    for (size_t i = 0; i < n; i++) {
+        p = put_varint(p, (uint64_t)(row[i].vert - prev - 1));
+        p = put_varint(p, (uint32_t)row[i].dist);
+        p = put_varint(p, zigzag((int64_t)row[i].pred - row[i].vert));
+        prev = row[i].vert;
+    }
+    return p - out;
+}
+
+static bool decode_record(const char* p, const char* end, int V, Pair* row) {
+    int64_t prev = 0;
+    for (int v = 0; v < V; v++) {
+        uint64_t dd, dp;
+        if (!(p = get_varint(p, end, dd)) || !(p = get_varint(p, end, dp))) return false;
+        int64_t d = prev + unzigzag(dd);
+        row[v].dist = d == 0 ? BIG_NUMBER : (int)(d - 1);
+        row[v].pred = d == 0 ? (int)(unzigzag(dp) - 1) : (int)(unzigzag(dp) + v);
+        prev = d;
+    }
+    return p == end;
+}
+
+static bool decode_record(const char* p, const char* end, std::vector<SparseEntry>& row) {
+    uint64_t n;
+    if (!(p = get_varint(p, end, n)) || n > (uint64_t)(end - p)) return false;
+
+    row.resize(n);
+    int64_t prev = -1;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t gap, dist, pred;
+        if (!(p = get_varint(p, end, gap)) || !(p = get_varint(p, end, dist)) || !(p = get_varint(p, end, pred))) return false;
+        row[i].vert = (int)(prev + 1 + (int64_t)gap);
+        row[i].dist = (int)dist;
+        row[i].pred = (int)(unzigzag(pred) + row[i].vert);
+        prev = row[i].vert;
+    }
+    return p == end;
+}
+
+// Turns the varint record in record[0, n) into the stored record, which is the record itself unless zstd is
+// used. Returns the stored size, or 0 if compression failed (a zstd frame is never empty)
+static size_t pack_record(BinaryMatrixDtype dtype, std::vector<char>& record, size_t n, std::vector<char>& scratch) {
+#ifdef GRAPHGEN_HAVE_ZSTD
+    if (dtype == DTYPE_VARINT_ZSTD) {
+        scratch.resize(ZSTD_compressBound(n));
+        size_t packed = ZSTD_compress(scratch.data(), scratch.size(), record.data(), n, ZSTD_LEVEL);
+        if (ZSTD_isError(packed)) return 0;
+        record.swap(scratch);
+        return packed;
+    }
+#else
+    (void)dtype;
+    (void)record;
+    (void)scratch;
+#endif
+    return n;
+}
+
+// Points [begin, end) at the varint bytes of a stored record, decompressing it into buffer when needed
+static void load_record(const char* bytes, size_t n, uint32_t dtype, std::vector<char>& buffer, const char*& begin, const char*& end) {
+    begin = bytes;
+    end = bytes + n;
+#ifdef GRAPHGEN_HAVE_ZSTD
+    if (dtype == DTYPE_VARINT_ZSTD) {
+        unsigned long long raw = ZSTD_getFrameContentSize(bytes, n);
+        if (raw == ZSTD_CONTENTSIZE_ERROR || raw == ZSTD_CONTENTSIZE_UNKNOWN) throw std::runtime_error("Corrupt zstd record in binary matrix");
+        buffer.resize(raw);
+        size_t got = ZSTD_decompress(buffer.data(), buffer.size(), bytes, n);
+        if (ZSTD_isError(got) || got != raw) throw std::runtime_error("Corrupt zstd record in binary matrix");
+        begin = buffer.data();
+        end = begin + got;
+    }
+#else
+    (void)dtype;
+    (void)buffer;
+#endif
+}
+
+static BinaryMatrixHeader make_header(int W, int V, int max_radius, BinaryMatrixDtype dtype) {
+    BinaryMatrixHeader header = {};
+    std::memcpy(header.magic, BINARY_MATRIX_MAGIC, sizeof(header.magic));
+    header.version = BINARY_MATRIX_VERSION;
+    header.dtype = dtype;
+    header.layout = max_radius > 0 ? LAYOUT_SPARSE : LAYOUT_DENSE;
+    header.max_radius = max_radius;
+    header.W = W;
+    header.V = V;
+    header.data_offset = sizeof(BinaryMatrixHeader);
+    header.row_stride = 0;
+
+    if (header.layout == LAYOUT_DENSE && dtype == DTYPE_INT32) {
+        header.row_stride = ((uint64_t)2 * V * sizeof(int32_t) + 63) / 64 * 64;
+    } else {
+        header.data_offset += ((uint64_t)W + 1) * sizeof(uint64_t);
+    }
+    return header;
+}
+
+BinaryMatrixWriter::BinaryMatrixWriter(BinaryMatrixDtype type) {
+    if (type == DTYPE_VARINT_ZSTD && !BINARY_MATRIX_HAS_ZSTD) {
+        throw std::runtime_error("zstd compression requested but the program was built without zstd");
+    }
+
+    dtype = type;
+    stream_fd = -1;
+    stream_next = 0;
+}
+
+BinaryMatrixWriter::~BinaryMatrixWriter() {
+    if (stream_fd >= 0) close(stream_fd);
+}
+
+// Every row lands at an offset known up front, so rows are converted and written in parallel with pwrite
+void BinaryMatrixWriter::write(std::string filepath, const KeywordDistanceMatrix& mat) {
+    TRACE_ZONE("BinaryMatrixWriter::write");
+    Pair p = mat.get_size();
+    int W = p.pred;
+    int V = p.dist;
+
+    BinaryMatrixHeader header = make_header(W, V, mat.get_max_radius(), dtype);
+
+    int fd = open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to create file " + filepath);
+    }
+
+    if (dtype != DTYPE_INT32) {
+        bool ok = write_compressed(fd, header, mat);
+        close(fd);
+        if (!ok) {
+            throw std::runtime_error("Unable to write to file " + filepath + ": " + std::strerror(errno));
+        }
+        std::cout << "Successfully wrote " << filepath << std::endl;
+        return;
+    }
+
+    std::vector<uint64_t> row_hashes(W);
+    uint64_t seed = FNV_OFFSET;
+    std::atomic<bool> ok(true);
+
+    if (!mat.is_sparse()) {
+        #pragma omp parallel num_threads(get_num_threads())
+        {
+            std::vector<char> block(header.row_stride, 0);
+            int32_t* dist = reinterpret_cast<int32_t*>(block.data());
+            int32_t* pred = dist + V;
+
+            #pragma omp for schedule(dynamic)
+            for (int w = 0; w < W; w++) {
+                const Pair* row = mat.dense_row(w);
+                for (int v = 0; v < V; v++) {
+                    dist[v] = row[v].dist;
+                    pred[v] = row[v].pred;
+                }
+                row_hashes[w] = hash_block(block.data(), block.size());
+                if (!pwrite_all(fd, block.data(), block.size(), header.data_offset + (uint64_t)w * header.row_stride)) ok = false;
+            }
+        }
+    } else {
+        std::vector<uint64_t> offsets(W + 1, 0);
+        for (int w = 0; w < W; w++) {
+            offsets[w + 1] = offsets[w] + mat.sparse_row(w).size();
+        }
+        ok = pwrite_all(fd, offsets.data(), offsets.size() * sizeof(uint64_t), sizeof(BinaryMatrixHeader));
+        seed = hash_block(offsets.data(), offsets.size() * sizeof(uint64_t));
+
+        #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic)
+        for (int w = 0; w < W; w++) {
+            const std::vector<SparseEntry>& row = mat.sparse_row(w);
+            row_hashes[w] = hash_block(row.data(), row.size() * sizeof(SparseEntry));
+            if (!pwrite_all(fd, row.data(), row.size() * sizeof(SparseEntry), header.data_offset + offsets[w] * sizeof(SparseEntry))) ok = false;
+        }
+    }
+
+    // The header goes last so that an interrupted write never looks like a valid file
+    header.checksum = fnv1a64(row_hashes.data(), row_hashes.size() * sizeof(uint64_t), seed);
+    if (ok) ok = pwrite_all(fd, &header, sizeof(header), 0);
+    close(fd);
+
+    if (!ok) {
+        throw std::runtime_error("Unable to write to file " + filepath + ": " + std::strerror(errno));
+    }
+    std::cout << "Successfully wrote " << filepath << std::endl;
+}
+
+// Record sizes are only known once the rows are encoded, so rows are encoded in parallel a batch at a
+// time, a prefix sum over the batch gives their offsets, and they are then written concurrently
+bool BinaryMatrixWriter::write_compressed(int fd, BinaryMatrixHeader& header, const KeywordDistanceMatrix& mat) {
+    const int W = header.W;
+    const int V = header.V;
+
+    std::vector<uint64_t> offsets(W + 1, 0);
+    std::vector<uint64_t> row_hashes(W);
+    bool ok = true;
+
+    size_t batch_rows = mat.is_sparse() ? 4096 : BATCH_BYTES / std::max<size_t>(1, max_record_size(V, false));
+    int batch = std::max<size_t>(1, std::min<size_t>(batch_rows, W));
+    std::vector<std::vector<char>> records(batch);
+    std::vector<size_t> lengths(batch);
+
+    for (int batch_start = 0; batch_start < W && ok; batch_start += batch) {
+        int n = std::min(batch, W - batch_start);
+
+        #pragma omp parallel num_threads(get_num_threads()) reduction(&&:ok)
+        {
+            std::vector<char> scratch;
+
+            #pragma omp for schedule(dynamic)
+            for (int r = 0; r < n; r++) {
+                int w = batch_start + r;
+                TRACE_ZONE("encode_row");
+                size_t raw;
+                if (mat.is_sparse()) {
+                    const std::vector<SparseEntry>& row = mat.sparse_row(w);
+                    records[r].resize(max_record_size(row.size(), true));
+                    raw = encode_row(row.data(), row.size(), records[r].data());
+                } else {
+                    records[r].resize(max_record_size(V, false));
+                    raw = encode_row(mat.dense_row(w), V, records[r].data());
+                }
+
+                lengths[r] = pack_record(dtype, records[r], raw, scratch);
+                if (lengths[r] == 0 && raw != 0) ok = false;
+                row_hashes[w] = hash_block(records[r].data(), lengths[r]);
+            }
+        }
+
+        for (int r = 0; r < n; r++) {
+            offsets[batch_start + r + 1] = offsets[batch_start + r] + lengths[r];
+        }
+
+        #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic) reduction(&&:ok)
+        for (int r = 0; r < n; r++) {
+            ok = pwrite_all(fd, records[r].data(), lengths[r], header.data_offset + offsets[batch_start + r]) && ok;
+        }
+    }
+
+    uint64_t seed = hash_block(offsets.data(), offsets.size() * sizeof(uint64_t));
+    header.checksum = fnv1a64(row_hashes.data(), row_hashes.size() * sizeof(uint64_t), seed);
+    if (ok) ok = pwrite_all(fd, offsets.data(), offsets.size() * sizeof(uint64_t), sizeof(BinaryMatrixHeader));
+    if (ok) ok = pwrite_all(fd, &header, sizeof(header), 0);
+    return ok;
+}
+
+void BinaryMatrixWriter::begin_stream(std::string filepath, int W, int V, int max_radius) {
+    stream_fd = open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (stream_fd < 0) {
+        throw std::runtime_error("Unable to create file " + filepath);
+    }
+
+    stream_path = filepath;
+    stream_next = 0;
+    stream_header = make_header(W, V, max_radius, dtype);
+    stream_hashes.assign(W, 0);
+    stream_offsets.clear();
+    if (stream_header.layout == LAYOUT_SPARSE || dtype != DTYPE_INT32) {
+        stream_offsets.reserve(W + 1);
+        stream_offsets.push_back(0);
+    } else {
+        stream_block.assign(stream_header.row_stride, 0);
+    }
+}
+
+void BinaryMatrixWriter::stream_row(const Pair* row) {
+    const int V = stream_header.V;
+    if (dtype != DTYPE_INT32) {
+        stream_block.resize(max_record_size(V, false));
+        stream_record(encode_row(row, V, stream_block.data()));
+        return;
+    }
+
+    int32_t* dist = reinterpret_cast<int32_t*>(stream_block.data());
+    int32_t* pred = dist + V;
+    for (int v = 0; v < V; v++) {
+        dist[v] = row[v].dist;
+        pred[v] = row[v].pred;
+    }
+
+    int w = stream_next++;
+    stream_hashes[w] = hash_block(stream_block.data(), stream_block.size());
+    if (!pwrite_all(stream_fd, stream_block.data(), stream_block.size(), stream_header.data_offset + (uint64_t)w * stream_header.row_stride)) stream_failed();
+}
+
+void BinaryMatrixWriter::stream_row(const SparseEntry* row, size_t n) {
+    if (dtype != DTYPE_INT32) {
+        stream_block.resize(max_record_size(n, true));
+        stream_record(encode_row(row, n, stream_block.data()));
+        return;
+    }
+
+    int w = stream_next++;
+    uint64_t first = stream_offsets.back();
+    stream_offsets.push_back(first + n);
+    stream_hashes[w] = hash_block(row, n * sizeof(SparseEntry));
+    if (!pwrite_all(stream_fd, row, n * sizeof(SparseEntry), stream_header.data_offset + first * sizeof(SparseEntry))) stream_failed();
+}
+
+// Appends the varint record in stream_block[0, n) as the next row
+void BinaryMatrixWriter::stream_record(size_t n) {
+    size_t length = pack_record(dtype, stream_block, n, stream_scratch);
+    if (length == 0 && n != 0) {
+        errno = EIO;
+        stream_failed();
+    }
+
+    int w = stream_next++;
+    uint64_t first = stream_offsets.back();
+    stream_offsets.push_back(first + length);
+    stream_hashes[w] = hash_block(stream_block.data(), length);
+    if (!pwrite_all(stream_fd, stream_block.data(), length, stream_header.data_offset + first)) stream_failed();
+}
+
+void BinaryMatrixWriter::end_stream() {
+    uint64_t seed = FNV_OFFSET;
+    if (!stream_offsets.empty()) {
+        seed = hash_block(stream_offsets.data(), stream_offsets.size() * sizeof(uint64_t));
+        if (!pwrite_all(stream_fd, stream_offsets.data(), stream_offsets.size() * sizeof(uint64_t), sizeof(BinaryMatrixHeader))) stream_failed();
+    }
+
+    stream_header.checksum = fnv1a64(stream_hashes.data(), stream_hashes.size() * sizeof(uint64_t), seed);
+    if (!pwrite_all(stream_fd, &stream_header, sizeof(stream_header), 0)) stream_failed();
+    close(stream_fd);
+    stream_fd = -1;
+
+    std::cout << "Successfully wrote " << stream_path << std::endl;
+}
+
+void BinaryMatrixWriter::stream_failed() {
+    std::string reason = std::strerror(errno);
+    close(stream_fd);
+    stream_fd = -1;
+    throw std::runtime_error("Unable to write to file " + stream_path + ": " + reason);
+}
+
+// Rows hold V dists then V preds, start after the header and must all end inside the file. Written so that no
+// product of header fields can overflow, the fields come from an untrusted file
+static bool dense_layout_fits(const BinaryMatrixHeader& h, size_t size) {
+    if (h.data_offset < sizeof(BinaryMatrixHeader) || h.data_offset > size) return false;
+    if (h.V > size / (2 * sizeof(int32_t)) || h.row_stride < 2 * h.V * sizeof(int32_t)) return false;
+    return h.row_stride == 0 || h.W <= (size - h.data_offset) / h.row_stride;
+}
+
+BinaryMatrixReader::BinaryMatrixReader(std::string filepath) {
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file " + filepath);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BinaryMatrixHeader)) {
+        close(fd);
+        throw std::runtime_error("Not a binary matrix: " + filepath);
+    }
+
+    size = st.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Unable to map file " + filepath);
+    }
+
+    data = static_cast<const char*>(mapping);
+    header = reinterpret_cast<const BinaryMatrixHeader*>(data);
+    offsets = nullptr;
+
+    // Sparse and compressed files carry a row index; its unit is an entry for sparse int32 rows and a byte otherwise
+    bool indexed = header->layout == LAYOUT_SPARSE || header->dtype != DTYPE_INT32;
+    size_t unit = header->dtype == DTYPE_INT32 ? sizeof(SparseEntry) : 1;
+
+    std::string problem;
+    if (std::memcmp(header->magic, BINARY_MATRIX_MAGIC, sizeof(header->magic)) != 0) problem = "Not a binary matrix: ";
+    else if (header->version != BINARY_MATRIX_VERSION) problem = "Unsupported binary matrix version in ";
+    else if (header->dtype != DTYPE_INT32 && header->dtype != DTYPE_VARINT && header->dtype != DTYPE_VARINT_ZSTD) problem = "Unsupported binary matrix dtype in ";
+    else if (header->dtype == DTYPE_VARINT_ZSTD && !BINARY_MATRIX_HAS_ZSTD) problem = "Built without zstd, unable to read ";
+    else if (header->layout != LAYOUT_DENSE && header->layout != LAYOUT_SPARSE) problem = "Unsupported binary matrix layout in ";
+    else if (!indexed && !dense_layout_fits(*header, size)) problem = "Truncated binary matrix: ";
+    else if (indexed) {
+        offsets = reinterpret_cast<const uint64_t*>(data + sizeof(BinaryMatrixHeader));
+        if (header->data_offset != sizeof(BinaryMatrixHeader) + (header->W + 1) * sizeof(uint64_t) || header->data_offset > size) problem = "Truncated binary matrix: ";
+        else if (header->data_offset + offsets[header->W] * unit > size) problem = "Truncated binary matrix: ";
+        else if (!std::is_sorted(offsets, offsets + header->W + 1)) problem = "Corrupt row index in binary matrix ";
+    }
+
+    if (!problem.empty()) {
+        munmap(mapping, size);
+        throw std::runtime_error(problem + filepath);
+    }
+}
+
+BinaryMatrixReader::~BinaryMatrixReader() {
+    munmap(const_cast<char*>(data), size);
+}
+
+Pair BinaryMatrixReader::get_size() const {
+    Pair p = {(int)header->W, (int)header->V};
+    return p;
+}
+
+const int32_t* BinaryMatrixReader::dist_row(int w) const {
+    return reinterpret_cast<const int32_t*>(data + header->data_offset + (uint64_t)w * header->row_stride);
+}
+
+const int32_t* BinaryMatrixReader::pred_row(int w) const {
+    return dist_row(w) + header->V;
+}
+
+const SparseEntry* BinaryMatrixReader::sparse_row(int w) const {
+    return reinterpret_cast<const SparseEntry*>(data + header->data_offset) + offsets[w];
+}
+
+size_t BinaryMatrixReader::sparse_row_size(int w) const {
+    return offsets[w + 1] - offsets[w];
+}
+
+void BinaryMatrixReader::decode_row(int w, std::vector<Pair>& row) const {
+    const int V = header->V;
+    row.resize(V);
+    if (!is_compressed()) {
+        for (int v = 0; v < V; v++) row[v] = {pred_row(w)[v], dist_row(w)[v]};
+        return;
+    }
+
+    thread_local std::vector<char> buffer;
+    const char *begin, *end;
+    load_record(data + header->data_offset + offsets[w], offsets[w + 1] - offsets[w], header->dtype, buffer, begin, end);
+    if (!decode_record(begin, end, V, row.data())) {
+        throw std::runtime_error("Corrupt row " + std::to_string(w) + " in binary matrix");
+    }
+}
+
+void BinaryMatrixReader::decode_row(int w, std::vector<SparseEntry>& row) const {
+    if (!is_compressed()) {
+        row.assign(sparse_row(w), sparse_row(w) + sparse_row_size(w));
+        return;
+    }
+
+    thread_local std::vector<char> buffer;
+    const char *begin, *end;
+    load_record(data + header->data_offset + offsets[w], offsets[w + 1] - offsets[w], header->dtype, buffer, begin, end);
+    if (!decode_record(begin, end, row)) {
+        throw std::runtime_error("Corrupt row " + std::to_string(w) + " in binary matrix");
+    }
+}
+
+Pair BinaryMatrixReader::operator()(int w, int v) const {
+    if (!is_sparse() && !is_compressed()) return {pred_row(w)[v], dist_row(w)[v]};
+
+    if (!is_sparse()) {
+        thread_local std::vector<Pair> decoded;
+        decode_row(w, decoded);
+        return decoded[v];
+    }
+
+    thread_local std::vector<SparseEntry> decoded;
+    const SparseEntry* row;
+    const SparseEntry* end;
+    if (is_compressed()) {
+        decode_row(w, decoded);
+        row = decoded.data();
+        end = row + decoded.size();
+    } else {
+        row = sparse_row(w);
+        end = row + sparse_row_size(w);
+    }
+
+    const SparseEntry* it = std::lower_bound(row, end, v, [](const SparseEntry& e, int vert) { return e.vert < vert; });
+    if (it == end || it->vert != v) return {-1, BIG_NUMBER};
+    return {it->pred, it->dist};
+}
+
+bool BinaryMatrixReader::verify() const {
+    const int W = header->W;
+    std::vector<uint64_t> row_hashes(W);
+    uint64_t seed = FNV_OFFSET;
+    if (offsets) seed = hash_block(offsets, (W + 1) * sizeof(uint64_t));
+
+    #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic)
+    for (int w = 0; w < W; w++) {
+        if (is_compressed()) row_hashes[w] = hash_block(data + header->data_offset + offsets[w], offsets[w + 1] - offsets[w]);
+        else if (is_sparse()) row_hashes[w] = hash_block(sparse_row(w), sparse_row_size(w) * sizeof(SparseEntry));
+        else row_hashes[w] = hash_block(dist_row(w), header->row_stride);
+    }
+
+    return fnv1a64(row_hashes.data(), row_hashes.size() * sizeof(uint64_t), seed) == header->checksum;
+}
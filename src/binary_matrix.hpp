@@ -0,0 +1,123 @@
+#ifndef EVA_BINARY_MATRIX
+#define EVA_BINARY_MATRIX
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "keyword_distance_matrix.hpp"
+
+/*! Binary keyword-distance matrix file that can be memory-mapped and read without any parsing.
+ *
+ * The file starts with a 64-byte BinaryMatrixHeader. In the dense layout every keyword row is one
+ * 64-byte aligned block of row_stride bytes holding a dist column of V int32 values followed by a
+ * pred column of V int32 values, so a consumer can point straight into the mapping. In the sparse
+ * layout the header is followed by W + 1 uint64 entry offsets and then the SparseEntry cells of every
+ * row back to back. All values are little endian. The checksum combines a hash_block() of each row.
+ *
+ * Compressed dtypes keep the logical layout but replace the row data with one variable-length record per
+ * row: the header is followed by W + 1 uint64 byte offsets of the records, so any row can still be found
+ * without scanning. A DTYPE_VARINT record encodes every cell with LEB128 varints: dense rows store the
+ * zigzag delta of dist + 1 (0 meaning unreachable) to the previous cell and pred relative to the cell's
+ * own vertex, sparse rows store the cell count, the gap to the previous vertex, dist and pred relative to
+ * the vertex. DTYPE_VARINT_ZSTD additionally compresses every record as its own zstd frame.
+ */
+
+const char     BINARY_MATRIX_MAGIC[8] = {'E', 'V', 'A', 'K', 'D', 'M', 0, 0};
+const uint32_t BINARY_MATRIX_VERSION = 1;
+
+enum BinaryMatrixDtype : uint32_t {
+    DTYPE_INT32 = 1,
+    DTYPE_VARINT = 2,       //!< Delta/varint encoded rows
+    DTYPE_VARINT_ZSTD = 3,  //!< Varint rows compressed with zstd, needs GRAPHGEN_HAVE_ZSTD
+};
+
+#ifdef GRAPHGEN_HAVE_ZSTD
+const bool BINARY_MATRIX_HAS_ZSTD = true;
+#else
+const bool BINARY_MATRIX_HAS_ZSTD = false;
+#endif
+
+enum BinaryMatrixLayout : uint32_t {
+    LAYOUT_DENSE = 1,     //!< Per keyword: dist[V], pred[V]
+    LAYOUT_SPARSE = 2,    //!< Row offsets, then (vert, dist, pred) cells
+};
+
+struct BinaryMatrixHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t layout;
+    int32_t  max_radius;  //!< 0 for dense matrices
+    uint64_t W;
+    uint64_t V;
+    uint64_t data_offset; //!< First byte of the row data
+    uint64_t row_stride;  //!< Bytes per row block in the uncompressed dense layout
+    uint64_t checksum;
+};
+static_assert(sizeof(BinaryMatrixHeader) == 64, "BinaryMatrixHeader must stay 64 bytes");
+
+class BinaryMatrixWriter {
+public:
+    BinaryMatrixWriter(BinaryMatrixDtype dtype = DTYPE_INT32);
+    ~BinaryMatrixWriter();
+
+    void write(std::string filepath, const KeywordDistanceMatrix& matrix);
+
+    // Row-by-row output for matrices that are never held in memory as a whole. Rows must come in keyword order
+    void begin_stream(std::string filepath, int W, int V, int max_radius);
+    void stream_row(const Pair* row);
+    void stream_row(const SparseEntry* row, size_t n);
+    void end_stream();
+    uint64_t stream_checksum() const { return stream_header.checksum; } //!< Header checksum of the last finished stream
+
+private:
+    bool write_compressed(int fd, BinaryMatrixHeader& header, const KeywordDistanceMatrix& matrix);
+    void stream_record(size_t n);
+    void stream_failed();
+
+    BinaryMatrixDtype     dtype;
+    std::string           stream_path;
+    int                   stream_fd;
+    int                   stream_next;      //!< Keyword of the next streamed row
+    BinaryMatrixHeader    stream_header;
+    std::vector<uint64_t> stream_hashes;
+    std::vector<uint64_t> stream_offsets;   //!< Sparse or compressed layouts only
+    std::vector<char>     stream_block;     //!< Row being written
+    std::vector<char>     stream_scratch;
+};
+
+/*! Zero-copy view of a binary matrix file. Pointers returned by the accessors live as long as the reader.
+ * Compressed files can only be read through decode_row() and operator(), which decodes the whole row
+ */
+class BinaryMatrixReader {
+public:
+    BinaryMatrixReader(std::string filepath);
+    ~BinaryMatrixReader();
+    BinaryMatrixReader(const BinaryMatrixReader&) = delete;
+    BinaryMatrixReader& operator=(const BinaryMatrixReader&) = delete;
+
+    Pair operator()(int w, int v) const;
+    Pair get_size() const;
+    int  get_max_radius() const                 { return header->max_radius;              }
+    bool is_sparse() const                      { return header->layout == LAYOUT_SPARSE; }
+    bool is_compressed() const                  { return header->dtype != DTYPE_INT32;    }
+    BinaryMatrixDtype get_dtype() const         { return (BinaryMatrixDtype)header->dtype; }
+    uint64_t get_checksum() const               { return header->checksum;                }
+    bool verify() const;                        //!< Recomputes the checksum
+
+    const int32_t*     dist_row(int w) const;   //!< Uncompressed dense layout only
+    const int32_t*     pred_row(int w) const;   //!< Uncompressed dense layout only
+    const SparseEntry* sparse_row(int w) const; //!< Uncompressed sparse layout only
+    size_t             sparse_row_size(int w) const;
+
+    void decode_row(int w, std::vector<Pair>& row) const;        //!< Any dense file
+    void decode_row(int w, std::vector<SparseEntry>& row) const; //!< Any sparse file
+
+private:
+    const char*               data;
+    size_t                    size;
+    const BinaryMatrixHeader* header;
+    const uint64_t*           offsets;          //!< Entry offsets of the sparse layout, byte offsets of compressed records
+};
+
+#endif
@@ -0,0 +1,772 @@
+#include <chrono>
+#include <fstream>
+#include <climits>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "graph.hpp"
+#include "graph_generator.hpp"
+#include "csr_graph.hpp"
+#include "keyword_distance_matrix.hpp"
+#include "csv_writer.hpp"
+#include "binary_matrix.hpp"
+#include "matrix_pipeline.hpp"
+#include "graph_snapshot.hpp"
+#include "graph_loader.hpp"
+#include "graph_cache.hpp"
+#include "sharded_writer.hpp"
+#include "thread_config.hpp"
+#include "sweep_runner.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "memory_budget.hpp"
+#include "matrix_checkpoint.hpp"
+#include "shard_coordinator.hpp"
+#include "query_server.hpp"
+#include "distance_index.hpp"
+#include "keyword_search.hpp"
+#include "force_directed_layout.hpp"
+
+// Headless entry point: generate -> matrix -> write without a window, GL context or ImGui
+
+struct CLIOptions {
+    GraphParameters   graph;
+    uint64_t          seed = 0;
+    bool              random_seed = true;
+    MatrixEngine      engine = ENGINE_CPU;
+    int               landmarks = 16;
+    double            validate_approx = -1;    //!< Percent of error --engine approx may have against the exact engine, < 0 skips the check
+    int               radius = 0;
+    int               threads = 0;             //!< 0 keeps the default
+    bool              binary = false;
+    BinaryMatrixDtype dtype = DTYPE_INT32;
+    std::string       output = "keyword_distance_matrix";
+    int               shards = 1;
+    bool              stream = false;
+    std::string       load_snapshot;
+    std::string       save_snapshot;
+    std::string       edges;                   //!< Edge list to import instead of generating a graph
+    std::string       keyword_list;            //!< Keywords of the imported vertices, empty imports none
+    int               default_weight = 1;      //!< Weight of imported edges without a weight column
+    std::string       cache_directory;         //!< Empty disables the cache
+    uint64_t          cache_bytes = GRAPH_CACHE_DEFAULT_BYTES;
+    std::string       sweep;                   //!< Sweep spec, replaces the single run
+    std::string       results = "sweep_results.csv";
+    std::string       metrics = "human";       //!< Progress report format, none disables it
+    double            metrics_interval = METRICS_DEFAULT_INTERVAL;
+    std::string       metrics_file;            //!< Empty reports to stderr
+    std::string       trace_file;              //!< Chrome trace of the run, empty disables tracing
+    uint64_t          memory_budget = 0;       //!< Bytes, 0 = no budget
+    bool              estimate = false;        //!< Only print the memory estimate
+    std::string       checkpoint;              //!< Checkpoint file of the matrix rows, empty disables checkpoints
+    double            checkpoint_interval = MATRIX_CHECKPOINT_DEFAULT_INTERVAL;
+    bool              resume = false;
+    int               workers = 0;             //!< Worker processes, 0 computes in this process
+    int               worker_shards = 0;       //!< 0 = four per worker
+    int               worker_fd = -1;          //!< >= 0 in a worker started by a coordinator
+    std::string       index;                   //!< pll or alt: build and save that index instead of the matrix
+    std::string       layout;                  //!< stochastic or barnes-hut: lay the graph out instead of computing the matrix
+    double            theta = ForceDirectedParams().theta;
+    int               layout_iterations = ForceDirectedParams().max_iterations;
+    std::string       layout_output = "layout.csv";
+    std::string       serve;                   //!< Socket to serve --matrix on, replaces the single run
+    std::string       matrix;                  //!< Stored matrix to serve or search instead of computing one
+    std::string       search;                  //!< Comma-separated keywords of one query
+    std::string       search_batch;            //!< File of queries, one per line
+    int               top_k = 10;
+    bool              search_scan = false;     //!< Full SIMD scan instead of the threshold algorithm
+    std::string       query_load;              //!< Socket of a server to send generated load to
+    QueryLoadOptions  load;
+};
+
+static void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [options]\n"
+              << "\n"
+              << "Graph:\n"
+              << "  --vertices N          Number of vertices (default 30)\n"
+              << "  --keywords N          Number of keywords (default 10)\n"
+              << "  --min-degree N        --max-degree N\n"
+              << "  --min-keywords N      --max-keywords N\n"
+              << "  --min-weight N        --max-weight N\n"
+              << "  --seed S              Generator seed (default: current time)\n"
+              << "  --load-snapshot FILE  Use a saved graph instead of generating one\n"
+              << "  --save-snapshot FILE  Save the graph before computing the matrix\n"
+              << "  --edges FILE          Import a \"start end [weight]\" edge list instead of generating a graph\n"
+              << "  --keyword-list FILE   Keywords of the imported graph, one \"vertex keyword ...\" line per vertex\n"
+              << "  --default-weight N    Weight of imported edges without a weight column (default 1)\n"
+              << "\n"
+              << "Matrix:\n"
+              << "  --engine cpu|approx   Exact CPU engine or landmark approximation (default cpu)\n"
+              << "  --landmarks N         Landmarks of the approximate engine (default 16)\n"
+              << "  --validate-approx PCT Also run the exact engine and fail when the approximation's mean relative\n"
+              << "                        error or share of missed reachable cells exceeds PCT percent\n"
+              << "  --radius R            Only keep distances <= R, 0 computes the dense matrix\n"
+              << "  --threads N           Worker threads (default " << get_num_threads() << ")\n"
+              << "\n"
+              << "  --build-index I       Build the pll (exact 2-hop labels, with keyword labels) or alt (--landmarks)\n"
+              << "                        distance index and save it as NAME.pll or NAME.alt instead of the matrix\n"
+              << "\n"
+              << "Layout:\n"
+              << "  --layout R            Lay the graph out with stochastic or barnes-hut repulsion and write the\n"
+              << "                        positions instead of computing the matrix\n"
+              << "  --theta X             Barnes-Hut opening angle, 0 is exact (default " << ForceDirectedParams().theta << ")\n"
+              << "  --layout-iterations N Iterations of the layout (default " << ForceDirectedParams().max_iterations << ")\n"
+              << "  --layout-output FILE  CSV of vertex,x,y (default layout.csv)\n"
+              << "\n"
+              << "Output:\n"
+              << "  --format F            csv, bin, varint or zstd (default csv)\n"
+              << "  --output NAME         Output name without extension (default keyword_distance_matrix)\n"
+              << "  --shards N            Split the output into N files with a manifest\n"
+              << "  --stream              Write rows while they are computed, exact engine only\n"
+              << "  --cache DIR           Reuse generated graphs and matrices stored in DIR\n"
+              << "  --cache-mb N          Cache budget in MB, 0 = unbounded (default 4096)\n"
+              << "\n"
+              << "Checkpoints:\n"
+              << "  --checkpoint FILE     Save finished keyword rows to FILE and FILE.rows, exact engine only. The\n"
+              << "                        files are removed once the matrix is written\n"
+              << "  --checkpoint-interval S\n"
+              << "                        Seconds between two checkpoints (default 300)\n"
+              << "  --resume              Skip the keywords finished in the --checkpoint file. Without --seed the\n"
+              << "                        graph is regenerated with the seed stored in the checkpoint\n"
+              << "\n"
+              << "Processes:\n"
+              << "  --workers N           Compute the matrix in N worker processes that share a graph snapshot and\n"
+              << "                        merge their rows into one output, exact engine only. Failed shards are\n"
+              << "                        handed to another worker. --threads is split between the workers\n"
+              << "  --worker-shards N     Keyword ranges handed out to the workers (default four per worker)\n"
+              << "\n"
+              << "Search:\n"
+              << "  --search K1,K2,...    Print the --top-k roots closest in sum to the keywords and their trees\n"
+              << "  --search-batch FILE   Answer the queries in FILE (one per line, keywords separated by commas or\n"
+              << "                        spaces) on --threads threads and report the throughput\n"
+              << "  --top-k N             Roots per query (default 10)\n"
+              << "  --search-method M     ta (threshold algorithm, default) or scan\n"
+              << "                        Searches run on the --matrix file if given, else on the computed matrix\n"
+              << "\n"
+              << "Server:\n"
+              << "  --serve SOCKET        Answer dist, nearest and path requests for --matrix on a Unix socket until\n"
+              << "                        SIGINT or SIGTERM, batches are split over --threads threads\n"
+              << "  --matrix FILE         Binary matrix file to serve or search\n"
+              << "  --query-load SOCKET   Send random requests to a server and report queries/s and latency\n"
+              << "  --load-connections N  Client connections (default 4)\n"
+              << "  --load-requests N     Requests over all connections (default 100000)\n"
+              << "  --load-depth N        Requests in flight per connection (default 1)\n"
+              << "  --load-kind K         dist, nearest, path or mix (default mix)\n"
+              << "  --load-k N            k of nearest requests (default 10)\n"
+              << "\n"
+              << "Sweep:\n"
+              << "  --sweep FILE          Run every combination of a sweep spec on one shared thread pool\n"
+              << "                        of --threads threads, the graph and matrix options above are ignored\n"
+              << "  --results FILE        Table of the sweep runs with timings (default sweep_results.csv)\n"
+              << "\n"
+              << "Metrics:\n"
+              << "  --metrics F           Progress, throughput and counters as human, json (one object per line)\n"
+              << "                        or none (default human)\n"
+              << "  --metrics-interval S  Seconds between two reports (default 1)\n"
+              << "  --metrics-file FILE   Write the reports to FILE instead of stderr\n"
+              << "  --trace FILE          Record timing zones and write them as a Chrome trace (chrome://tracing,\n"
+              << "                        ui.perfetto.dev)\n"
+              << "\n"
+              << "Memory:\n"
+              << "  --memory-budget MB    Refuse jobs predicted to need more, or stream the matrix when that fits.\n"
+              << "                        auto uses the memory currently available. Sweeps also start runs only\n"
+              << "                        while the running ones leave room\n"
+              << "  --estimate            Print the predicted peak memory and exit\n"
+              << "  --help\n";
+}
+
+static long parseNumber(const std::string& flag, const std::string& value, long min, long max = LONG_MAX) {
+    size_t used = 0;
+    long n = 0;
+    try {
+        n = std::stol(value, &used);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    if (used != value.size() || used == 0 || n < min || n > max) {
+        throw std::runtime_error("Invalid value '" + value + "' for " + flag);
+    }
+    return n;
+}
+
+static double parsePositive(const std::string& flag, const std::string& value, bool zero = false) {
+    size_t used = 0;
+    double n = 0;
+    try {
+        n = std::stod(value, &used);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    if (used == 0 || used != value.size() || !(n > 0 || (zero && n == 0))) {
+        throw std::runtime_error("Invalid value '" + value + "' for " + flag);
+    }
+    return n;
+}
+
+static CLIOptions parseArguments(int argc, char** argv) {
+    CLIOptions o;
+
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--help" || flag == "-h") {
+            printUsage(argv[0]);
+            std::exit(0);
+        }
+        if (flag == "--stream") {
+            o.stream = true;
+            continue;
+        }
+        if (flag == "--estimate") {
+            o.estimate = true;
+            continue;
+        }
+        if (flag == "--resume") {
+            o.resume = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            throw std::runtime_error("Missing value for " + flag);
+        }
+        std::string value = argv[++i];
+        auto number = [&](long min) { return (int)parseNumber(flag, value, min, INT_MAX); };
+
+        if      (flag == "--vertices")      o.graph.n_vertices = number(1);
+        else if (flag == "--keywords")      o.graph.n_keywords = number(1);
+        else if (flag == "--min-degree")    o.graph.min_degree = number(0);
+        else if (flag == "--max-degree")    o.graph.max_degree = number(0);
+        else if (flag == "--min-keywords")  o.graph.min_keywords = number(0);
+        else if (flag == "--max-keywords")  o.graph.max_keywords = number(0);
+        else if (flag == "--min-weight")    o.graph.min_weight = number(0);
+        else if (flag == "--max-weight")    o.graph.max_weight = number(0);
+        else if (flag == "--landmarks")     o.landmarks = number(1);
+        else if (flag == "--radius")        o.radius = number(0);
+        else if (flag == "--threads")       o.threads = number(1);
+        else if (flag == "--shards")        o.shards = number(1);
+        else if (flag == "--workers")       o.workers = number(1);
+        else if (flag == "--worker-shards") o.worker_shards = number(1);
+        else if (flag == "--worker")        o.worker_fd = number(0);
+        else if (flag == "--output")        o.output = value;
+        else if (flag == "--load-snapshot") o.load_snapshot = value;
+        else if (flag == "--save-snapshot") o.save_snapshot = value;
+        else if (flag == "--edges")         o.edges = value;
+        else if (flag == "--keyword-list")  o.keyword_list = value;
+        else if (flag == "--default-weight") o.default_weight = number(1);
+        else if (flag == "--cache")         o.cache_directory = value;
+        else if (flag == "--sweep")         o.sweep = value;
+        else if (flag == "--results")       o.results = value;
+        else if (flag == "--metrics-file")  o.metrics_file = value;
+        else if (flag == "--trace")         o.trace_file = value;
+        else if (flag == "--checkpoint")    o.checkpoint = value;
+        else if (flag == "--validate-approx") {
+            o.validate_approx = parsePositive(flag, value);
+        }
+        else if (flag == "--build-index") {
+            if (value != "pll" && value != "alt") throw std::runtime_error("Unknown index '" + value + "'");
+            o.index = value;
+        }
+        else if (flag == "--layout") {
+            if (value != "stochastic" && value != "barnes-hut") throw std::runtime_error("Unknown layout '" + value + "'");
+            o.layout = value;
+        }
+        else if (flag == "--theta")         o.theta = parsePositive(flag, value, true);
+        else if (flag == "--layout-iterations") o.layout_iterations = number(1);
+        else if (flag == "--layout-output") o.layout_output = value;
+        else if (flag == "--serve")         o.serve = value;
+        else if (flag == "--search")        o.search = value;
+        else if (flag == "--search-batch")  o.search_batch = value;
+        else if (flag == "--top-k")         o.top_k = number(1);
+        else if (flag == "--search-method") {
+            if (value != "ta" && value != "scan") throw std::runtime_error("Unknown search method '" + value + "'");
+            o.search_scan = value == "scan";
+        }
+        else if (flag == "--matrix")        o.matrix = value;
+        else if (flag == "--query-load")    o.query_load = value;
+        else if (flag == "--load-connections") o.load.connections = number(1);
+        else if (flag == "--load-requests") o.load.requests = parseNumber(flag, value, 1);
+        else if (flag == "--load-depth")    o.load.depth = number(1);
+        else if (flag == "--load-kind")     o.load.kind = value;
+        else if (flag == "--load-k")        o.load.k = number(0);
+        else if (flag == "--memory-budget") {
+            o.memory_budget = value == "auto" ? available_memory() : (uint64_t)parseNumber(flag, value, 1) << 20;
+            if (o.memory_budget == 0) throw std::runtime_error("Unable to read the available memory, give --memory-budget in MB");
+        }
+        else if (flag == "--cache-mb")      o.cache_bytes = (uint64_t)parseNumber(flag, value, 0) << 20;
+        else if (flag == "--seed") {
+            o.seed = parseNumber(flag, value, 0, UINT32_MAX); // GraphGenerator takes an unsigned seed
+            o.random_seed = false;
+        } else if (flag == "--metrics") {
+            if (value != "none") MetricsReporter::parse_format(value);
+            o.metrics = value;
+        } else if (flag == "--metrics-interval") {
+            o.metrics_interval = parsePositive(flag, value);
+        } else if (flag == "--checkpoint-interval") {
+            o.checkpoint_interval = parsePositive(flag, value);
+        } else if (flag == "--engine") {
+            if (value == "cpu") o.engine = ENGINE_CPU;
+            else if (value == "approx") o.engine = ENGINE_APPROX;
+            else if (value == "gpu") throw std::runtime_error("The GPU engine needs a GL context, use the graphical build");
+            else throw std::runtime_error("Unknown engine '" + value + "'");
+        } else if (flag == "--format") {
+            o.binary = value != "csv";
+            if (value == "csv" || value == "bin") o.dtype = DTYPE_INT32;
+            else if (value == "varint") o.dtype = DTYPE_VARINT;
+            else if (value == "zstd") o.dtype = DTYPE_VARINT_ZSTD;
+            else throw std::runtime_error("Unknown format '" + value + "'");
+        } else {
+            throw std::runtime_error("Unknown option " + flag);
+        }
+    }
+
+    const GraphParameters& g = o.graph;
+    if (g.min_degree > g.max_degree || g.min_keywords > g.max_keywords || g.min_weight > g.max_weight) {
+        throw std::runtime_error("Every minimum must be at most its maximum");
+    }
+    if (o.dtype == DTYPE_VARINT_ZSTD && !BINARY_MATRIX_HAS_ZSTD) {
+        throw std::runtime_error("This build has no zstd support");
+    }
+    if (o.stream && (o.engine != ENGINE_CPU || o.shards > 1)) {
+        throw std::runtime_error("--stream needs the cpu engine and a single output file");
+    }
+    if (!o.checkpoint.empty() && o.engine != ENGINE_CPU) {
+        throw std::runtime_error("--checkpoint needs the cpu engine");
+    }
+    if (o.workers > 0 && (o.engine != ENGINE_CPU || o.shards > 1 || !o.checkpoint.empty())) {
+        throw std::runtime_error("--workers needs the cpu engine, a single output file and no --checkpoint");
+    }
+    if (!o.edges.empty() && !o.load_snapshot.empty()) {
+        throw std::runtime_error("--edges and --load-snapshot both replace the generated graph, give one");
+    }
+    if (!o.keyword_list.empty() && o.edges.empty()) {
+        throw std::runtime_error("--keyword-list needs --edges");
+    }
+    if (o.worker_fd >= 0 && o.load_snapshot.empty()) {
+        throw std::runtime_error("--worker needs --load-snapshot");
+    }
+    if (o.validate_approx >= 0 && o.engine != ENGINE_APPROX) {
+        throw std::runtime_error("--validate-approx needs --engine approx");
+    }
+    bool searching = !o.search.empty() || !o.search_batch.empty();
+    if (searching && o.matrix.empty() && (o.stream || o.workers > 0 || o.shards > 1)) {
+        throw std::runtime_error("--search needs --matrix or a matrix computed in memory, without --stream, --workers or --shards");
+    }
+    if (!o.serve.empty() && o.matrix.empty()) {
+        throw std::runtime_error("--serve needs --matrix");
+    }
+    if (o.resume && o.checkpoint.empty()) {
+        throw std::runtime_error("--resume needs --checkpoint");
+    }
+    if (!o.trace_file.empty() && !TRACE_COMPILED) {
+        throw std::runtime_error("This build has no tracing, configure with -DGRAPHGEN_TRACING=ON");
+    }
+    if (o.random_seed) o.seed = std::time(nullptr);
+    return o;
+}
+
+static double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The estimator only knows generator parameters, an imported graph gets the ones of a generated graph
+// of the same size: its mean degree and keyword count rounded down and up, and its real weight range
+static CSRGraph<int> importGraph(CLIOptions& o) {
+    GraphLoader loader;
+    loader.set_default_weight(o.default_weight);
+    CSRGraph<int> csr = loader.load(o.edges, o.keyword_list);
+
+    GraphParameters& g = o.graph;
+    double degree = csr.n_vertices ? (double)csr.n_edges() / csr.n_vertices : 0;
+    double keywords = csr.n_vertices ? (double)csr.keyword_vertices.size() / csr.n_vertices : 0;
+    g.n_vertices = csr.n_vertices;
+    g.n_keywords = csr.n_keywords;
+    g.min_degree = (int)std::floor(degree);
+    g.max_degree = (int)std::ceil(degree);
+    g.min_keywords = (int)std::floor(keywords);
+    g.max_keywords = (int)std::ceil(keywords);
+    g.min_weight = csr.weights.empty() ? 0 : *std::min_element(csr.weights.begin(), csr.weights.end());
+    g.max_weight = loader.get_max_weight();
+    o.seed = 0;
+    return csr;
+}
+
+// Only generated graphs are cached, a loaded snapshot may come from another generator version
+static CSRGraph<int> makeGraph(CLIOptions& o, GraphCache* cache) {
+    if (!o.load_snapshot.empty()) {
+        GraphSnapshotReader reader(o.load_snapshot);
+        o.graph = reader.get_params();
+        o.seed = reader.get_seed();
+        return reader.to_csr();
+    }
+
+    if (cache) {
+        std::unique_ptr<GraphSnapshotReader> stored = cache->find_graph(o.graph, o.seed);
+        if (stored) return stored->to_csr();
+    }
+
+    const GraphParameters& g = o.graph;
+    GraphGenerator<int> gen(o.seed, 5, 5);
+    SparseGraph<int>* graph = gen.generate(g.n_vertices, g.n_keywords, g.min_keywords, g.max_keywords, g.min_degree, g.max_degree, g.min_weight, g.max_weight);
+    CSRGraph<int> csr(*graph, g.n_keywords);
+    delete graph;
+
+    if (cache) cache->store_graph(csr, o.graph, o.seed);
+    return csr;
+}
+
+static void writeMatrix(const CLIOptions& o, const KeywordDistanceMatrix& mat) {
+    if (o.shards > 1) {
+        ShardedMatrixWriter writer(".", o.output);
+        writer.set_shard_count(o.shards);
+        writer.set_binary(o.binary, o.dtype);
+        writer.write(mat);
+    } else if (o.binary) {
+        BinaryMatrixWriter writer(o.dtype);
+        writer.write(o.output + ".bin", mat);
+    } else {
+        CSVWriter writer;
+        writer.write(o.output + ".csv", mat);
+    }
+}
+
+static std::string formatName(BinaryMatrixDtype dtype) {
+    if (dtype == DTYPE_VARINT) return "varint";
+    if (dtype == DTYPE_VARINT_ZSTD) return "zstd";
+    return "bin";
+}
+
+// Workers run this program again in worker mode on a snapshot of the graph, the one given on the command
+// line if there is one. Shards of a CSV output are written as varint matrices, which are the smallest to merge
+static void runWorkers(const CLIOptions& o, const CSRGraph<int>& csr) {
+    char exe[4096];
+    ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (length < 0) {
+        throw std::runtime_error("Unable to find the program to start the workers with");
+    }
+    exe[length] = 0;
+
+    std::string snapshot = !o.load_snapshot.empty() ? o.load_snapshot : o.save_snapshot;
+    bool temporary = snapshot.empty();
+    if (temporary) {
+        snapshot = o.output + ".graph.snapshot";
+        GraphSnapshotWriter writer;
+        writer.write(snapshot, csr, o.graph, o.seed);
+    }
+
+    BinaryMatrixDtype shard_dtype = o.binary ? o.dtype : DTYPE_VARINT;
+    int threads = std::max(1, get_num_threads() / o.workers);
+    std::vector<std::string> command = {exe, "--worker", std::to_string(SHARD_WORKER_FD), "--load-snapshot", snapshot,
+                                        "--radius", std::to_string(o.radius), "--format", formatName(shard_dtype),
+                                        "--threads", std::to_string(threads), "--metrics", "none"};
+
+    try {
+        ShardCoordinator coordinator(command, csr.n_keywords);
+        coordinator.set_workers(o.workers);
+        coordinator.set_shard_count(o.worker_shards);
+        std::vector<ShardInfo> shards = coordinator.run(o.output);
+        coordinator.merge(shards, o.output + (o.binary ? ".bin" : ".csv"), o.binary, o.dtype);
+    } catch (...) {
+        if (temporary) std::remove(snapshot.c_str());
+        throw;
+    }
+    if (temporary) std::remove(snapshot.c_str());
+}
+
+static std::vector<int> parseKeywords(const std::string& flag, std::string text) {
+    std::replace(text.begin(), text.end(), ',', ' ');
+    std::istringstream words(text);
+    std::vector<int> keywords;
+    std::string word;
+    while (words >> word) keywords.push_back(parseNumber(flag, word, 0, INT_MAX));
+    return keywords;
+}
+
+static void runSearch(const CLIOptions& o, const KeywordSearchEngine& engine) {
+    if (!o.search.empty()) {
+        std::vector<int> keywords = parseKeywords("--search", o.search);
+        if (keywords.empty()) throw std::runtime_error("--search needs at least one keyword");
+        auto start = std::chrono::steady_clock::now();
+        std::vector<SearchResult> results = o.search_scan ? engine.query_scan(keywords, o.top_k) : engine.query(keywords, o.top_k);
+        std::cout << "Search: " << results.size() << " roots (" << secondsSince(start) * 1e6 << " us)" << std::endl;
+        for (const SearchResult& r : results) {
+            std::cout << "  root " << r.root << ", cost " << r.cost << ", tree";
+            for (const VerboseEdge<int>& e : r.tree) std::cout << " " << e.start << "->" << e.end;
+            std::cout << std::endl;
+        }
+    }
+
+    if (!o.search_batch.empty()) {
+        std::ifstream file(o.search_batch);
+        if (!file) throw std::runtime_error("Unable to open " + o.search_batch);
+        std::vector<std::vector<int>> queries;
+        std::string line;
+        while (std::getline(file, line)) {
+            std::vector<int> keywords = parseKeywords(o.search_batch, line);
+            if (!keywords.empty()) queries.push_back(keywords);
+        }
+
+        std::vector<std::vector<SearchResult>> results;
+        std::cout << "Search batch: " << engine.query_batch(queries, o.top_k, results, o.search_scan) << std::endl;
+    }
+}
+
+static void validateApproximation(const CLIOptions& o, const KeywordDistanceMatrix& mat, const CSRGraph<int>& csr) {
+    KeywordDistanceMatrix exact(o.graph.n_keywords, o.graph.n_vertices, o.graph.max_weight, o.radius);
+    exact.calculate_matrix_cpu(csr);
+    ApproximationReport report = mat.validate_approximation(exact);
+    std::cout << report << std::endl;
+
+    long reachable = report.compared_cells + report.missed_cells;
+    double missed = reachable ? 100.0 * report.missed_cells / reachable : 0.0;
+    if (report.mean_relative_error * 100 > o.validate_approx || missed > o.validate_approx) {
+        throw std::runtime_error("The approximation is off by " + std::to_string(report.mean_relative_error * 100) + "% on average and missed " +
+                                 std::to_string(missed) + "% of the reachable cells, more than the " + std::to_string(o.validate_approx) + "% allowed");
+    }
+}
+
+static void buildIndex(const CLIOptions& o, const CSRGraph<int>& csr) {
+    auto start = std::chrono::steady_clock::now();
+    std::string filepath = o.output + "." + o.index;
+    if (o.index == "pll") {
+        PrunedLandmarkLabeling pll;
+        pll.build(csr);
+        pll.build_keyword_labels(csr);
+        pll.save(filepath);
+        std::cout << "Index: " << pll.label_entries() << " label entries";
+    } else {
+        ALTIndex alt;
+        alt.build(csr, o.landmarks);
+        alt.save(filepath);
+        std::cout << "Index: " << alt.n_landmarks() << " landmarks";
+    }
+    std::cout << ", written to " << filepath << " (" << secondsSince(start) << " s)" << std::endl;
+}
+
+static void runLayout(const CLIOptions& o, const CSRGraph<int>& csr) {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<SparseGraph<int>> graph(csr.to_sparse_graph());
+    ForceDirectedParams params;
+    params.repulsion = o.layout == "barnes-hut" ? REPULSION_BARNES_HUT : REPULSION_STOCHASTIC;
+    params.theta = o.theta;
+    params.max_iterations = o.layout_iterations;
+
+    ForceDirectedLayout<int> layout;
+    layout.initialize_positions(*graph, params);
+    layout.calculate(*graph, params);
+
+    std::ofstream file(o.layout_output);
+    if (!file) {
+        throw std::runtime_error("Unable to create file " + o.layout_output);
+    }
+    file << "vertex,x,y\n";
+    for (const auto& [v, position] : layout.get_positions()) {
+        file << v << ',' << position.first << ',' << position.second << '\n';
+    }
+    if (!file.flush()) {
+        throw std::runtime_error("Unable to write " + o.layout_output);
+    }
+    std::cout << "Layout: " << o.layout_iterations << " iterations of " << o.layout << " repulsion, written to " << o.layout_output
+              << " (" << secondsSince(start) << " s)" << std::endl;
+}
+
+static void runSweep(const CLIOptions& o) {
+    SweepSpec spec = SweepSpec::parse(o.sweep);
+    SweepRunner runner(get_num_threads());
+    if (!o.cache_directory.empty()) runner.set_cache(o.cache_directory, o.cache_bytes);
+    runner.set_memory_budget(o.memory_budget);
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SweepResult> results = runner.run(spec);
+
+    std::ofstream file(o.results);
+    if (!file) {
+        throw std::runtime_error("Unable to create file " + o.results);
+    }
+    SweepRunner::write_results(file, results);
+
+    long failed = std::count_if(results.begin(), results.end(), [](const SweepResult& r) { return !r.error.empty(); });
+    std::cout << "Sweep: " << results.size() << " runs, " << failed << " failed (" << secondsSince(start) << " s), results in " << o.results << std::endl;
+}
+
+static QueryServer* active_server = nullptr;
+
+static void stopServer(int) {
+    if (active_server) active_server->stop();
+}
+
+static void runServer(const CLIOptions& o) {
+    BinaryMatrixReader matrix(o.matrix);
+    QueryServer server(matrix, get_num_threads());
+    active_server = &server;
+    std::signal(SIGINT, stopServer);
+    std::signal(SIGTERM, stopServer);
+    server.serve(o.serve);
+    active_server = nullptr;
+    std::cout << "Server stopped after " << Metrics::global().counter("queries_served").value() << " queries" << std::endl;
+}
+
+static void run(CLIOptions& o) {
+    if (o.threads > 0) set_num_threads(o.threads);
+    if (!o.sweep.empty()) {
+        runSweep(o);
+        return;
+    }
+    if (!o.serve.empty()) {
+        runServer(o);
+        return;
+    }
+    if (!o.matrix.empty() && (!o.search.empty() || !o.search_batch.empty())) {
+        BinaryMatrixReader matrix(o.matrix);
+        runSearch(o, KeywordSearchEngine(matrix));
+        return;
+    }
+    if (!o.query_load.empty()) {
+        o.load.seed = o.seed;
+        std::cout << "Load: " << run_query_load(o.query_load, o.load) << std::endl;
+        return;
+    }
+    if (o.worker_fd >= 0) {
+        run_shard_worker(o.worker_fd, o.load_snapshot, o.radius, o.dtype);
+        return;
+    }
+
+    MatrixOptions options;
+    options.engine = o.engine;
+    options.max_radius = o.radius;
+    options.n_landmarks = o.landmarks;
+
+    // Checked before anything is generated, a job that cannot fit should fail in seconds rather than hours
+    auto start = std::chrono::steady_clock::now();
+    bool generate = o.load_snapshot.empty() && o.edges.empty();
+    if (!o.load_snapshot.empty()) o.graph = GraphSnapshotReader(o.load_snapshot).get_params();
+    CSRGraph<int> imported;
+    if (!o.edges.empty()) imported = importGraph(o);
+    if (o.workers > 0) o.stream = true; // Workers stream their rows, no process holds the whole matrix
+    bool requested_stream = o.stream;
+    MemoryEstimate estimate = fit_memory_budget(o.graph, options, get_num_threads(), o.memory_budget, o.stream,
+                                                o.engine == ENGINE_CPU && o.shards == 1, generate);
+    if (o.estimate) {
+        std::cout << "Estimated memory: " << estimate << std::endl;
+        return;
+    }
+    if (o.stream && !requested_stream) {
+        std::cout << "Streaming the matrix to stay within the memory budget, estimated " << estimate << std::endl;
+    }
+    uint64_t available = available_memory();
+    if (!o.memory_budget && available && estimate.peak > available) {
+        std::cerr << "Warning: the job is estimated to need " << estimate.peak / 1048576 << " MB but only "
+                  << available / 1048576 << " MB are available, consider --memory-budget auto" << std::endl;
+    }
+
+    // A resumed run needs the exact graph the checkpoint was made for, which the stored seed regenerates
+    MatrixCheckpointHeader stored_checkpoint;
+    if (o.resume && o.random_seed && generate && MatrixCheckpoint::read_header(o.checkpoint, stored_checkpoint)) {
+        o.seed = stored_checkpoint.seed;
+    }
+
+    std::unique_ptr<GraphCache> cache;
+    if (!o.cache_directory.empty()) cache = std::make_unique<GraphCache>(o.cache_directory, o.cache_bytes);
+    GraphCache* graph_cache = generate ? cache.get() : nullptr;
+
+    CSRGraph<int> csr = o.edges.empty() ? makeGraph(o, graph_cache) : std::move(imported);
+    std::cout << "Graph: " << csr.n_vertices << " vertices, " << csr.n_edges() << " edges, seed " << o.seed
+              << ", " << csr.memory_bytes() / 1048576 << " MB (" << secondsSince(start) << " s)" << std::endl;
+
+    if (!o.save_snapshot.empty()) {
+        GraphSnapshotWriter writer;
+        writer.write(o.save_snapshot, csr, o.graph, o.seed);
+    }
+
+    if (!o.index.empty()) {
+        buildIndex(o, csr);
+        return;
+    }
+    if (!o.layout.empty()) {
+        runLayout(o, csr);
+        return;
+    }
+
+    KeywordDistanceMatrix mat(o.graph.n_keywords, o.graph.n_vertices, o.graph.max_weight, o.radius);
+    std::string filepath = o.output + (o.binary ? ".bin" : ".csv");
+
+    start = std::chrono::steady_clock::now();
+    // A stored matrix is loaded whole, which a budget that forced streaming has no room for
+    std::unique_ptr<BinaryMatrixReader> stored;
+    if (graph_cache && o.stream == requested_stream) stored = graph_cache->find_matrix(o.graph, o.seed, options);
+
+    std::unique_ptr<MatrixCheckpoint> checkpoint;
+    if (!stored && !o.checkpoint.empty()) {
+        checkpoint = std::make_unique<MatrixCheckpoint>(o.checkpoint, csr, o.radius, o.seed, o.resume);
+        checkpoint->set_interval(o.checkpoint_interval);
+        if (o.resume) std::cout << "Resuming from " << o.checkpoint << ": " << checkpoint->resumed_rows() << " of " << o.graph.n_keywords << " keywords done" << std::endl;
+        mat.set_checkpoint(checkpoint.get());
+    }
+
+    if (stored) {
+        mat.load_matrix(*stored);
+    } else if (o.workers > 0) {
+        runWorkers(o, csr);
+        std::cout << "Matrix computed and written by " << o.workers << " workers (" << secondsSince(start) << " s)" << std::endl;
+        if (graph_cache && o.binary) graph_cache->store_matrix_file(filepath, o.graph, o.seed, options);
+        return;
+    } else if (o.stream) {
+        stream_matrix_cpu(mat, csr, filepath, o.binary, o.dtype);
+        std::cout << "Matrix computed and written (" << secondsSince(start) << " s)" << std::endl;
+        if (checkpoint) checkpoint->remove();
+        if (graph_cache && o.binary) graph_cache->store_matrix_file(filepath, o.graph, o.seed, options);
+        return;
+    } else if (o.engine == ENGINE_APPROX) {
+        std::cout << mat.calculate_matrix_approx(csr, o.landmarks) << std::endl;
+        if (o.validate_approx >= 0) validateApproximation(o, mat, csr);
+    } else {
+        mat.calculate_matrix_cpu(csr);
+    }
+    std::cout << "Matrix " << (stored ? "loaded" : "computed") << ", " << mat.memory_bytes() / 1048576 << " MB (" << secondsSince(start) << " s)" << std::endl;
+
+    if (graph_cache && !stored) graph_cache->store_matrix(mat, o.graph, o.seed, options);
+    if (!o.search.empty() || !o.search_batch.empty()) runSearch(o, KeywordSearchEngine(mat));
+
+    start = std::chrono::steady_clock::now();
+    writeMatrix(o, mat);
+    std::cout << "Matrix written (" << secondsSince(start) << " s)" << std::endl;
+    if (checkpoint) checkpoint->remove();
+}
+
+int main(int argc, char** argv) {
+    try {
+        CLIOptions options = parseArguments(argc, argv);
+
+        std::ofstream metrics_file;
+        std::unique_ptr<MetricsReporter> reporter;
+        if (options.metrics != "none") {
+            if (!options.metrics_file.empty()) {
+                metrics_file.open(options.metrics_file);
+                if (!metrics_file) throw std::runtime_error("Unable to create file " + options.metrics_file);
+            }
+            std::ostream& os = options.metrics_file.empty() ? std::cerr : metrics_file;
+            reporter = std::make_unique<MetricsReporter>(os, MetricsReporter::parse_format(options.metrics), options.metrics_interval);
+            reporter->start();
+        }
+
+        if (!options.trace_file.empty()) Trace::start();
+        run(options);
+        if (!options.trace_file.empty()) {
+            Trace::stop();
+            Trace::write(options.trace_file);
+            std::cout << "Trace written to " << options.trace_file << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,155 @@
+#ifndef EVA_CSR_GRAPH
+#define EVA_CSR_GRAPH
+
+#include <vector>
+#include <algorithm>
+#include "graph.hpp"
+
+/*! Read-only compressed sparse row (CSR) snapshot of a SparseGraph. The multimaps in SparseGraph are
+ * convenient while a graph is being built, but walking them costs a tree lookup per vertex and a pointer
+ * chase per edge. The matrix engines instead flatten the graph once into contiguous arrays:
+ * the out-edges of v are targets[offsets[v] .. offsets[v + 1]) with matching weights, and the vertices
+ * holding keyword w are keyword_vertices[keyword_offsets[w] .. keyword_offsets[w + 1]).
+ * Edges whose endpoint is outside [0, n_vertices) and keywords outside [0, n_keywords) are dropped.
+ */
+template <typename T>
+class CSRGraph {
+public:
+    CSRGraph() : n_vertices(0), n_keywords(0) {}
+    CSRGraph(const SparseGraph<T>& graph, T n_keywords);
+
+    CSRGraph<T>     reversed() const;               //!< Same graph with every edge flipped, keywords are kept
+    SparseGraph<T>* to_sparse_graph() const;        //!< Rebuilds a SparseGraph, e.g. for the renderer. Caller owns it
+
+    T               n_edges() const                { return static_cast<T>(targets.size()); }
+    T               edges_begin(T v) const         { return offsets[v];                     }
+    T               edges_end(T v) const           { return offsets[v + 1];                 }
+    T               holders_begin(T w) const       { return keyword_offsets[w];             }
+    T               holders_end(T w) const         { return keyword_offsets[w + 1];         }
+    uint64_t        memory_bytes() const           { return vector_bytes(offsets) + vector_bytes(targets) + vector_bytes(weights) + vector_bytes(keyword_offsets) + vector_bytes(keyword_vertices); }
+
+    T               n_vertices;
+    T               n_keywords;
+    std::vector<T>  offsets;            //!< n_vertices + 1 entries
+    std::vector<T>  targets;            //!< Edge endpoints, grouped by start vertex
+    std::vector<T>  weights;            //!< Edge weights, parallel to targets
+    std::vector<T>  keyword_offsets;    //!< n_keywords + 1 entries
+    std::vector<T>  keyword_vertices;   //!< Sorted, duplicate-free vertex list per keyword
+};
+
+/*! Read-only view of CSR arrays owned elsewhere, by a CSRGraph or a memory-mapped GraphSnapshotReader. It
+ * has the accessors of CSRGraph the exact matrix engine reads, so the engine can run on a snapshot in place
+ * instead of on a heap copy. A CSRGraph converts to a view implicitly; the arrays must outlive the view.
+ */
+template <typename T>
+struct CSRView {
+    CSRView() = default;
+    CSRView(const CSRGraph<T>& graph);
+
+    T               n_edges() const                { return offsets[n_vertices];            }
+    T               edges_begin(T v) const         { return offsets[v];                     }
+    T               edges_end(T v) const           { return offsets[v + 1];                 }
+    T               holders_begin(T w) const       { return keyword_offsets[w];             }
+    T               holders_end(T w) const         { return keyword_offsets[w + 1];         }
+
+    T               n_vertices = 0;
+    T               n_keywords = 0;
+    const T*        offsets = nullptr;
+    const T*        targets = nullptr;
+    const T*        weights = nullptr;
+    const T*        keyword_offsets = nullptr;
+    const T*        keyword_vertices = nullptr;
+};
+
+template <typename T>
+CSRView<T>::CSRView(const CSRGraph<T>& graph)
+    : n_vertices(graph.n_vertices), n_keywords(graph.n_keywords), offsets(graph.offsets.data()), targets(graph.targets.data()),
+      weights(graph.weights.data()), keyword_offsets(graph.keyword_offsets.data()), keyword_vertices(graph.keyword_vertices.data()) {}
+
+template <typename T>
+CSRGraph<T>::CSRGraph(const SparseGraph<T>& graph, T n_W) {
+    TRACE_ZONE("CSRGraph::CSRGraph");
+    n_vertices = graph.n_vertices;
+    n_keywords = n_W;
+
+    // std::multimap keeps keys ordered, so a single pass over adjacency_list yields edges grouped by start
+    offsets.assign(n_vertices + 1, 0);
+    targets.reserve(graph.adjacency_list.size());
+    weights.reserve(graph.adjacency_list.size());
+    for (const auto& [start, edge] : graph.adjacency_list) {
+        if (start < 0 || start >= n_vertices || edge.end < 0 || edge.end >= n_vertices) continue;
+        ++offsets[start + 1];
+        targets.push_back(edge.end);
+        weights.push_back(edge.weight);
+    }
+    for (T v = 0; v < n_vertices; ++v) {
+        offsets[v + 1] += offsets[v];
+    }
+
+    keyword_offsets.assign(n_keywords + 1, 0);
+    keyword_vertices.reserve(graph.reverse_index.size());
+    for (T w = 0; w < n_keywords; ++w) {
+        auto range = graph.reverse_index.equal_range(w);
+        size_t first = keyword_vertices.size();
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second >= 0 && it->second < n_vertices) keyword_vertices.push_back(it->second);
+        }
+
+        std::sort(keyword_vertices.begin() + first, keyword_vertices.end());
+        keyword_vertices.erase(std::unique(keyword_vertices.begin() + first, keyword_vertices.end()), keyword_vertices.end());
+        keyword_offsets[w + 1] = static_cast<T>(keyword_vertices.size());
+    }
+}
+
+template <typename T>
+CSRGraph<T> CSRGraph<T>::reversed() const {
+    CSRGraph<T> rev;
+    rev.n_vertices = n_vertices;
+    rev.n_keywords = n_keywords;
+    rev.keyword_offsets = keyword_offsets;
+    rev.keyword_vertices = keyword_vertices;
+
+    rev.offsets.assign(n_vertices + 1, 0);
+    for (T e = 0; e < n_edges(); ++e) {
+        ++rev.offsets[targets[e] + 1];
+    }
+    for (T v = 0; v < n_vertices; ++v) {
+        rev.offsets[v + 1] += rev.offsets[v];
+    }
+
+    rev.targets.resize(targets.size());
+    rev.weights.resize(weights.size());
+    std::vector<T> fill(rev.offsets.begin(), rev.offsets.end() - 1);
+    for (T v = 0; v < n_vertices; ++v) {
+        for (T e = offsets[v]; e < offsets[v + 1]; ++e) {
+            T slot = fill[targets[e]]++;
+            rev.targets[slot] = v;
+            rev.weights[slot] = weights[e];
+        }
+    }
+
+    return rev;
+}
+
+template <typename T>
+SparseGraph<T>* CSRGraph<T>::to_sparse_graph() const {
+    SparseGraph<T>* graph = new SparseGraph<T>();
+
+    for (T v = 0; v < n_vertices; ++v) {
+        graph->add_vertex(v);
+        for (T e = offsets[v]; e < offsets[v + 1]; ++e) {
+            graph->add_edge(v, targets[e], weights[e]);
+        }
+    }
+
+    for (T w = 0; w < n_keywords; ++w) {
+        for (T i = keyword_offsets[w]; i < keyword_offsets[w + 1]; ++i) {
+            graph->keyword_index.insert({keyword_vertices[i], w});
+            graph->reverse_index.insert({w, keyword_vertices[i]});
+        }
+    }
+
+    return graph;
+}
+
+#endif
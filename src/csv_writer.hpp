@@ -1,14 +1,40 @@
 #ifndef EVA_GRAPH_CSV_WRITER
 #define EVA_GRAPH_CSV_WRITER
 
+#include <cstdint>
+#include <string>
+#include <vector>
 #include "graph.hpp"
 #include "keyword_distance_matrix.hpp"
 
 class CSVWriter {
 public:
     CSVWriter();
+    ~CSVWriter();
 
     void write(std::string filepath, const KeywordDistanceMatrix& matrix);
+
+    // Row-by-row output for matrices that are never held in memory as a whole. Rows must come in keyword order
+    void begin_stream(std::string filepath, int V);
+    void stream_row(const Pair* row);
+    void stream_row(const SparseEntry* row, size_t n);
+    void end_stream();
+    uint64_t stream_checksum() const { return stream_hash; } //!< fnv1a64 over the hash_block() of every streamed line
+
+    static size_t max_row_size(int V, bool sparse);                       //!< Upper bound on the bytes format_row() produces for V cells
+    static size_t format_row(const Pair* row, int V, char* out);           //!< Formats a dense row as dist;pred, cells and a newline
+    static size_t format_row(const SparseEntry* row, size_t n, char* out); //!< Formats a sparse row as vert:dist;pred, cells and a newline
+
+private:
+    void flush_stream();
+    void append_line(size_t n);     //!< Accounts for a line formatted at the end of the buffer
+
+    std::string       stream_path;
+    int               stream_fd;
+    int               stream_V;
+    std::vector<char> stream_buffer;
+    size_t            stream_used;
+    uint64_t          stream_hash;
 };
 
 #endif
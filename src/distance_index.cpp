@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <queue>
+#include <stdexcept>
+#include "distance_index.hpp"
+#include "keyword_distance_matrix.hpp"
+#include "trace.hpp"
+
+const uint32_t INDEX_VERSION = 2;
+const LabelEntry LABEL_SENTINEL = {INT_MAX, 0};
+
+typedef std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<std::pair<int, int>>> MinHeap;
+
+template <typename U>
+static void write_vector(std::ofstream& file, const std::vector<U>& vec) {
+    uint64_t n = vec.size();
+    file.write(reinterpret_cast<const char*>(&n), sizeof(n));
+    file.write(reinterpret_cast<const char*>(vec.data()), n * sizeof(U));
+}
+
+template <typename U>
+static void read_vector(std::ifstream& file, std::vector<U>& vec) {
+    uint64_t n = 0;
+    file.read(reinterpret_cast<char*>(&n), sizeof(n));
+    vec.resize(n);
+    file.read(reinterpret_cast<char*>(vec.data()), n * sizeof(U));
+}
+
+static void write_header(std::ofstream& file, const char* magic, int V) {
+    file.write(magic, 8);
+    file.write(reinterpret_cast<const char*>(&INDEX_VERSION), sizeof(INDEX_VERSION));
+    file.write(reinterpret_cast<const char*>(&V), sizeof(V));
+}
+
+static void read_header(std::ifstream& file, const char* magic, int& V, const std::string& filepath) {
+    char found[8];
+    uint32_t version = 0;
+    file.read(found, 8);
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    file.read(reinterpret_cast<char*>(&V), sizeof(V));
+    if (!file || std::memcmp(found, magic, 8) != 0) throw std::runtime_error("Not a distance index: " + filepath);
+    if (version != INDEX_VERSION) throw std::runtime_error("Unsupported distance index version in " + filepath);
+}
+
+// Merges two hub-sorted, sentinel-terminated labels
+static int merge_labels(const LabelEntry* a, const LabelEntry* b) {
+    long best = BIG_NUMBER;
+    while (true) {
+        if (a->hub == b->hub) {
+            if (a->hub == INT_MAX) break;
+            best = std::min(best, (long)a->dist + b->dist);
+            ++a;
+            ++b;
+        } else if (a->hub < b->hub) {
+            ++a;
+        } else {
+            ++b;
+        }
+    }
+    return (int)best;
+}
+
+static void flatten_labels(std::vector<std::vector<LabelEntry>>& labels, std::vector<int>& offsets, std::vector<LabelEntry>& flat) {
+    offsets.assign(labels.size() + 1, 0);
+    flat.clear();
+    for (size_t v = 0; v < labels.size(); v++) {
+        flat.insert(flat.end(), labels[v].begin(), labels[v].end());
+        flat.push_back(LABEL_SENTINEL);
+        offsets[v + 1] = static_cast<int>(flat.size());
+        std::vector<LabelEntry>().swap(labels[v]);
+    }
+}
+
+PrunedLandmarkLabeling::PrunedLandmarkLabeling() {
+    V = 0;
+}
+
+void PrunedLandmarkLabeling::build(const CSRGraph<int>& graph) {
+    TRACE_ZONE("PrunedLandmarkLabeling::build");
+    V = graph.n_vertices;
+    CSRGraph<int> reverse = graph.reversed();
+
+    // High-degree vertices cover the most shortest paths, so they become hubs first and prune the rest
+    order.resize(V);
+    for (int v = 0; v < V; v++) order[v] = v;
+    auto degree = [&](int v) { return (graph.edges_end(v) - graph.edges_begin(v)) + (reverse.edges_end(v) - reverse.edges_begin(v)); };
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return degree(a) > degree(b); });
+
+    std::vector<std::vector<LabelEntry>> out(V), in(V);
+    std::vector<int> dist(V, BIG_NUMBER);
+    std::vector<int> root_label(V, BIG_NUMBER); // Label of the current root indexed by hub rank
+    std::vector<int> touched;
+    MinHeap heap;
+
+    // One pruned Dijkstra per direction: forward searches fill in-labels, backward searches fill out-labels
+    auto pruned_search = [&](int rank, const CSRGraph<int>& g, std::vector<std::vector<LabelEntry>>& root_side, std::vector<std::vector<LabelEntry>>& target_side) {
+        int root = order[rank];
+        for (const LabelEntry& e : root_side[root]) root_label[e.hub] = e.dist;
+
+        dist[root] = 0;
+        touched.push_back(root);
+        heap.push({0, root});
+        while (!heap.empty()) {
+            auto [d, u] = heap.top();
+            heap.pop();
+            if (d > dist[u]) continue;
+
+            bool covered = false;
+            for (const LabelEntry& e : target_side[u]) {
+                if (root_label[e.hub] != BIG_NUMBER && (long)root_label[e.hub] + e.dist <= d) {
+                    covered = true;
+                    break;
+                }
+            }
+            if (covered) continue;
+
+            target_side[u].push_back({rank, d});
+            for (int e = g.edges_begin(u); e < g.edges_end(u); e++) {
+                int next = g.targets[e];
+                int nd = d + g.weights[e];
+                if (nd >= dist[next]) continue;
+
+                if (dist[next] == BIG_NUMBER) touched.push_back(next);
+                dist[next] = nd;
+                heap.push({nd, next});
+            }
+        }
+
+        for (int v : touched) dist[v] = BIG_NUMBER;
+        touched.clear();
+        for (const LabelEntry& e : root_side[root]) root_label[e.hub] = BIG_NUMBER;
+    };
+
+    for (int rank = 0; rank < V; rank++) {
+        pruned_search(rank, graph, out, in);
+        pruned_search(rank, reverse, in, out);
+    }
+
+    flatten_labels(out, out_offsets, out_labels);
+    flatten_labels(in, in_offsets, in_labels);
+    keyword_offsets.clear();
+    keyword_labels.clear();
+
+    std::cout << "Pruned landmark labeling built with " << label_entries() - 2 * V << " label entries" << std::endl;
+}
+
+void PrunedLandmarkLabeling::build_keyword_labels(const CSRGraph<int>& graph) {
+    const int W = graph.n_keywords;
+    std::vector<int> best(V, BIG_NUMBER);
+    std::vector<int> hubs;
+
+    keyword_offsets.assign(W + 1, 0);
+    keyword_labels.clear();
+    for (int w = 0; w < W; w++) {
+        for (int i = graph.holders_begin(w); i < graph.holders_end(w); i++) {
+            int h = graph.keyword_vertices[i];
+            for (int j = out_offsets[h]; j < out_offsets[h + 1] - 1; j++) {
+                const LabelEntry& e = out_labels[j];
+                if (best[e.hub] == BIG_NUMBER) hubs.push_back(e.hub);
+                best[e.hub] = std::min(best[e.hub], e.dist);
+            }
+        }
+
+        std::sort(hubs.begin(), hubs.end());
+        for (int hub : hubs) {
+            keyword_labels.push_back({hub, best[hub]});
+            best[hub] = BIG_NUMBER;
+        }
+        keyword_labels.push_back(LABEL_SENTINEL);
+        keyword_offsets[w + 1] = static_cast<int>(keyword_labels.size());
+        hubs.clear();
+    }
+}
+
+int PrunedLandmarkLabeling::query(int s, int t) const {
+    return merge_labels(&out_labels[out_offsets[s]], &in_labels[in_offsets[t]]);
+}
+
+int PrunedLandmarkLabeling::keyword_distance(int w, int v) const {
+    return merge_labels(&keyword_labels[keyword_offsets[w]], &in_labels[in_offsets[v]]);
+}
+
+void PrunedLandmarkLabeling::save(const std::string& filepath) const {
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to create file " + filepath);
+    }
+
+    write_header(file, "EVA_PLL", V);
+    write_vector(file, order);
+    write_vector(file, out_offsets);
+    write_vector(file, out_labels);
+    write_vector(file, in_offsets);
+    write_vector(file, in_labels);
+    write_vector(file, keyword_offsets);
+    write_vector(file, keyword_labels);
+}
+
+void PrunedLandmarkLabeling::load(const std::string& filepath) {
+    std::ifstream file(filepath, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open file " + filepath);
+    }
+
+    read_header(file, "EVA_PLL", V, filepath);
+    read_vector(file, order);
+    read_vector(file, out_offsets);
+    read_vector(file, out_labels);
+    read_vector(file, in_offsets);
+    read_vector(file, in_labels);
+    read_vector(file, keyword_offsets);
+    read_vector(file, keyword_labels);
+    if (!file) throw std::runtime_error("Truncated distance index: " + filepath);
+}
+
+// Plain single-source Dijkstra writing every distance, used for the landmark tables
+static void full_dijkstra(const CSRGraph<int>& graph, int source, int* dist, int* pred) {
+    std::fill_n(dist, graph.n_vertices, BIG_NUMBER);
+    if (pred) std::fill_n(pred, graph.n_vertices, -1);
+    MinHeap heap;
+    dist[source] = 0;
+    heap.push({0, source});
+    while (!heap.empty()) {
+        auto [d, u] = heap.top();
+        heap.pop();
+        if (d > dist[u]) continue;
+
+        for (int e = graph.edges_begin(u); e < graph.edges_end(u); e++) {
+            int next = graph.targets[e];
+            int nd = d + graph.weights[e];
+            if (nd < dist[next]) {
+                dist[next] = nd;
+                if (pred) pred[next] = u;
+                heap.push({nd, next});
+            }
+        }
+    }
+}
+
+ALTIndex::ALTIndex() {
+    V = 0;
+}
+
+void ALTIndex::build(const CSRGraph<int>& graph, int n_landmarks) {
+    TRACE_ZONE("ALTIndex::build");
+    V = graph.n_vertices;
+    n_landmarks = std::max(0, std::min(n_landmarks, V));
+    CSRGraph<int> reverse = graph.reversed();
+
+    landmarks.clear();
+    from.assign((size_t)n_landmarks * V, BIG_NUMBER);
+    to.assign((size_t)n_landmarks * V, BIG_NUMBER);
+    from_pred.assign((size_t)n_landmarks * V, -1);
+    to_next.assign((size_t)n_landmarks * V, -1);
+
+    // Farthest-point selection: prefer high-degree vertices no landmark reaches yet, otherwise the vertex
+    // farthest from every existing landmark, so the landmarks spread over the graph
+    std::vector<int> cover(V, BIG_NUMBER);
+    auto degree = [&](int v) { return (graph.edges_end(v) - graph.edges_begin(v)) + (reverse.edges_end(v) - reverse.edges_begin(v)); };
+    for (int l = 0; l < n_landmarks; l++) {
+        int next = -1;
+        for (int v = 0; v < V; v++) {
+            if (cover[v] != BIG_NUMBER || std::find(landmarks.begin(), landmarks.end(), v) != landmarks.end()) continue;
+            if (next == -1 || degree(v) > degree(next)) next = v;
+        }
+        if (next == -1) {
+            next = (int)(std::max_element(cover.begin(), cover.end()) - cover.begin());
+        }
+
+        landmarks.push_back(next);
+        full_dijkstra(graph, next, &from[(size_t)l * V], &from_pred[(size_t)l * V]);
+        full_dijkstra(reverse, next, &to[(size_t)l * V], &to_next[(size_t)l * V]);
+        for (int v = 0; v < V; v++) {
+            cover[v] = std::min(cover[v], from[(size_t)l * V + v]);
+        }
+        cover[next] = 0;
+    }
+}
+
+int ALTIndex::estimate(int s, int t) const {
+    long best = BIG_NUMBER;
+    for (int l = 0; l < n_landmarks(); l++) {
+        int a = to_landmark(l, s);
+        int b = from_landmark(l, t);
+        if (a != BIG_NUMBER && b != BIG_NUMBER) best = std::min(best, (long)a + b);
+    }
+    return (int)best;
+}
+
+int ALTIndex::lower_bound(int s, int t) const {
+    int best = 0;
+    for (int l = 0; l < n_landmarks(); l++) {
+        int from_s = from_landmark(l, s), from_t = from_landmark(l, t);
+        int to_s = to_landmark(l, s), to_t = to_landmark(l, t);
+
+        // L reaches s but not t, or t reaches L but s does not: t is unreachable from s
+        if (from_s != BIG_NUMBER && from_t == BIG_NUMBER) return BIG_NUMBER;
+        if (to_t != BIG_NUMBER && to_s == BIG_NUMBER) return BIG_NUMBER;
+
+        if (from_s != BIG_NUMBER) best = std::max(best, from_t - from_s);
+        if (to_t != BIG_NUMBER) best = std::max(best, to_s - to_t);
+    }
+    return best;
+}
+
+int ALTIndex::query(const CSRGraph<int>& graph, int s, int t) const {
+    if (lower_bound(s, t) == BIG_NUMBER) return BIG_NUMBER;
+
+    thread_local std::vector<int> dist;
+    thread_local std::vector<int> touched;
+    if ((int)dist.size() != V) dist.assign(V, BIG_NUMBER);
+
+    MinHeap heap;
+    int result = BIG_NUMBER;
+    dist[s] = 0;
+    touched.push_back(s);
+    heap.push({lower_bound(s, t), s});
+    while (!heap.empty()) {
+        auto [f, u] = heap.top();
+        heap.pop();
+        if (u == t) {
+            result = dist[t];
+            break;
+        }
+
+        int h = lower_bound(u, t);
+        if (h == BIG_NUMBER || f > dist[u] + h) continue;
+
+        for (int e = graph.edges_begin(u); e < graph.edges_end(u); e++) {
+            int next = graph.targets[e];
+            int nd = dist[u] + graph.weights[e];
+            if (nd >= dist[next]) continue;
+
+            int next_h = lower_bound(next, t);
+            if (next_h == BIG_NUMBER) continue;
+
+            if (dist[next] == BIG_NUMBER) touched.push_back(next);
+            dist[next] = nd;
+            heap.push({nd + next_h, next});
+        }
+    }
+
+    for (int v : touched) dist[v] = BIG_NUMBER;
+    touched.clear();
+    return result;
+}
+
+void ALTIndex::save(const std::string& filepath) const {
+    std::ofstream file(filepath, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to create file " + filepath);
+    }
+
+    write_header(file, "EVA_ALT", V);
+    write_vector(file, landmarks);
+    write_vector(file, from);
+    write_vector(file, to);
+    write_vector(file, from_pred);
+    write_vector(file, to_next);
+}
+
+void ALTIndex::load(const std::string& filepath) {
+    std::ifstream file(filepath, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open file " + filepath);
+    }
+
+    read_header(file, "EVA_ALT", V, filepath);
+    read_vector(file, landmarks);
+    read_vector(file, from);
+    read_vector(file, to);
+    read_vector(file, from_pred);
+    read_vector(file, to_next);
+    if (!file) throw std::runtime_error("Truncated distance index: " + filepath);
+}
@@ -0,0 +1,87 @@
+#ifndef EVA_DISTANCE_INDEX
+#define EVA_DISTANCE_INDEX
+
+#include <string>
+#include <vector>
+#include "csr_graph.hpp"
+
+/*! Indexes for arbitrary vertex-to-vertex shortest path queries over a CSRGraph. Unlike
+ * KeywordDistanceMatrix they do not materialize any distances up front; instead they keep a compact
+ * per-vertex summary and answer each query on demand. Unreachable pairs report BIG_NUMBER.
+ */
+
+struct LabelEntry {
+    int hub;              //!< Rank of the hub vertex in the labeling order
+    int dist;             //!< Distance between the labeled vertex and the hub
+};
+
+/*! Exact 2-hop cover built with pruned landmark labeling (Akiba et al.). Every vertex keeps an out-label
+ * of hubs it can reach and an in-label of hubs that reach it, both sorted by hub rank, such that
+ * dist(s, t) = min over common hubs x of out(s)[x] + in(t)[x]. Queries are a single merge of two short
+ * sorted lists. Keyword distances are answered the same way against a per-keyword label that merges the
+ * out-labels of every vertex holding the keyword.
+ */
+class PrunedLandmarkLabeling {
+public:
+    PrunedLandmarkLabeling();
+
+    void   build(const CSRGraph<int>& graph);
+    void   build_keyword_labels(const CSRGraph<int>& graph);     //!< Must be called after build()
+    int    query(int s, int t) const;                            //!< Exact dist(s, t)
+    int    keyword_distance(int w, int v) const;                 //!< Exact distance from the closest holder of w to v
+
+    void   save(const std::string& filepath) const;
+    void   load(const std::string& filepath);
+
+    int    n_vertices() const                  { return V;                                        }
+    int    n_keywords() const                  { return static_cast<int>(keyword_offsets.size()) - 1; }
+    size_t label_entries() const               { return out_labels.size() + in_labels.size();     }
+
+private:
+    int V;
+    std::vector<int>        order;              //!< Vertex at each rank
+    std::vector<int>        out_offsets;        //!< V + 1 entries into out_labels
+    std::vector<LabelEntry> out_labels;         //!< Hubs reachable from each vertex, terminated by a sentinel
+    std::vector<int>        in_offsets;         //!< V + 1 entries into in_labels
+    std::vector<LabelEntry> in_labels;          //!< Hubs reaching each vertex, terminated by a sentinel
+    std::vector<int>        keyword_offsets;    //!< W + 1 entries into keyword_labels
+    std::vector<LabelEntry> keyword_labels;     //!< min over holders of their out-labels, terminated by a sentinel
+};
+
+/*! Approximate distances from a small set of landmarks (ALT). For every landmark L the index stores
+ * dist(L, v) and dist(v, L); the triangle inequality then gives an upper bound min_L dist(s, L) + dist(L, t)
+ * and a lower bound max_L max(dist(L, t) - dist(L, s), dist(s, L) - dist(t, L)) in O(landmarks).
+ * The lower bound also drives an exact A* search when a precise answer is needed.
+ */
+class ALTIndex {
+public:
+    ALTIndex();
+
+    void   build(const CSRGraph<int>& graph, int n_landmarks);
+    int    estimate(int s, int t) const;                         //!< Upper bound on dist(s, t)
+    int    lower_bound(int s, int t) const;                      //!< Lower bound on dist(s, t)
+    int    query(const CSRGraph<int>& graph, int s, int t) const; //!< Exact dist(s, t) through A*
+
+    void   save(const std::string& filepath) const;
+    void   load(const std::string& filepath);
+
+    int    n_vertices() const                  { return V;                                        }
+    int    n_landmarks() const                 { return static_cast<int>(landmarks.size());       }
+    const std::vector<int>& get_landmarks() const { return landmarks;                             }
+    int    from_landmark(int l, int v) const   { return from[(size_t)l * V + v];                  } //!< dist(landmark l, v)
+    int    to_landmark(int l, int v) const     { return to[(size_t)l * V + v];                    } //!< dist(v, landmark l)
+    const int* from_row(int l) const           { return from.data() + (size_t)l * V;              }
+    const int* to_row(int l) const             { return to.data() + (size_t)l * V;                }
+    const int* pred_row(int l) const           { return from_pred.data() + (size_t)l * V;         } //!< Predecessors on the shortest paths out of landmark l
+    const int* next_row(int l) const           { return to_next.data() + (size_t)l * V;           } //!< Successors on the shortest paths into landmark l
+
+private:
+    int V;
+    std::vector<int> landmarks;
+    std::vector<int> from;                      //!< landmarks x V, dist(L, v)
+    std::vector<int> to;                        //!< landmarks x V, dist(v, L)
+    std::vector<int> from_pred;                 //!< landmarks x V, predecessor of v on a shortest L -> v path
+    std::vector<int> to_next;                   //!< landmarks x V, successor of v on a shortest v -> L path
+};
+
+#endif
@@ -2,12 +2,18 @@
 #define FORCE_DIRECTED_LAYOUT_HPP
 
 #include "graph.hpp"
+#include "thread_config.hpp"
 #include <map>
 #include <cmath>
 #include <ctime>
 #include <vector>
 #include <algorithm>
 
+enum RepulsionMode {
+    REPULSION_STOCHASTIC,   //!< One random vertex against all others per iteration, O(n)
+    REPULSION_BARNES_HUT    //!< Every vertex against a quadtree of the others, O(n log n)
+};
+
 struct ForceDirectedParams {
     float width = 1000.0f;
     float height = 800.0f;
@@ -16,8 +22,121 @@ struct ForceDirectedParams {
     float ideal_length = 200.0f;
     float time_step = 0.01f;
     int max_iterations = 100;
+    RepulsionMode repulsion = REPULSION_STOCHASTIC;
+    float theta = 0.8f;     //!< Barnes-Hut opening angle, cells with size / distance < theta act as one body. 0 is exact
 };
 
+/*! Barnes-Hut quadtree over a snapshot of the vertex positions. The nodes live in one flat pool that
+ * keeps its capacity, so rebuilding the tree every iteration costs no allocations once it has grown.
+ */
+class RepulsionQuadtree {
+public:
+    void  build(const std::vector<float>& xs, const std::vector<float>& ys);
+    //! Repulsion on body i from every other body, with the force law of ForceDirectedLayout. stack is scratch space
+    void  force(int i, float k_repulsion, float theta, std::vector<int>& stack, float& fx, float& fy) const;
+
+private:
+    struct Node {
+        float cx, cy;       //!< Center of mass
+        float mass;         //!< Bodies below the node
+        float x0, y0, size; //!< Square cell
+        int   child[4];     //!< -1 where the quadrant is empty, all -1 in a leaf
+        int   body;         //!< Body of a leaf holding a single one, else -1
+    };
+    static const int MAX_DEPTH = 32;    // Bodies closer than the cells get at this depth share a leaf
+
+    int  add_node(float x0, float y0, float size);
+    int  child_for(int node, float x, float y);
+
+    std::vector<Node>  nodes;
+    const float*       xs = nullptr;
+    const float*       ys = nullptr;
+};
+
+inline int RepulsionQuadtree::add_node(float x0, float y0, float size) {
+    nodes.push_back({0.0f, 0.0f, 0.0f, x0, y0, size, {-1, -1, -1, -1}, -1});
+    return static_cast<int>(nodes.size()) - 1;
+}
+
+// Quadrant of (x, y) in node, created on first use. Returns an index, push_back may move the nodes
+inline int RepulsionQuadtree::child_for(int node, float x, float y) {
+    float half = nodes[node].size / 2;
+    int q = (x >= nodes[node].x0 + half) + 2 * (y >= nodes[node].y0 + half);
+    if (nodes[node].child[q] < 0) {
+        int c = add_node(nodes[node].x0 + (q & 1) * half, nodes[node].y0 + (q >> 1) * half, half);
+        nodes[node].child[q] = c;
+    }
+    return nodes[node].child[q];
+}
+
+inline void RepulsionQuadtree::build(const std::vector<float>& x, const std::vector<float>& y) {
+    xs = x.data();
+    ys = y.data();
+    nodes.clear();
+    if (x.empty()) return;
+
+    float min_x = *std::min_element(x.begin(), x.end()), max_x = *std::max_element(x.begin(), x.end());
+    float min_y = *std::min_element(y.begin(), y.end()), max_y = *std::max_element(y.begin(), y.end());
+    add_node(min_x, min_y, std::max(max_x - min_x, max_y - min_y) * 1.0001f + 1e-3f);
+
+    for (int i = 0; i < static_cast<int>(x.size()); ++i) {
+        int node = 0;
+        for (int depth = 0; ; ++depth) {
+            Node& n = nodes[node];
+            bool leaf = n.child[0] < 0 && n.child[1] < 0 && n.child[2] < 0 && n.child[3] < 0;
+            if (leaf && (n.mass == 0 || depth >= MAX_DEPTH)) {
+                n.cx = (n.cx * n.mass + x[i]) / (n.mass + 1);
+                n.cy = (n.cy * n.mass + y[i]) / (n.mass + 1);
+                n.body = n.mass == 0 ? i : -1;
+                n.mass += 1;
+                break;
+            }
+            if (leaf) {
+                // Push the single body down, this node becomes internal and keeps its center of mass
+                int other = n.body;
+                n.body = -1;
+                int c = child_for(node, x[other], y[other]);
+                nodes[c].cx = x[other];
+                nodes[c].cy = y[other];
+                nodes[c].mass = 1;
+                nodes[c].body = other;
+            }
+            Node& m = nodes[node];
+            m.cx = (m.cx * m.mass + x[i]) / (m.mass + 1);
+            m.cy = (m.cy * m.mass + y[i]) / (m.mass + 1);
+            m.mass += 1;
+            node = child_for(node, x[i], y[i]);
+        }
+    }
+}
+
+inline void RepulsionQuadtree::force(int i, float k_repulsion, float theta, std::vector<int>& stack, float& fx, float& fy) const {
+    fx = fy = 0.0f;
+    if (nodes.empty()) return;
+    stack.assign(1, 0);
+
+    while (!stack.empty()) {
+        const Node& n = nodes[stack.back()];
+        stack.pop_back();
+        if (n.body == i) continue;
+
+        float dx = n.cx - xs[i];
+        float dy = n.cy - ys[i];
+        float distance = std::hypot(dx, dy) + 0.01f;
+        bool leaf = n.child[0] < 0 && n.child[1] < 0 && n.child[2] < 0 && n.child[3] < 0;
+        if (leaf || n.size < theta * distance) {
+            float force = n.mass * k_repulsion / (distance * distance);
+            fx -= (dx / distance) * force;
+            fy -= (dy / distance) * force;
+            continue;
+        }
+        for (int c : n.child) {
+            if (c >= 0) stack.push_back(c);
+        }
+    }
+}
+
+
 template<typename T>
 class ForceDirectedLayout {
 public:
@@ -28,75 +147,110 @@ public:
     void reset_positions();
 
 private:
+    struct FlatEdge {
+        int   src, dest;        //!< Indices into xs and ys
+        float weight;
+    };
+
     std::map<T, std::pair<float, float>> positions;
     std::vector<T> get_all_vertex_ids(SparseGraph<T>& graph);
+    void apply_barnes_hut(const ForceDirectedParams& params);
+    RepulsionQuadtree quadtree;
+    std::vector<float> xs, ys, fxs, fys;     // Positions and forces of the vertices while calculate() runs
+    std::vector<FlatEdge> edges;
     size_t counter = 0; 
 
 };
 
+// The positions are copied into flat arrays once, iterated there and written back at the end, so an
+// iteration does no map lookups or allocations
 template <typename T>
 void ForceDirectedLayout<T>::calculate(SparseGraph<T>& graph, const ForceDirectedParams& params) {
     counter = 0;
-    for(int iter = 0; iter < params.max_iterations; ++iter) {
-        std::map<T, std::pair<float, float>> forces;
+    const std::vector<T> vertex_ids = get_all_vertex_ids(graph);
+    const int n = static_cast<int>(vertex_ids.size());
 
+    std::vector<int> index(graph.vertices.size(), -1);
+    xs.resize(n);
+    ys.resize(n);
+    fxs.resize(n);
+    fys.resize(n);
+    for (int i = 0; i < n; ++i) {
+        index[vertex_ids[i]] = i;
+        const auto& pos = positions[vertex_ids[i]];
+        xs[i] = pos.first;
+        ys[i] = pos.second;
+    }
+
+    edges.clear();
+    for (const auto& edge : graph.adjacency_list) {
+        size_t src = static_cast<size_t>(edge.first), dest = static_cast<size_t>(edge.second.end);
+        if (src >= index.size() || dest >= index.size() || index[src] < 0 || index[dest] < 0) continue;
+        edges.push_back({index[src], index[dest], static_cast<float>(edge.second.weight)});
+    }
+
+    for(int iter = 0; iter < params.max_iterations; ++iter) {
         std::srand(std::time(nullptr) * ++counter);
-       
-        auto vertex_ids = get_all_vertex_ids(graph);
 
         // Repulsive forces between all vertices
-        
-        // As a temporary measure to make software rendering faster, we apply repulsion stochastically
-        size_t i = (static_cast<size_t>(std::rand()) * RAND_MAX) % vertex_ids.size();
-        //size_t i = counter++ % vertex_ids.size();
-        for(size_t j = 0; j < vertex_ids.size(); ++j) {
-            T id1 = vertex_ids[i];
-            T id2 = vertex_ids[j];
-            auto& pos1 = positions[id1];
-            auto& pos2 = positions[id2];
-            
-            float dx = pos2.first - pos1.first;
-            float dy = pos2.second - pos1.second;
-            float distance = std::hypot(dx, dy) + 0.01f;
-            float force = params.k_repulsion / (distance * distance);
+        if (params.repulsion == REPULSION_BARNES_HUT) {
+            apply_barnes_hut(params);
+        } else if (n > 0) {
+            std::fill(fxs.begin(), fxs.end(), 0.0f);
+            std::fill(fys.begin(), fys.end(), 0.0f);
+
+            // As a temporary measure to make software rendering faster, we apply repulsion stochastically
+            size_t i = (static_cast<size_t>(std::rand()) * RAND_MAX) % n;
+            for(int j = 0; j < n; ++j) {
+                float dx = xs[j] - xs[i];
+                float dy = ys[j] - ys[i];
+                float distance = std::hypot(dx, dy) + 0.01f;
+                float force = params.k_repulsion / (distance * distance);
             
-            forces[id1].first -= (dx / distance) * force;
-            forces[id1].second -= (dy / distance) * force;
-            forces[id2].first += (dx / distance) * force;
-            forces[id2].second += (dy / distance) * force;
+                fxs[i] -= (dx / distance) * force;
+                fys[i] -= (dy / distance) * force;
+                fxs[j] += (dx / distance) * force;
+                fys[j] += (dy / distance) * force;
+            }
         }
 
         // Attractive forces between connected vertices
-        for(const auto& edge : graph.adjacency_list) {
-            T src = edge.first;
-            T dest = edge.second.end;
-            
-            auto& pos_src = positions[src];
-            auto& pos_dest = positions[dest];
-            float dx = pos_dest.first - pos_src.first;
-            float dy = pos_dest.second - pos_src.second;
+        for(const FlatEdge& edge : edges) {
+            float dx = xs[edge.dest] - xs[edge.src];
+            float dy = ys[edge.dest] - ys[edge.src];
             float distance = std::hypot(dx, dy) + 0.01f;
-            float force = (distance - params.ideal_length) * params.k_attraction * edge.second.weight;
+            float force = (distance - params.ideal_length) * params.k_attraction * edge.weight;
             
-            forces[src].first += (dx / distance) * force;
-            forces[src].second += (dy / distance) * force;
-            forces[dest].first -= (dx / distance) * force;
-            forces[dest].second -= (dy / distance) * force;
+            fxs[edge.src] += (dx / distance) * force;
+            fys[edge.src] += (dy / distance) * force;
+            fxs[edge.dest] -= (dx / distance) * force;
+            fys[edge.dest] -= (dy / distance) * force;
         }
 
         // Update positions with bounds check
-        for(typename std::map<T, std::pair<float, float>>::iterator it = forces.begin(); 
-            it != forces.end(); ++it) {
-            T id = it->first;
-            float fx = it->second.first;
-            float fy = it->second.second;
-            
-            positions[id].first += fx * params.time_step;
-            positions[id].second += fy * params.time_step;
-            
-            // Manual clamping
-            positions[id].first = std::max(0.0f, std::min(params.width, positions[id].first));
-            positions[id].second = std::max(0.0f, std::min(params.height, positions[id].second));
+        for(int i = 0; i < n; ++i) {
+            xs[i] = std::max(0.0f, std::min(params.width, xs[i] + fxs[i] * params.time_step));
+            ys[i] = std::max(0.0f, std::min(params.height, ys[i] + fys[i] * params.time_step));
+        }
+    }
+
+    for (int i = 0; i < n; ++i) {
+        positions[vertex_ids[i]] = {xs[i], ys[i]};
+    }
+}
+
+// Every vertex gets the approximate sum of the repulsion of all others, instead of one vertex the exact sum
+template <typename T>
+void ForceDirectedLayout<T>::apply_barnes_hut(const ForceDirectedParams& params) {
+    const int n = static_cast<int>(xs.size());
+    quadtree.build(xs, ys);
+
+    #pragma omp parallel num_threads(get_num_threads())
+    {
+        std::vector<int> stack;
+        #pragma omp for schedule(dynamic, 256)
+        for (int i = 0; i < n; ++i) {
+            quadtree.force(i, params.k_repulsion, params.theta, stack, fxs[i], fys[i]);
         }
     }
 }
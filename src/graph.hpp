@@ -6,10 +6,11 @@
 #include <vector>
 #include <memory>
 #include <stdexcept>
-#include <imgui.h>
 #include <queue> 
 #include <new>
 #include <memory>
+#include "trace.hpp"
+#include "heap_model.hpp"
 
 // Max keyword count should equal 2^N - 1 where N is some integer to ensure that the Vertex struct is packed properly for memory purposes
 #define MAX_KEYWORD_COUNT 15
@@ -24,8 +25,6 @@ struct GraphParameters {
     int max_keywords = 5;
     int min_weight = 1;
     int max_weight = 10;
-    ImVec4 vertex_color = ImVec4(1.00f, 1.00f, 1.00f, 1.00f);
-    ImVec4 edge_color = ImVec4(0.0f, 1.0f, 0.0f, 1.00f);
 };
 
 //! We make use of templates for the Vertex struct and the SparseGraph class primarily so that the user may select the most memory efficient data type. If you don't need more than 256 unique vertices, you don't need more than a uint8_t, otherwise you might need a uint16_t or a uint32_t, etc.
@@ -87,6 +86,7 @@ public:
 
     bool            vertex_exists(T id);
     bool            keyword_is_in(T w, T v);
+    uint64_t        memory_bytes() const;                          //!< Heap bytes held by the graph, see heap_model.hpp
 
     template <class U>friend std::ostream& operator<<(std::ostream& os, SparseGraph<U>&);
 
@@ -157,6 +157,7 @@ void SparseGraph<T>::add_keyword(T id, T word) {
 
 template <typename T>
 void SparseGraph<T>::process_keyword_additions() {
+    TRACE_ZONE("SparseGraph::process_keyword_additions");
     T i = 0;
     while (!keyword_add_queue.empty()) {
         KeywordPair<T> pair = keyword_add_queue.front();
@@ -264,6 +265,7 @@ std::vector<T> SparseGraph<T>::get_keywords(T id) {
 
 template <typename T>
 std::vector<VerboseEdge<T>> SparseGraph<T>::get_edge_list() {
+    TRACE_ZONE("SparseGraph::get_edge_list");
     std::vector<VerboseEdge<T>> list;
 
     for (auto vert : vertices) {
@@ -310,6 +312,14 @@ bool SparseGraph<T>::keyword_is_in(T w, T v) {
     return false;
 }
 
+template <typename T>
+uint64_t SparseGraph<T>::memory_bytes() const {
+    return vector_bytes(vertices) + vertices.size() * heap_chunk_bytes(sizeof(Vertex<T>))
+         + adjacency_list.size() * multimap_node_bytes<T, Edge<T>>()
+         + (keyword_index.size() + reverse_index.size()) * multimap_node_bytes<T, T>()
+         + keyword_add_queue.size() * sizeof(KeywordPair<T>);
+}
+
 template <class T>
 std::ostream& operator<<(std::ostream& os, SparseGraph<T>& graph) {
         for (Vertex<T>* vert : graph.vertices) {
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <unistd.h>
+#include "graph_cache.hpp"
+#include "graph_generator.hpp"
+#include "hash_util.hpp"
+#include "trace.hpp"
+
+namespace fs = std::filesystem;
+
+static bool same_params(const GraphParameters& a, const GraphParameters& b) {
+    return a.n_vertices == b.n_vertices && a.n_keywords == b.n_keywords && a.min_degree == b.min_degree && a.max_degree == b.max_degree &&
+           a.min_keywords == b.min_keywords && a.max_keywords == b.max_keywords && a.min_weight == b.min_weight && a.max_weight == b.max_weight;
+}
+
+// Cache entries are recognised by name, temporary files and anything else in the directory are left alone
+static bool is_entry(const fs::path& path) {
+    std::string name = path.filename().string();
+    std::string ext = path.extension().string();
+    return (name.rfind("graph-", 0) == 0 && ext == ".snapshot") || (name.rfind("matrix-", 0) == 0 && ext == ".bin");
+}
+
+static std::string hex_key(uint64_t key) {
+    char buffer[17];
+    std::snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)key);
+    return buffer;
+}
+
+GraphCache::GraphCache(std::string dir, uint64_t bytes) {
+    directory = dir.empty() ? "." : dir;
+    max_bytes = bytes;
+
+    std::error_code error;
+    fs::create_directories(directory, error);
+    if (error) {
+        throw std::runtime_error("Unable to create cache directory " + directory + ": " + error.message());
+    }
+}
+
+// Fields are hashed as fixed-width values so the key does not depend on struct padding
+uint64_t GraphCache::graph_key(const GraphParameters& p, uint64_t seed) {
+    int32_t values[9] = {(int32_t)GRAPH_GENERATOR_VERSION, p.n_vertices, p.n_keywords, p.min_degree, p.max_degree, p.min_keywords, p.max_keywords, p.min_weight, p.max_weight};
+    uint64_t h = fnv1a64(values, sizeof(values));
+    return fnv1a64(&seed, sizeof(seed), h);
+}
+
+uint64_t GraphCache::matrix_key(const GraphParameters& p, uint64_t seed, const MatrixOptions& options) {
+    int32_t landmarks = options.engine == ENGINE_APPROX ? options.n_landmarks : 0;
+    int32_t values[4] = {(int32_t)GRAPH_CACHE_MATRIX_VERSION, (int32_t)options.engine, options.max_radius, landmarks};
+    return fnv1a64(values, sizeof(values), graph_key(p, seed));
+}
+
+std::string GraphCache::graph_path(uint64_t key) const {
+    return (fs::path(directory) / ("graph-" + hex_key(key) + ".snapshot")).string();
+}
+
+std::string GraphCache::matrix_path(uint64_t key) const {
+    return (fs::path(directory) / ("matrix-" + hex_key(key) + ".bin")).string();
+}
+
+// Unique per process and call, so concurrent writers of the same entry never share a temporary file
+std::string GraphCache::temp_path(const std::string& path) const {
+    static std::atomic<unsigned> counter(0);
+    return path + ".tmp" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+}
+
+void GraphCache::commit(const std::string& temp, const std::string& path) {
+    std::error_code error;
+    fs::rename(temp, path, error);
+    if (error) {
+        fs::remove(temp, error);
+        throw std::runtime_error("Unable to add " + path + " to the cache");
+    }
+    evict(path);
+}
+
+// The modification time doubles as the last use, so a hit pushes the entry to the back of the eviction order
+void GraphCache::touch(const std::string& path) const {
+    std::error_code error;
+    fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+}
+
+std::unique_ptr<GraphSnapshotReader> GraphCache::find_graph(const GraphParameters& params, uint64_t seed) {
+    TRACE_ZONE("GraphCache::find_graph");
+    std::string path = graph_path(graph_key(params, seed));
+    if (!fs::exists(path)) {
+        ++stats.misses;
+        return nullptr;
+    }
+
+    std::unique_ptr<GraphSnapshotReader> reader;
+    try {
+        reader = std::make_unique<GraphSnapshotReader>(path);
+    } catch (const std::exception& e) {
+        std::cerr << "Dropping unreadable cache entry: " << e.what() << std::endl;
+        std::error_code error;
+        fs::remove(path, error);
+        ++stats.misses;
+        return nullptr;
+    }
+
+    // The snapshot records what it was generated from, which also rules out a key collision
+    if (!same_params(reader->get_params(), params) || reader->get_seed() != seed) {
+        ++stats.misses;
+        return nullptr;
+    }
+
+    touch(path);
+    ++stats.hits;
+    std::cout << "Graph cache hit " << path << std::endl;
+    return reader;
+}
+
+void GraphCache::store_graph(const CSRGraph<int>& graph, const GraphParameters& params, uint64_t seed) {
+    TRACE_ZONE("GraphCache::store_graph");
+    std::string path = graph_path(graph_key(params, seed));
+    std::string temp = temp_path(path);
+
+    GraphSnapshotWriter writer;
+    writer.write(temp, graph, params, seed);
+    commit(temp, path);
+}
+
+std::unique_ptr<BinaryMatrixReader> GraphCache::find_matrix(const GraphParameters& params, uint64_t seed, const MatrixOptions& options) {
+    TRACE_ZONE("GraphCache::find_matrix");
+    std::string path = matrix_path(matrix_key(params, seed, options));
+    if (!fs::exists(path)) {
+        ++stats.misses;
+        return nullptr;
+    }
+
+    std::unique_ptr<BinaryMatrixReader> reader;
+    try {
+        reader = std::make_unique<BinaryMatrixReader>(path);
+    } catch (const std::exception& e) {
+        std::cerr << "Dropping unreadable cache entry: " << e.what() << std::endl;
+        std::error_code error;
+        fs::remove(path, error);
+        ++stats.misses;
+        return nullptr;
+    }
+
+    Pair size = reader->get_size();
+    if (size.pred != params.n_keywords || size.dist != params.n_vertices || reader->get_max_radius() != options.max_radius) {
+        ++stats.misses;
+        return nullptr;
+    }
+
+    touch(path);
+    ++stats.hits;
+    std::cout << "Matrix cache hit " << path << std::endl;
+    return reader;
+}
+
+void GraphCache::store_matrix(const KeywordDistanceMatrix& matrix, const GraphParameters& params, uint64_t seed, const MatrixOptions& options) {
+    TRACE_ZONE("GraphCache::store_matrix");
+    std::string path = matrix_path(matrix_key(params, seed, options));
+    std::string temp = temp_path(path);
+
+    BinaryMatrixWriter writer(dtype);
+    try {
+        writer.write(temp, matrix);
+    } catch (...) {
+        std::error_code error;
+        fs::remove(temp, error);
+        throw;
+    }
+    commit(temp, path);
+}
+
+void GraphCache::store_matrix_file(std::string filepath, const GraphParameters& params, uint64_t seed, const MatrixOptions& options) {
+    std::string path = matrix_path(matrix_key(params, seed, options));
+    std::string temp = temp_path(path);
+
+    std::error_code error;
+    fs::copy_file(filepath, temp, fs::copy_options::overwrite_existing, error);
+    if (error) {
+        fs::remove(temp, error);
+        throw std::runtime_error("Unable to copy " + filepath + " into the cache: " + error.message());
+    }
+    commit(temp, path);
+}
+
+void GraphCache::set_max_bytes(uint64_t bytes) {
+    max_bytes = bytes;
+    evict("");
+}
+
+uint64_t GraphCache::size_bytes() const {
+    uint64_t total = 0;
+    std::error_code error;
+    for (const fs::directory_entry& entry : fs::directory_iterator(directory, error)) {
+        std::error_code size_error;
+        uint64_t bytes = entry.file_size(size_error);
+        if (!size_error && entry.is_regular_file(size_error) && is_entry(entry.path())) total += bytes;
+    }
+    return total;
+}
+
+/*! Least recently used first. Other processes may be adding or removing entries at the same time, so every
+ * filesystem error here only means that entry is somebody else's business now. Readers that still map an
+ * evicted file keep working, the data goes away when the last mapping does
+ */
+void GraphCache::evict(const std::string& keep) {
+    if (max_bytes == 0) return;
+
+    struct Entry {
+        fs::path            path;
+        uint64_t            bytes;
+        fs::file_time_type  used;
+    };
+
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    std::error_code error;
+    for (const fs::directory_entry& entry : fs::directory_iterator(directory, error)) {
+        if (!is_entry(entry.path())) continue;
+
+        std::error_code entry_error;
+        Entry e = {entry.path(), entry.file_size(entry_error), entry.last_write_time(entry_error)};
+        if (entry_error) continue;
+        entries.push_back(e);
+        total += e.bytes;
+    }
+    if (total <= max_bytes) return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    for (const Entry& e : entries) {
+        if (total <= max_bytes) break;
+        if (e.path == fs::path(keep)) continue;
+
+        std::error_code remove_error;
+        if (fs::remove(e.path, remove_error)) {
+            total -= e.bytes;
+            ++stats.evictions;
+        }
+    }
+}
+
+void GraphCache::clear() {
+    std::error_code error;
+    std::vector<fs::path> entries;
+    for (const fs::directory_entry& entry : fs::directory_iterator(directory, error)) {
+        if (is_entry(entry.path())) entries.push_back(entry.path());
+    }
+    for (const fs::path& path : entries) {
+        fs::remove(path, error);
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef EVA_GRAPH_CACHE
+#define EVA_GRAPH_CACHE
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "graph.hpp"
+#include "csr_graph.hpp"
+#include "graph_snapshot.hpp"
+#include "binary_matrix.hpp"
+#include "keyword_distance_matrix.hpp"
+
+const uint32_t GRAPH_CACHE_MATRIX_VERSION = 1;          //!< Bump whenever an engine changes the matrix it produces for a graph
+const uint64_t GRAPH_CACHE_DEFAULT_BYTES = 4ULL << 30;
+
+enum MatrixEngine : uint32_t {
+    ENGINE_CPU = 1,
+    ENGINE_GPU = 2,
+    ENGINE_APPROX = 3,
+};
+
+//! Everything besides the graph that decides which matrix an engine produces
+struct MatrixOptions {
+    MatrixEngine engine = ENGINE_CPU;
+    int          max_radius = 0;        //!< > 0 for a sparse matrix
+    int          n_landmarks = 0;       //!< ENGINE_APPROX only
+};
+
+struct GraphCacheStats {
+    long hits = 0;
+    long misses = 0;
+    long evictions = 0;
+};
+
+/*! On-disk cache of generated graphs and their keyword-distance matrices, so that a sweep that revisits a
+ * parameter set neither regenerates the graph nor recomputes the matrix. Entries are content addressed:
+ * a graph is keyed by a hash of its GraphParameters, the seed and GRAPH_GENERATOR_VERSION, a matrix by the
+ * key of its graph plus the MatrixOptions and GRAPH_CACHE_MATRIX_VERSION. Graphs are stored as snapshots
+ * (graph-<key>.snapshot) and matrices as binary matrix files (matrix-<key>.bin), and a hit hands out the
+ * memory-mapped reader of the file.
+ *
+ * Entries are written to a temporary file and renamed into place, so several processes can share a
+ * directory and a reader never sees half an entry. Whenever an entry is added the least recently used
+ * entries (by modification time, which a hit refreshes) are removed until the cache fits its byte budget.
+ * Only graphs that really come from GraphGenerator with the given seed belong in the cache.
+ */
+class GraphCache {
+public:
+    GraphCache(std::string directory, uint64_t max_bytes = GRAPH_CACHE_DEFAULT_BYTES); //!< max_bytes = 0 never evicts
+
+    static uint64_t graph_key(const GraphParameters& params, uint64_t seed);
+    static uint64_t matrix_key(const GraphParameters& params, uint64_t seed, const MatrixOptions& options);
+
+    std::unique_ptr<GraphSnapshotReader> find_graph(const GraphParameters& params, uint64_t seed);   //!< nullptr on a miss
+    void store_graph(const CSRGraph<int>& graph, const GraphParameters& params, uint64_t seed);
+
+    std::unique_ptr<BinaryMatrixReader> find_matrix(const GraphParameters& params, uint64_t seed, const MatrixOptions& options); //!< nullptr on a miss
+    void store_matrix(const KeywordDistanceMatrix& matrix, const GraphParameters& params, uint64_t seed, const MatrixOptions& options);
+    void store_matrix_file(std::string filepath, const GraphParameters& params, uint64_t seed, const MatrixOptions& options); //!< Copies a finished binary matrix, e.g. a streamed one
+
+    void     set_matrix_dtype(BinaryMatrixDtype d) { dtype = d; }  //!< Encoding of matrices stored from memory
+    void     set_max_bytes(uint64_t bytes);                        //!< Evicts right away if the cache is over the new budget
+    uint64_t size_bytes() const;
+    void     clear();
+
+    const GraphCacheStats& get_stats() const { return stats; }
+    const std::string&     get_directory() const { return directory; }
+
+private:
+    std::string graph_path(uint64_t key) const;
+    std::string matrix_path(uint64_t key) const;
+    std::string temp_path(const std::string& path) const;
+    void        commit(const std::string& temp, const std::string& path);
+    void        evict(const std::string& keep);
+    void        touch(const std::string& path) const;
+
+    std::string       directory;
+    uint64_t          max_bytes;
+    BinaryMatrixDtype dtype = DTYPE_INT32;
+    GraphCacheStats   stats;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include "graph_condensation.hpp"
+#include "trace.hpp"
+
+// Iterative Tarjan so that long paths in large generated graphs cannot overflow the call stack
+GraphCondensation::GraphCondensation(const CSRView<int>& graph) {
+    TRACE_ZONE("GraphCondensation::GraphCondensation");
+    const int V = graph.n_vertices;
+
+    std::vector<int> index(V, -1);
+    std::vector<int> lowlink(V, 0);
+    std::vector<char> on_stack(V, 0);
+    std::vector<int> stack;
+    std::vector<std::pair<int, int>> call_stack; // (vertex, next edge to visit)
+    std::vector<int> tarjan_id(V, -1);
+    int next_index = 0;
+    int n_found = 0;
+
+    for (int root = 0; root < V; root++) {
+        if (index[root] != -1) continue;
+
+        call_stack.push_back({root, graph.edges_begin(root)});
+        index[root] = lowlink[root] = next_index++;
+        stack.push_back(root);
+        on_stack[root] = 1;
+
+        while (!call_stack.empty()) {
+            auto& [v, e] = call_stack.back();
+
+            if (e < graph.edges_end(v)) {
+                int u = graph.targets[e++];
+                if (index[u] == -1) {
+                    index[u] = lowlink[u] = next_index++;
+                    stack.push_back(u);
+                    on_stack[u] = 1;
+                    call_stack.push_back({u, graph.edges_begin(u)});
+                } else if (on_stack[u]) {
+                    lowlink[v] = std::min(lowlink[v], index[u]);
+                }
+                continue;
+            }
+
+            int done = v;
+            call_stack.pop_back();
+            if (!call_stack.empty()) {
+                int parent = call_stack.back().first;
+                lowlink[parent] = std::min(lowlink[parent], lowlink[done]);
+            }
+
+            if (lowlink[done] == index[done]) {
+                int u;
+                do {
+                    u = stack.back();
+                    stack.pop_back();
+                    on_stack[u] = 0;
+                    tarjan_id[u] = n_found;
+                } while (u != done);
+                ++n_found;
+            }
+        }
+    }
+
+    // Tarjan emits components sinks first, so reversing the ids yields a topological numbering
+    component.resize(V);
+    comp_offsets.assign(n_found + 1, 0);
+    for (int v = 0; v < V; v++) {
+        component[v] = n_found - 1 - tarjan_id[v];
+        ++comp_offsets[component[v] + 1];
+    }
+    for (int c = 0; c < n_found; c++) {
+        comp_offsets[c + 1] += comp_offsets[c];
+    }
+
+    comp_vertices.resize(V);
+    std::vector<int> fill(comp_offsets.begin(), comp_offsets.end() - 1);
+    for (int v = 0; v < V; v++) {
+        comp_vertices[fill[component[v]]++] = v;
+    }
+
+    trivial.assign(n_found, 0);
+    dag_offsets.assign(n_found + 1, 0);
+    std::vector<int> last_seen(n_found, -1);
+    for (int c = 0; c < n_found; c++) {
+        trivial[c] = (comp_offsets[c + 1] - comp_offsets[c]) == 1;
+
+        for (int i = comp_offsets[c]; i < comp_offsets[c + 1]; i++) {
+            int v = comp_vertices[i];
+            for (int e = graph.edges_begin(v); e < graph.edges_end(v); e++) {
+                int target = component[graph.targets[e]];
+                if (target == c) {
+                    trivial[c] = 0;
+                    continue;
+                }
+                if (last_seen[target] == c) continue;
+
+                last_seen[target] = c;
+                dag_targets.push_back(target);
+            }
+        }
+        dag_offsets[c + 1] = static_cast<int>(dag_targets.size());
+    }
+}
+
+int GraphCondensation::mark_reachable(const CSRView<int>& graph, int w, std::vector<char>& reachable) const {
+    return mark_reachable(graph.keyword_vertices + graph.holders_begin(w), graph.holders_end(w) - graph.holders_begin(w), reachable);
+}
+
+int GraphCondensation::mark_reachable(const int* sources, int n_sources, std::vector<char>& reachable) const {
+    const int C = n_components();
+    reachable.assign(C, 0);
+
+    int lowest = C;
+    for (int i = 0; i < n_sources; i++) {
+        int c = component[sources[i]];
+        reachable[c] = 1;
+        lowest = std::min(lowest, c);
+    }
+
+    // Components are topologically ordered, so one ascending sweep propagates reachability
+    for (int c = lowest; c < C; c++) {
+        if (!reachable[c]) continue;
+        for (int i = dag_offsets[c]; i < dag_offsets[c + 1]; i++) {
+            reachable[dag_targets[i]] = 1;
+        }
+    }
+
+    return lowest;
+}
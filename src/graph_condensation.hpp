@@ -0,0 +1,35 @@
+#ifndef EVA_GRAPH_CONDENSATION
+#define EVA_GRAPH_CONDENSATION
+
+#include <vector>
+#include "csr_graph.hpp"
+
+/*! Strongly connected components of a CSR graph and the condensation DAG between them. Components are
+ * numbered in topological order, so every DAG edge goes from a lower to a higher component id and a
+ * single ascending sweep over the ids visits a component only after everything that can reach it.
+ * The matrix engines build this once per graph and use it to find, for each keyword, the region
+ * reachable from its holders; everything outside that region is unreachable and can be filled in bulk.
+ */
+class GraphCondensation {
+public:
+    GraphCondensation(const CSRView<int>& graph);
+
+    int  n_components() const                   { return static_cast<int>(comp_offsets.size()) - 1; }
+    int  members_begin(int c) const             { return comp_offsets[c];       }
+    int  members_end(int c) const               { return comp_offsets[c + 1];   }
+    int  successors_begin(int c) const          { return dag_offsets[c];        }
+    int  successors_end(int c) const            { return dag_offsets[c + 1];    }
+    bool is_trivial(int c) const                { return trivial[c] != 0;       } //!< Single vertex without a self loop
+
+    int  mark_reachable(const CSRView<int>& graph, int w, std::vector<char>& reachable) const; //!< Flags every component reachable from a holder of w, returns the lowest one
+    int  mark_reachable(const int* sources, int n_sources, std::vector<char>& reachable) const; //!< Flags every component reachable from the given vertices, returns the lowest one
+
+    std::vector<int>  component;        //!< Component id of each vertex
+    std::vector<int>  comp_offsets;     //!< n_components + 1 entries into comp_vertices
+    std::vector<int>  comp_vertices;    //!< Vertices grouped by component
+    std::vector<int>  dag_offsets;      //!< n_components + 1 entries into dag_targets
+    std::vector<int>  dag_targets;      //!< Duplicate-free successor components
+    std::vector<char> trivial;
+};
+
+#endif
@@ -3,6 +3,11 @@
 
 #include "graph.hpp"
 #include "simd_random.hpp"
+#include "background_task.hpp"
+#include "metrics.hpp"
+
+//! Bump whenever generate() or the random number generator changes what a seed produces, this invalidates cached graphs
+const uint32_t GRAPH_GENERATOR_VERSION = 2;
 
 // This class randomly generates a graph according to user parameters
 // !! THE GRAPH CAN OUTLIVE THE GENERATOR !!
@@ -38,10 +43,25 @@ GraphGenerator<T>::~GraphGenerator() {
 
 template <typename T>
 SparseGraph<T>* GraphGenerator<T>::generate(T n_vertices, T n_keywords, T min_keywords, T max_keywords, T min_degree, T max_degree, T min_weight, T max_weight) {
+    TRACE_ZONE("GraphGenerator::generate");
     SparseGraph<T>* graph = new SparseGraph<T>();
+    TaskControl* control = TaskControl::current();
+    if (control) control->set_stage("Generating graph");
+    std::shared_ptr<ProgressSource> progress = Metrics::global().start_progress("generate_graph", n_vertices);
+    T reported = 0;
 
     // Generate vertices and populate with keywords
     for (T i = 0; i < n_vertices; ++i) {
+        if (i % 4096 == 0) {
+            progress->done.add(i - reported);
+            reported = i;
+            if (control && control->cancelled()) {
+                delete graph;
+                throw TaskCancelled();
+            }
+            if (control) control->set_progress(i, n_vertices);
+        }
+
         Vertex<T>* vert = new Vertex<T>;
         vert->id = i;
      
@@ -61,6 +81,7 @@ SparseGraph<T>* GraphGenerator<T>::generate(T n_vertices, T n_keywords, T min_ke
         }
     }
 
+    progress->done.add(n_vertices - reported);
     graph->process_keyword_additions();
 
     std::cout << "Graph generated" << std::endl;
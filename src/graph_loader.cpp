@@ -0,0 +1,346 @@
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <immintrin.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "graph_loader.hpp"
+#include "thread_config.hpp"
+
+const size_t MIN_CHUNK_BYTES = 1 << 20; // Smaller files are not worth splitting further
+const int    CHUNKS_PER_THREAD = 8;     // Uneven line lengths are balanced by the dynamic schedule
+const int    MAX_DIGITS = 10;           // Enough for any int32 id
+
+// Shuffle masks that right-align the first n bytes of a 16-byte vector, filling the front with zeros
+struct AlignTable {
+    alignas(16) unsigned char masks[17][16];
+
+    AlignTable() {
+        for (int n = 0; n <= 16; n++) {
+            for (int i = 0; i < 16; i++) {
+                masks[n][i] = i >= 16 - n ? i - (16 - n) : 0x80;
+            }
+        }
+    }
+};
+static const AlignTable align_table;
+
+static inline bool is_digit(char c)     { return (unsigned char)(c - '0') < 10; }
+static inline bool is_blank(char c)     { return c == ' ' || c == '\t' || c == '\r'; }
+
+/*! Parses the unsigned integer at p and returns the first byte after it, or nullptr if there is no number
+ * or it has more than MAX_DIGITS digits. With 16 readable bytes the digits are found with one compare,
+ * right-aligned with a shuffle and combined with three multiply-adds instead of one multiply per digit.
+ */
+static inline const char* parse_uint(const char* p, const char* end, uint64_t& value) {
+    if (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i digits = _mm_sub_epi8(chunk, _mm_set1_epi8('0'));
+        __m128i in_range = _mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits);
+        unsigned non_digits = ~(unsigned)_mm_movemask_epi8(in_range) | 0x10000;
+        int n = __builtin_ctz(non_digits);
+        if (n == 0 || n > MAX_DIGITS) return nullptr;
+
+        __m128i aligned = _mm_shuffle_epi8(digits, _mm_load_si128(reinterpret_cast<const __m128i*>(align_table.masks[n])));
+        __m128i pairs = _mm_maddubs_epi16(aligned, _mm_setr_epi8(10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1, 10, 1));
+        __m128i quads = _mm_madd_epi16(pairs, _mm_setr_epi16(100, 1, 100, 1, 100, 1, 100, 1));
+        __m128i packed = _mm_packus_epi32(quads, quads);
+        __m128i octs = _mm_madd_epi16(packed, _mm_setr_epi16(10000, 1, 10000, 1, 10000, 1, 10000, 1));
+
+        value = (uint64_t)(uint32_t)_mm_cvtsi128_si32(octs) * 100000000ULL + (uint32_t)_mm_extract_epi32(octs, 1);
+        return p + n;
+    }
+
+    const char* start = p;
+    value = 0;
+    while (p < end && is_digit(*p) && p - start < MAX_DIGITS + 1) {
+        value = value * 10 + (*p - '0');
+        ++p;
+    }
+    if (p == start || p - start > MAX_DIGITS) return nullptr;
+    return p;
+}
+
+// Read-only mapping of a whole file
+struct MappedFile {
+    const char* data = nullptr;
+    size_t      size = 0;
+
+    MappedFile(const std::string& filepath) {
+        int fd = open(filepath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Unable to open file " + filepath);
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("Unable to stat file " + filepath);
+        }
+
+        size = st.st_size;
+        if (size > 0) {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Unable to map file " + filepath);
+            }
+            madvise(mapping, size, MADV_WILLNEED);
+            data = static_cast<const char*>(mapping);
+        }
+        close(fd);
+    }
+
+    ~MappedFile() {
+        if (data) munmap(const_cast<char*>(data), size);
+    }
+};
+
+// Cuts the file into about n pieces that each start at the beginning of a line
+static std::vector<size_t> split_lines(const MappedFile& file, int n) {
+    std::vector<size_t> bounds = {0};
+    for (int i = 1; i < n; i++) {
+        size_t target = std::max(bounds.back(), file.size / n * i);
+        const char* nl = static_cast<const char*>(std::memchr(file.data + target, '\n', file.size - target));
+        if (!nl) break;
+        bounds.push_back(nl - file.data + 1);
+    }
+    bounds.push_back(file.size);
+    return bounds;
+}
+
+/*! Parses every line of the file into the per-chunk record lists. on_line receives the numbers of one
+ * line and appends its records; it returns false for a malformed line. Returns the byte offset of the
+ * first malformed line, or SIZE_MAX if there is none.
+ */
+template <typename Record, typename OnLine>
+static size_t parse_file(const MappedFile& file, std::vector<std::vector<Record>>& records, OnLine on_line) {
+    int n_chunks = std::max<size_t>(1, std::min<size_t>(get_num_threads() * CHUNKS_PER_THREAD, file.size / MIN_CHUNK_BYTES));
+    std::vector<size_t> bounds = split_lines(file, n_chunks);
+    n_chunks = bounds.size() - 1;
+    records.assign(n_chunks, std::vector<Record>());
+
+    std::vector<size_t> errors(n_chunks, SIZE_MAX);
+    const char* file_end = file.data + file.size;
+
+    #pragma omp parallel num_threads(get_num_threads())
+    {
+        std::vector<uint64_t> values;
+
+        #pragma omp for schedule(dynamic)
+        for (int c = 0; c < n_chunks; c++) {
+            const char* p = file.data + bounds[c];
+            const char* end = file.data + bounds[c + 1];
+            std::vector<Record>& out = records[c];
+            out.reserve((end - p) / 8);
+
+            while (p < end) {
+                const char* line = p;
+                while (p < end && is_blank(*p)) ++p;
+
+                if (p < end && (*p == '#' || *p == '%')) {
+                    const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+                    p = nl ? nl + 1 : end;
+                    continue;
+                }
+
+                values.clear();
+                bool ok = true;
+                while (p < end && *p != '\n') {
+                    uint64_t value;
+                    const char* next = parse_uint(p, file_end, value);
+                    if (!next || next > end) {
+                        ok = false;
+                        break;
+                    }
+                    values.push_back(value);
+                    p = next;
+                    if (p < end && !is_blank(*p) && *p != '\n') {
+                        ok = false;
+                        break;
+                    }
+                    while (p < end && is_blank(*p)) ++p;
+                }
+
+                if (!ok || (!values.empty() && !on_line(values, out))) {
+                    errors[c] = line - file.data;
+                    break;
+                }
+                if (p < end) ++p;
+            }
+        }
+    }
+
+    return *std::min_element(errors.begin(), errors.end());
+}
+
+/*! Stable counting sort of the records into CSR offsets and values, consuming the records. Scattering
+ * straight to the final positions would miss the cache on nearly every record of an unsorted file, so the
+ * records are first partitioned into key ranges and each range is then sorted on its own, with counters
+ * and output window small enough to stay in cache. Within a key, records keep their file order.
+ */
+template <typename Record, typename Key, typename Value, typename Out>
+static void build_csr(std::vector<std::vector<Record>>& records, int n_keys, Key key, Value value, std::vector<int>& offsets, std::vector<Out>& values) {
+    const int n_chunks = records.size();
+    const int n_buckets = std::max(1, std::min(n_keys, 1024));
+    const int keys_per_bucket = std::max(1, (n_keys + n_buckets - 1) / n_buckets);
+
+    std::vector<size_t> starts((size_t)n_chunks * n_buckets, 0);
+    #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic)
+    for (int c = 0; c < n_chunks; c++) {
+        size_t* counts = starts.data() + (size_t)c * n_buckets;
+        for (const Record& r : records[c]) ++counts[key(r) / keys_per_bucket];
+    }
+
+    std::vector<size_t> bucket_begin(n_buckets + 1, 0);
+    size_t position = 0;
+    for (int b = 0; b < n_buckets; b++) {
+        bucket_begin[b] = position;
+        for (int c = 0; c < n_chunks; c++) {
+            size_t count = starts[(size_t)c * n_buckets + b];
+            starts[(size_t)c * n_buckets + b] = position;
+            position += count;
+        }
+    }
+    bucket_begin[n_buckets] = position;
+
+    std::vector<Record> staged(position);
+    #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic)
+    for (int c = 0; c < n_chunks; c++) {
+        size_t* cursor = starts.data() + (size_t)c * n_buckets;
+        for (const Record& r : records[c]) staged[cursor[key(r) / keys_per_bucket]++] = r;
+        std::vector<Record>().swap(records[c]);
+    }
+
+    offsets.assign(n_keys + 1, 0);
+    values.resize(position);
+    #pragma omp parallel num_threads(get_num_threads())
+    {
+        std::vector<size_t> cursor;
+
+        #pragma omp for schedule(dynamic)
+        for (int b = 0; b < n_buckets; b++) {
+            int first_key = b * keys_per_bucket;
+            int last_key = std::min(n_keys, first_key + keys_per_bucket);
+            if (first_key >= last_key) continue;
+
+            cursor.assign(last_key - first_key, 0);
+            for (size_t i = bucket_begin[b]; i < bucket_begin[b + 1]; i++) ++cursor[key(staged[i]) - first_key];
+
+            size_t at = bucket_begin[b];
+            for (int k = first_key; k < last_key; k++) {
+                offsets[k] = at;
+                size_t count = cursor[k - first_key];
+                cursor[k - first_key] = at;
+                at += count;
+            }
+
+            for (size_t i = bucket_begin[b]; i < bucket_begin[b + 1]; i++) values[cursor[key(staged[i]) - first_key]++] = value(staged[i]);
+        }
+    }
+    offsets[n_keys] = position;
+}
+
+GraphLoader::GraphLoader() {
+
+}
+
+CSRGraph<int> GraphLoader::load(std::string edge_path, std::string keyword_path) {
+    const int weight = default_weight;
+
+    MappedFile edge_file(edge_path);
+    std::vector<std::vector<VerboseEdge<int>>> edges;
+    size_t bad = parse_file(edge_file, edges, [weight](const std::vector<uint64_t>& v, std::vector<VerboseEdge<int>>& out) {
+        if (v.size() < 2 || v.size() > 3 || v[0] >= INT_MAX || v[1] >= INT_MAX || (v.size() == 3 && v[2] > INT_MAX)) return false;
+        out.push_back({(int)v[0], (int)v[1], v.size() == 3 ? (int)v[2] : weight});
+        return true;
+    });
+    if (bad != SIZE_MAX) {
+        throw std::runtime_error("Malformed edge at byte " + std::to_string(bad) + " of " + edge_path);
+    }
+
+    std::vector<std::vector<KeywordPair<int>>> keywords;
+    if (!keyword_path.empty()) {
+        MappedFile keyword_file(keyword_path);
+        bad = parse_file(keyword_file, keywords, [](const std::vector<uint64_t>& v, std::vector<KeywordPair<int>>& out) {
+            if (v[0] >= INT_MAX) return false;
+            for (size_t i = 1; i < v.size(); i++) {
+                if (v[i] >= INT_MAX) return false;
+                out.push_back({(int)v[0], (int)v[i]});
+            }
+            return true;
+        });
+        if (bad != SIZE_MAX) {
+            throw std::runtime_error("Malformed keyword line at byte " + std::to_string(bad) + " of " + keyword_path);
+        }
+    }
+
+    size_t n_edges = 0, n_postings = 0;
+    for (const auto& chunk : edges) n_edges += chunk.size();
+    for (const auto& chunk : keywords) n_postings += chunk.size();
+    if (n_edges >= INT_MAX || n_postings >= INT_MAX) {
+        throw std::runtime_error("Graph in " + edge_path + " is too large for int32 offsets");
+    }
+
+    int V = 0, W = 0, max_w = 0;
+    #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic) reduction(max:V, W, max_w)
+    for (size_t c = 0; c < std::max(edges.size(), keywords.size()); c++) {
+        if (c < edges.size()) {
+            for (const VerboseEdge<int>& e : edges[c]) {
+                V = std::max(V, std::max(e.start, e.end) + 1);
+                max_w = std::max(max_w, e.weight);
+            }
+        }
+        if (c < keywords.size()) {
+            for (const KeywordPair<int>& k : keywords[c]) {
+                V = std::max(V, k.vert + 1);
+                W = std::max(W, k.keyword + 1);
+            }
+        }
+    }
+    max_weight = max_w;
+
+    CSRGraph<int> graph;
+    graph.n_vertices = V;
+    graph.n_keywords = W;
+
+    // Targets and weights are sorted together and split afterwards
+    std::vector<std::pair<int, int>> adjacency;
+    build_csr(edges, V, [](const VerboseEdge<int>& e) { return e.start; }, [](const VerboseEdge<int>& e) { return std::make_pair(e.end, e.weight); }, graph.offsets, adjacency);
+
+    graph.targets.resize(adjacency.size());
+    graph.weights.resize(adjacency.size());
+    #pragma omp parallel for num_threads(get_num_threads())
+    for (size_t e = 0; e < adjacency.size(); e++) {
+        graph.targets[e] = adjacency[e].first;
+        graph.weights[e] = adjacency[e].second;
+    }
+
+    // Keyword postings are sorted and deduplicated like in the SparseGraph conversion
+    std::vector<int> offsets, holders;
+    build_csr(keywords, W, [](const KeywordPair<int>& k) { return k.keyword; }, [](const KeywordPair<int>& k) { return k.vert; }, offsets, holders);
+    std::vector<int> unique_counts(W);
+    #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic, 64)
+    for (int w = 0; w < W; w++) {
+        auto first = holders.begin() + offsets[w];
+        auto last = holders.begin() + offsets[w + 1];
+        std::sort(first, last);
+        unique_counts[w] = std::unique(first, last) - first;
+    }
+
+    graph.keyword_offsets.assign(W + 1, 0);
+    for (int w = 0; w < W; w++) graph.keyword_offsets[w + 1] = graph.keyword_offsets[w] + unique_counts[w];
+    graph.keyword_vertices.resize(graph.keyword_offsets[W]);
+    #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic, 64)
+    for (int w = 0; w < W; w++) {
+        std::copy_n(holders.begin() + offsets[w], unique_counts[w], graph.keyword_vertices.begin() + graph.keyword_offsets[w]);
+    }
+
+    std::cout << "Loaded " << V << " vertices, " << graph.n_edges() << " edges and " << W << " keywords" << std::endl;
+    return graph;
+}
@@ -0,0 +1,34 @@
+#ifndef EVA_GRAPH_LOADER
+#define EVA_GRAPH_LOADER
+
+#include <string>
+#include "graph.hpp"
+#include "csr_graph.hpp"
+
+/*! Importer for real graphs stored as whitespace-separated text, e.g. SNAP edge lists.
+ *
+ * The edge file has one "start end [weight]" line per directed edge; edges without a weight column get
+ * the default weight. The optional keyword file has one "vertex keyword keyword ..." line per vertex.
+ * Lines starting with # or % are comments. Vertex and keyword ids are non-negative integers and the
+ * graph gets max id + 1 vertices and max keyword + 1 keywords.
+ *
+ * Files are memory-mapped and cut into chunks at newline boundaries, the chunks are parsed in parallel
+ * with SSE digit parsing, and the CSR arrays are filled directly by a cache-friendly counting sort, so
+ * SparseGraph is never built. Edges of a vertex keep their order in the file, like in a SparseGraph, so
+ * the result does not depend on the number of threads.
+ */
+class GraphLoader {
+public:
+    GraphLoader();
+
+    CSRGraph<int> load(std::string edge_path, std::string keyword_path = "");
+
+    void set_default_weight(int w)  { default_weight = w; } //!< Weight of edges without a weight column
+    int  get_max_weight() const     { return max_weight;  } //!< Largest weight seen by the last load()
+
+private:
+    int default_weight = 1;
+    int max_weight = 0;
+};
+
+#endif
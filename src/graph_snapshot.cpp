@@ -0,0 +1,232 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "graph_snapshot.hpp"
+#include "hash_util.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+static uint64_t align64(uint64_t x) {
+    return (x + 63) / 64 * 64;
+}
+
+static void params_to_header(const GraphParameters& p, int32_t* out) {
+    int32_t values[8] = {p.n_vertices, p.n_keywords, p.min_degree, p.max_degree, p.min_keywords, p.max_keywords, p.min_weight, p.max_weight};
+    std::memcpy(out, values, sizeof(values));
+}
+
+// The five arrays in file order with their element counts
+static void array_layout(const GraphSnapshotHeader& h, uint64_t at[5], uint64_t count[5]) {
+    uint64_t a[5] = {h.offsets_at, h.targets_at, h.weights_at, h.keyword_offsets_at, h.keyword_vertices_at};
+    uint64_t c[5] = {(uint64_t)h.n_vertices + 1, h.n_edges, h.n_edges, (uint64_t)h.n_keywords + 1, h.n_keyword_entries};
+    std::copy(a, a + 5, at);
+    std::copy(c, c + 5, count);
+}
+
+static uint64_t checksum_arrays(const void* const arrays[5], const uint64_t count[5]) {
+    uint64_t hashes[5];
+    for (int i = 0; i < 5; i++) {
+        hashes[i] = hash_block(arrays[i], count[i] * sizeof(int32_t));
+    }
+    return fnv1a64(hashes, sizeof(hashes));
+}
+
+static void write_all(int fd, const void* buffer, size_t n, const std::string& filepath) {
+    static Counter& bytes_written = Metrics::global().counter("bytes_written");
+    bytes_written.add(n);
+    const char* bytes = static_cast<const char*>(buffer);
+    while (n > 0) {
+        ssize_t written = ::write(fd, bytes, n);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            std::string reason = std::strerror(errno);
+            close(fd);
+            throw std::runtime_error("Unable to write to file " + filepath + ": " + reason);
+        }
+        bytes += written;
+        n -= written;
+    }
+}
+
+GraphSnapshotWriter::GraphSnapshotWriter() {
+
+}
+
+// The arrays are already in memory, so the checksum and the layout are known before the first byte is written
+void GraphSnapshotWriter::write(std::string filepath, const CSRGraph<int>& graph, const GraphParameters& params, uint64_t seed) {
+    TRACE_ZONE("GraphSnapshotWriter::write");
+    GraphSnapshotHeader header = {};
+    std::memcpy(header.magic, GRAPH_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = GRAPH_SNAPSHOT_VERSION;
+    header.n_vertices = graph.n_vertices;
+    header.n_keywords = graph.n_keywords;
+    header.n_edges = graph.targets.size();
+    header.n_keyword_entries = graph.keyword_vertices.size();
+    params_to_header(params, header.params);
+    header.seed = seed;
+
+    const void* arrays[5] = {graph.offsets.data(), graph.targets.data(), graph.weights.data(), graph.keyword_offsets.data(), graph.keyword_vertices.data()};
+    uint64_t* at[5] = {&header.offsets_at, &header.targets_at, &header.weights_at, &header.keyword_offsets_at, &header.keyword_vertices_at};
+    uint64_t count[5] = {graph.offsets.size(), graph.targets.size(), graph.weights.size(), graph.keyword_offsets.size(), graph.keyword_vertices.size()};
+
+    uint64_t position = sizeof(GraphSnapshotHeader);
+    for (int i = 0; i < 5; i++) {
+        position = align64(position);
+        *at[i] = position;
+        position += count[i] * sizeof(int32_t);
+    }
+    header.checksum = checksum_arrays(arrays, count);
+
+    int fd = open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to create file " + filepath);
+    }
+
+    const char padding[64] = {};
+    write_all(fd, &header, sizeof(header), filepath);
+    position = sizeof(header);
+    for (int i = 0; i < 5; i++) {
+        write_all(fd, padding, *at[i] - position, filepath);
+        write_all(fd, arrays[i], count[i] * sizeof(int32_t), filepath);
+        position = *at[i] + count[i] * sizeof(int32_t);
+    }
+    close(fd);
+
+    std::cout << "Successfully wrote " << filepath << std::endl;
+}
+
+GraphSnapshotReader::GraphSnapshotReader(std::string filepath) {
+    int fd = open(filepath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file " + filepath);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(GraphSnapshotHeader)) {
+        close(fd);
+        throw std::runtime_error("Not a graph snapshot: " + filepath);
+    }
+
+    size = st.st_size;
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        throw std::runtime_error("Unable to map file " + filepath);
+    }
+
+    data = static_cast<const char*>(mapping);
+    header = reinterpret_cast<const GraphSnapshotHeader*>(data);
+
+    std::string problem;
+    if (std::memcmp(header->magic, GRAPH_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) problem = "Not a graph snapshot: ";
+    else if (header->version != GRAPH_SNAPSHOT_VERSION) problem = "Unsupported graph snapshot version in ";
+    else if (header->n_vertices > 0x7FFFFFFF || header->n_keywords > 0x7FFFFFFF || header->n_edges > 0x7FFFFFFF || header->n_keyword_entries > 0x7FFFFFFF) problem = "Graph snapshot too large for int32 ids: ";
+    else {
+        uint64_t at[5], count[5];
+        array_layout(*header, at, count);
+        for (int i = 0; i < 5; i++) {
+            if (at[i] % sizeof(int32_t) != 0 || at[i] < sizeof(GraphSnapshotHeader) || at[i] > size || count[i] > (size - at[i]) / sizeof(int32_t)) problem = "Truncated graph snapshot: ";
+        }
+    }
+
+    if (!problem.empty()) {
+        munmap(mapping, size);
+        throw std::runtime_error(problem + filepath);
+    }
+}
+
+GraphSnapshotReader::~GraphSnapshotReader() {
+    munmap(const_cast<char*>(data), size);
+}
+
+const int32_t* GraphSnapshotReader::offsets() const          { return reinterpret_cast<const int32_t*>(data + header->offsets_at);          }
+const int32_t* GraphSnapshotReader::targets() const          { return reinterpret_cast<const int32_t*>(data + header->targets_at);          }
+const int32_t* GraphSnapshotReader::weights() const          { return reinterpret_cast<const int32_t*>(data + header->weights_at);          }
+const int32_t* GraphSnapshotReader::keyword_offsets() const  { return reinterpret_cast<const int32_t*>(data + header->keyword_offsets_at);  }
+const int32_t* GraphSnapshotReader::keyword_vertices() const { return reinterpret_cast<const int32_t*>(data + header->keyword_vertices_at); }
+
+GraphParameters GraphSnapshotReader::get_params() const {
+    GraphParameters p;
+    p.n_vertices = header->params[0];
+    p.n_keywords = header->params[1];
+    p.min_degree = header->params[2];
+    p.max_degree = header->params[3];
+    p.min_keywords = header->params[4];
+    p.max_keywords = header->params[5];
+    p.min_weight = header->params[6];
+    p.max_weight = header->params[7];
+    return p;
+}
+
+bool GraphSnapshotReader::verify() const {
+    uint64_t at[5], count[5];
+    array_layout(*header, at, count);
+    const void* arrays[5] = {offsets(), targets(), weights(), keyword_offsets(), keyword_vertices()};
+    return checksum_arrays(arrays, count) == header->checksum;
+}
+
+// The matrix engines index straight into these arrays, so their structure is checked once here
+void GraphSnapshotReader::check_arrays() const {
+    const int V = header->n_vertices;
+    const int W = header->n_keywords;
+    const int E = header->n_edges;
+    const int K = header->n_keyword_entries;
+
+    const int32_t* off = offsets();
+    const int32_t* tgt = targets();
+    const int32_t* kw_off = keyword_offsets();
+    const int32_t* kw_vert = keyword_vertices();
+
+    bool ok = off[0] == 0 && off[V] == E && kw_off[0] == 0 && kw_off[W] == K;
+    for (int v = 0; ok && v < V; v++) ok = off[v] <= off[v + 1];
+    for (int w = 0; ok && w < W; w++) ok = kw_off[w] <= kw_off[w + 1];
+    for (int e = 0; ok && e < E; e++) ok = tgt[e] >= 0 && tgt[e] < V;
+    for (int i = 0; ok && i < K; i++) ok = kw_vert[i] >= 0 && kw_vert[i] < V;
+    if (!ok) {
+        throw std::runtime_error("Corrupt graph snapshot");
+    }
+}
+
+CSRGraph<int> GraphSnapshotReader::to_csr() const {
+    TRACE_ZONE("GraphSnapshotReader::to_csr");
+    check_arrays();
+    const int V = header->n_vertices;
+    const int W = header->n_keywords;
+    const int E = header->n_edges;
+    const int K = header->n_keyword_entries;
+
+    CSRGraph<int> graph;
+    graph.n_vertices = V;
+    graph.n_keywords = W;
+    graph.offsets.assign(offsets(), offsets() + V + 1);
+    graph.targets.assign(targets(), targets() + E);
+    graph.weights.assign(weights(), weights() + E);
+    graph.keyword_offsets.assign(keyword_offsets(), keyword_offsets() + W + 1);
+    graph.keyword_vertices.assign(keyword_vertices(), keyword_vertices() + K);
+    return graph;
+}
+
+CSRView<int> GraphSnapshotReader::view() const {
+    TRACE_ZONE("GraphSnapshotReader::view");
+    check_arrays();
+    CSRView<int> graph;
+    graph.n_vertices = header->n_vertices;
+    graph.n_keywords = header->n_keywords;
+    graph.offsets = offsets();
+    graph.targets = targets();
+    graph.weights = weights();
+    graph.keyword_offsets = keyword_offsets();
+    graph.keyword_vertices = keyword_vertices();
+    return graph;
+}
+
+SparseGraph<int>* GraphSnapshotReader::to_sparse_graph() const {
+    return to_csr().to_sparse_graph();
+}
@@ -0,0 +1,77 @@
+#ifndef EVA_GRAPH_SNAPSHOT
+#define EVA_GRAPH_SNAPSHOT
+
+#include <cstdint>
+#include <string>
+#include "graph.hpp"
+#include "csr_graph.hpp"
+
+/*! Binary snapshot of a generated graph, so that experiments can be re-run on the same graph without
+ * regenerating it. The file is a 128-byte GraphSnapshotHeader followed by the five CSRGraph<int> arrays
+ * (offsets, targets, weights, keyword_offsets, keyword_vertices) as little endian int32, each starting
+ * on a 64-byte boundary. The header records the GraphParameters and seed the graph was generated with.
+ * The writer emits the file in one sequential pass, the reader maps it and either bulk-copies the arrays
+ * or hands out a view that reads them in place.
+ */
+
+const char     GRAPH_SNAPSHOT_MAGIC[8] = {'E', 'V', 'A', 'G', 'R', 'A', 'P', 'H'};
+const uint32_t GRAPH_SNAPSHOT_VERSION = 1;
+
+struct GraphSnapshotHeader {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint32_t n_vertices;
+    uint32_t n_keywords;
+    uint64_t n_edges;
+    uint64_t n_keyword_entries;     //!< Size of keyword_vertices
+    int32_t  params[8];             //!< GraphParameters in declaration order
+    uint64_t seed;
+    uint64_t offsets_at;            //!< File offsets of the arrays
+    uint64_t targets_at;
+    uint64_t weights_at;
+    uint64_t keyword_offsets_at;
+    uint64_t keyword_vertices_at;
+    uint64_t checksum;
+};
+static_assert(sizeof(GraphSnapshotHeader) == 128, "GraphSnapshotHeader must stay 128 bytes");
+
+class GraphSnapshotWriter {
+public:
+    GraphSnapshotWriter();
+
+    void write(std::string filepath, const CSRGraph<int>& graph, const GraphParameters& params, uint64_t seed);
+};
+
+//! Memory-mapped snapshot. Pointers returned by the accessors live as long as the reader
+class GraphSnapshotReader {
+public:
+    GraphSnapshotReader(std::string filepath);
+    ~GraphSnapshotReader();
+    GraphSnapshotReader(const GraphSnapshotReader&) = delete;
+    GraphSnapshotReader& operator=(const GraphSnapshotReader&) = delete;
+
+    const GraphSnapshotHeader& get_header() const { return *header; }
+    GraphParameters            get_params() const;
+    uint64_t                   get_seed() const   { return header->seed; }
+    bool                       verify() const;    //!< Recomputes the checksum
+
+    CSRGraph<int>    to_csr() const;              //!< Validates the arrays and copies them out in bulk
+    CSRView<int>     view() const;                //!< Validates the arrays and reads them from the mapping, lives as long as the reader
+    SparseGraph<int>* to_sparse_graph() const;    //!< Rebuilds a SparseGraph for the renderer, caller owns it
+
+    const int32_t* offsets() const;
+    const int32_t* targets() const;
+    const int32_t* weights() const;
+    const int32_t* keyword_offsets() const;
+    const int32_t* keyword_vertices() const;
+
+private:
+    void check_arrays() const;                    //!< Throws if the arrays do not form a valid CSR graph
+
+    const char*                data;
+    size_t                     size;
+    const GraphSnapshotHeader* header;
+};
+
+#endif
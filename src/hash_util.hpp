@@ -0,0 +1,49 @@
+#ifndef EVA_HASH_UTIL
+#define EVA_HASH_UTIL
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+const uint64_t FNV_PRIME  = 0x100000001b3ULL;
+
+//! Byte-wise FNV-1a, meant for short keys; chain calls by passing the previous result as h
+inline uint64_t fnv1a64(const void* data, size_t n, uint64_t h = FNV_OFFSET) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < n; i++) {
+        h ^= bytes[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/*! Non-cryptographic checksum for large blocks. It consumes 8 bytes per step, so it keeps up with disk
+ * bandwidth where byte-wise FNV would not. Blocks are hashed independently (and in parallel) and the
+ * per-block results combined with fnv1a64.
+ */
+inline uint64_t hash_block(const void* data, size_t n, uint64_t seed = 0) {
+    const uint64_t K1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t K2 = 0xC2B2AE3D27D4EB4FULL;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+    uint64_t h = seed ^ (n * K1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        h ^= word * K2;
+        h = ((h << 31) | (h >> 33)) * K1;
+    }
+
+    uint64_t tail = 0;
+    std::memcpy(&tail, bytes + i, n - i);
+    h ^= tail * K2;
+
+    h ^= h >> 33;
+    h *= K2;
+    h ^= h >> 29;
+    return h;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef EVA_HEAP_MODEL
+#define EVA_HEAP_MODEL
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*! Heap model shared by the per-structure byte counters (memory_bytes() of SparseGraph, CSRGraph and
+ * KeywordDistanceMatrix) and the pre-flight estimator in memory_budget.hpp, so the two can be compared. It
+ * follows glibc malloc and libstdc++ on 64-bit: every allocation carries an 8 byte header and is rounded up
+ * to 16 bytes with a 32 byte minimum, and a std::multimap node is a 32 byte tree header followed by its
+ * key/value pair.
+ */
+constexpr uint64_t heap_chunk_bytes(uint64_t n)         { return std::max<uint64_t>(32, (n + 8 + 15) / 16 * 16); }
+const uint64_t     TREE_NODE_HEADER_BYTES = 32;
+
+template <typename K, typename V>
+constexpr uint64_t multimap_node_bytes()                { return heap_chunk_bytes(TREE_NODE_HEADER_BYTES + sizeof(std::pair<const K, V>)); }
+
+template <typename T>
+uint64_t vector_bytes(const std::vector<T>& v)          { return v.capacity() * sizeof(T); }
+
+#endif
@@ -1,20 +1,46 @@
 #include "keyword_distance_matrix.hpp"
 #include <omp.h>
 #include <iostream>
+#include <queue>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <string>
 #include "percent_tracker.hpp"
-
-const int BIG_NUMBER = 0x7FFFFFFF;
-
-const int BATCH_SIZE = 50; // keywords to process per batch
-const int LOCAL_SIZE = 1024; // threads per work group
-
-KeywordDistanceMatrix::KeywordDistanceMatrix(int n_W, int n_V, int max_weight) {
+#include "graph_condensation.hpp"
+#include "distance_index.hpp"
+#include "binary_matrix.hpp"
+#include "thread_config.hpp"
+#include "matrix_checkpoint.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+typedef std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<std::pair<int, int>>> MinHeap;
+const int NEAR_SEARCH = -2;     // via[v] of approximate cells the bounded search found the best path to
+
+// Scratch space of one thread. dist/pred are kept at BIG_NUMBER/-1 between keywords and only the touched
+// vertices are reset, so a keyword costs what its reachable part of the graph costs rather than O(V)
+struct KeywordDistanceMatrix::Workspace {
+    std::vector<unsigned> dist;
+    std::vector<int> pred;
+    std::vector<char> reachable;
+    std::vector<int> touched;
+    std::priority_queue<std::pair<unsigned, int>, std::vector<std::pair<unsigned, int>>, std::greater<std::pair<unsigned, int>>> heap;
+    uint64_t relaxed = 0;           //!< Edges relaxed since the last flush into the edges_relaxed counter
+
+    Workspace(int V) : dist(V, BIG_NUMBER), pred(V, -1) {}
+};
+
+KeywordDistanceMatrix::KeywordDistanceMatrix(int n_W, int n_V, int max_weight, int radius) {
     W = n_W;
     V = n_V;
     MAX_WEIGHT = max_weight + 1;
-    matrix = new std::atomic<Pair>*[W];
-    for (int i = 0; i < W; i++) {
-        matrix[i] = new std::atomic<Pair>[V];
+    max_radius = radius > 0 ? radius : 0;
+    matrix = nullptr;
+
+    if (is_sparse()) {
+        sparse_rows.resize(W);
     }
 }
 
@@ -28,8 +54,39 @@ KeywordDistanceMatrix::~KeywordDistanceMatrix() {
     }
 }
 
+void KeywordDistanceMatrix::check_shape(const CSRView<int>& graph) const {
+    if (graph.n_vertices != V || graph.n_keywords != W) {
+        throw std::runtime_error("Graph has " + std::to_string(graph.n_vertices) + " vertices and " + std::to_string(graph.n_keywords) +
+                                 " keywords but the matrix is " + std::to_string(W) + "x" + std::to_string(V));
+    }
+}
+
+// The dense matrix is only allocated once something is going to fill it, so a streamed computation never holds it
+void KeywordDistanceMatrix::allocate_dense() {
+    if (matrix || is_sparse()) return;
+
+    matrix = new Pair*[W];
+    for (int i = 0; i < W; i++) {
+        matrix[i] = new Pair[V];
+    }
+}
+
 Pair KeywordDistanceMatrix::operator()(int w, int v) const {
-    return (matrix[w][v]).load();
+    if (!is_sparse()) return matrix[w][v];
+
+    const std::vector<SparseEntry>& row = sparse_rows[w];
+    auto it = std::lower_bound(row.begin(), row.end(), v, [](const SparseEntry& e, int vert) { return e.vert < vert; });
+    if (it == row.end() || it->vert != v) return {-1, BIG_NUMBER};
+    return {it->pred, it->dist};
+}
+
+uint64_t KeywordDistanceMatrix::memory_bytes() const {
+    uint64_t bytes = 0;
+    if (matrix) bytes += W * (sizeof(Pair*) + heap_chunk_bytes((uint64_t)V * sizeof(Pair)));
+    for (const std::vector<SparseEntry>& row : sparse_rows) {
+        bytes += sizeof(row) + (row.capacity() ? heap_chunk_bytes(vector_bytes(row)) : 0);
+    }
+    return bytes;
 }
 
 Pair KeywordDistanceMatrix::get_size() const {
@@ -38,209 +95,482 @@ Pair KeywordDistanceMatrix::get_size() const {
 }
 
 void KeywordDistanceMatrix::calculate_matrix_cpu(SparseGraph<int>* graph) {
-    std::vector<VerboseEdge<int>> list = graph->get_edge_list();
-    if (list.size() == 0) {
-        std::cerr << "No edges found for " << __func__ << std::endl;
+    calculate_matrix_cpu(CSRGraph<int>(*graph, W));
+}
+
+void KeywordDistanceMatrix::calculate_matrix_cpu(const CSRView<int>& graph) {
+    if (is_sparse()) {
+        calculate_rows_cpu(graph, nullptr, nullptr, 0, W);
         return;
     }
 
-    ProgressTracker tracker("calculate_matrix_cpu", "All keywords processed.", W);
-    tracker.begin();
+    allocate_dense();
+    GraphCondensation condensation(graph);
+    calculate_rows_cpu(graph, &condensation, nullptr, 0, W);
+}
 
+void KeywordDistanceMatrix::calculate_matrix_cpu(SparseGraph<int>* graph, OrderedRowQueue<MatrixRow>& rows) {
+    calculate_matrix_cpu(CSRGraph<int>(*graph, W), rows);
+}
 
-    #pragma omp parallel num_threads(10) 
-    {
-       #pragma omp for 
-        for (int w = 0; w < W; w++) {
-            unsigned* dist = new unsigned[V];
-            int* pred = new int[V];
+void KeywordDistanceMatrix::calculate_matrix_cpu(const CSRView<int>& graph, OrderedRowQueue<MatrixRow>& rows) {
+    calculate_matrix_cpu(graph, rows, 0, W);
+}
 
-            for (int v = 0; v < V; v++) {
-                dist[v] = BIG_NUMBER;
-                pred[v] = -1;
+void KeywordDistanceMatrix::calculate_matrix_cpu(const CSRView<int>& graph, OrderedRowQueue<MatrixRow>& rows, int first_keyword, int last_keyword) {
+    if (first_keyword < 0 || last_keyword > W || first_keyword > last_keyword) {
+        throw std::runtime_error("Keyword range [" + std::to_string(first_keyword) + ", " + std::to_string(last_keyword) + ") is outside of the " +
+                                 std::to_string(W) + " keywords");
+    }
+    if (is_sparse()) {
+        calculate_rows_cpu(graph, nullptr, &rows, first_keyword, last_keyword);
+        return;
+    }
+
+    GraphCondensation condensation(graph);
+    calculate_rows_cpu(graph, &condensation, &rows, first_keyword, last_keyword);
+}
+
+// Keywords are handed out in increasing order, which is what lets an OrderedRowQueue consumer keep up
+// with a bounded number of rows in flight. A closed queue stops the remaining keywords from being computed.
+// With a checkpoint, rows it already holds are read back instead of computed and new rows are added to it
+void KeywordDistanceMatrix::calculate_rows_cpu(const CSRView<int>& graph, const GraphCondensation* condensation, OrderedRowQueue<MatrixRow>* rows, int first, int last) {
+    TRACE_ZONE("calculate_matrix_cpu");
+    check_shape(graph);
+    ProgressTracker tracker("calculate_matrix_cpu", "All keywords processed.", last - first);
+    tracker.begin();
+
+    std::atomic<bool> stopped(false);
+    std::exception_ptr failure;
+    static Counter& edges_relaxed = Metrics::global().counter("edges_relaxed");
 
-                if (graph->keyword_is_in(w, v)) {
-                    dist[v] = 0;
-                    pred[v] = v;
+    #pragma omp parallel num_threads(get_num_threads())
+    {
+        Workspace ws(V);
+        MatrixRow row;
+
+        #pragma omp for schedule(dynamic)
+        for (int w = first; w < last; w++) {
+            if (stopped || tracker.cancelled()) continue;
+            TRACE_ZONE("keyword_row");
+
+            try {
+                std::vector<SparseEntry>& sparse = rows ? row.sparse : sparse_rows[w];
+                Pair* dense = nullptr;
+                if (!is_sparse()) {
+                    if (rows) row.dense.resize(V);
+                    dense = rows ? row.dense.data() : matrix[w];
                 }
-            }
 
-            // This part of the algorithm is the most run-time intensive and potentially has the most
-            // opportunity for optimization
-            for (int counter = 0; counter < V; counter++) {
-                for (auto& edge: list) {
-                    if (dist[edge.start] + edge.weight < dist[edge.end]) {
-                        dist[edge.end] = dist[edge.start] + edge.weight;
-                        pred[edge.end] = edge.start;
+                if (checkpoint && checkpoint->has_row(w)) {
+                    if (is_sparse()) checkpoint->read_row(w, sparse);
+                    else checkpoint->read_row(w, dense);
+                } else {
+                    if (is_sparse()) compute_sparse_row(graph, w, sparse, ws);
+                    else compute_dense_row(graph, *condensation, w, dense, ws);
+
+                    if (checkpoint) {
+                        if (is_sparse()) checkpoint->add_row(w, sparse);
+                        else checkpoint->add_row(w, dense);
+                        checkpoint->maybe_commit();
                     }
-                }   
+                }
+            } catch (...) {
+                #pragma omp critical(calculate_rows_failure)
+                if (!failure) failure = std::current_exception();
+                stopped = true;
+                if (rows) rows->close();
+                continue;
             }
 
-            for (int v = 0; v < V; v++) {
-                (matrix[w][v]).store({(int)dist[v], pred[v]});
+            if (rows) {
+                if (!rows->push(w - first, std::move(row))) stopped = true;
+                row = MatrixRow();
             }
-            
-            tracker.increment_and_print();
-            delete[] dist;
-            delete[] pred;
+
+            edges_relaxed.add(ws.relaxed);
+            ws.relaxed = 0;
+            tracker.increment();
         }
     }
+
+    // Whatever was finished survives a cancellation or a failure, unless writing the checkpoint is what failed
+    if (checkpoint) {
+        try {
+            checkpoint->commit();
+        } catch (...) {
+            if (!failure) failure = std::current_exception();
+        }
+    }
+    if (failure) std::rethrow_exception(failure);
+    tracker.throw_if_cancelled();
+    tracker.finish();
 }
 
-void setUniforms(GLuint computeProgram, int V, int E, int W) {
-    glUseProgram(computeProgram);
+// Exact single-keyword shortest paths restricted to the part of the graph reachable from the keyword's
+// holders. Components are visited in topological order: by the time a component is reached, every edge
+// entering it has already been relaxed, so trivial components only need their out-edges relaxed and
+// cyclic ones run a Dijkstra confined to their own vertices. Unreachable cells are filled in bulk
+void KeywordDistanceMatrix::compute_dense_row(const CSRView<int>& graph, const GraphCondensation& condensation, int w, Pair* row, Workspace& ws) const {
+    std::fill_n(row, V, Pair{-1, BIG_NUMBER});
+    if (graph.holders_begin(w) == graph.holders_end(w)) return;
+
+    std::vector<unsigned>& dist = ws.dist;
+    std::vector<int>& pred = ws.pred;
+    std::vector<int>& touched = ws.touched;
+    auto& heap = ws.heap;
+    const int C = condensation.n_components();
+
+    int lowest = condensation.mark_reachable(graph, w, ws.reachable);
+    for (int i = graph.holders_begin(w); i < graph.holders_end(w); i++) {
+        int v = graph.keyword_vertices[i];
+        dist[v] = 0;
+        pred[v] = v;
+        touched.push_back(v);
+    }
+
+    for (int c = lowest; c < C; c++) {
+        if (!ws.reachable[c]) continue;
+
+        if (condensation.is_trivial(c)) {
+            int u = condensation.comp_vertices[condensation.members_begin(c)];
+            for (int e = graph.edges_begin(u); e < graph.edges_end(u); e++) {
+                int next = graph.targets[e];
+                unsigned nd = dist[u] + graph.weights[e];
+                if (nd >= dist[next]) continue;
+                ws.relaxed++;
+
+                if (dist[next] == (unsigned)BIG_NUMBER) touched.push_back(next);
+                dist[next] = nd;
+                pred[next] = u;
+            }
+            continue;
+        }
 
-    auto setUniformChecked = [&](const char* name, GLuint value) {
-        GLint loc = glGetUniformLocation(computeProgram, name);
-        if (loc != -1) {
-            glUniform1ui(loc, value);
-            std::cout << "Set uniform " << name << " = " << value << std::endl;
-        } else {
-            std::cerr << "Warning: Uniform " << name << " not found (may be optimized out)" << std::endl;
+        for (int i = condensation.members_begin(c); i < condensation.members_end(c); i++) {
+            int v = condensation.comp_vertices[i];
+            if (dist[v] != (unsigned)BIG_NUMBER) heap.push({dist[v], v});
         }
-    };
 
-    setUniformChecked("V", V);
-    setUniformChecked("E", E);
-    setUniformChecked("W", W);
+        while (!heap.empty()) {
+            auto [d, u] = heap.top();
+            heap.pop();
+            if (d > dist[u]) continue;
+
+            for (int e = graph.edges_begin(u); e < graph.edges_end(u); e++) {
+                int next = graph.targets[e];
+                unsigned nd = d + graph.weights[e];
+                if (nd >= dist[next]) continue;
+                ws.relaxed++;
+
+                if (dist[next] == (unsigned)BIG_NUMBER) touched.push_back(next);
+                dist[next] = nd;
+                pred[next] = u;
+                if (condensation.component[next] == c) heap.push({nd, next});
+            }
+        }
+    }
+
+    for (int v : touched) {
+        row[v] = {pred[v], (int)dist[v]};
+        dist[v] = BIG_NUMBER;
+        pred[v] = -1;
+    }
+    touched.clear();
 }
 
-void KeywordDistanceMatrix::calculate_matrix_gpu(SparseGraph<int>* graph) {
-    GLuint computeProgram = createShaderProgram("keyword_matrix.comp");
-    if (computeProgram == 0) {
-        std::cerr << "Unable to compile shaders for " << __func__ << std::endl;
-        return;
+// Multi-source Dijkstra from every vertex holding w that never expands past max_radius, so the cost of a
+// keyword is proportional to the size of its radius-neighbourhood rather than to V
+void KeywordDistanceMatrix::compute_sparse_row(const CSRView<int>& graph, int w, std::vector<SparseEntry>& row, Workspace& ws) const {
+    const unsigned radius = max_radius;
+    std::vector<unsigned>& dist = ws.dist;
+    std::vector<int>& pred = ws.pred;
+    std::vector<int>& touched = ws.touched;
+    auto& heap = ws.heap;
+
+    for (int i = graph.holders_begin(w); i < graph.holders_end(w); i++) {
+        int v = graph.keyword_vertices[i];
+        dist[v] = 0;
+        pred[v] = v;
+        touched.push_back(v);
+        heap.push({0, v});
     }
 
-    GLint status;
-    glGetProgramiv(computeProgram, GL_LINK_STATUS, &status);
-    if (status != GL_TRUE) {
-        GLchar log[1024];
-        glGetProgramInfoLog(computeProgram, sizeof(log), nullptr, log);
-        std::cerr << "Program link failed:\n" << log << std::endl;
-        return;
+    while (!heap.empty()) {
+        auto [d, u] = heap.top();
+        heap.pop();
+        if (d > dist[u]) continue;
+
+        for (int e = graph.edges_begin(u); e < graph.edges_end(u); e++) {
+            int next = graph.targets[e];
+            unsigned nd = d + graph.weights[e];
+            if (nd > radius || nd >= dist[next]) continue;
+            ws.relaxed++;
+
+            if (dist[next] == (unsigned)BIG_NUMBER) touched.push_back(next);
+            dist[next] = nd;
+            pred[next] = u;
+            heap.push({nd, next});
+        }
     }
 
-    std::vector<VerboseEdge<int>> edges = graph->get_edge_list();
-    int E = edges.size();
-    if (E == 0) {
-        std::cerr << "No edges found for " << __func__ << std::endl;
-        return;
+    std::sort(touched.begin(), touched.end());
+    row.clear();
+    row.reserve(touched.size());
+    for (int v : touched) {
+        row.push_back({v, (int)dist[v], pred[v]});
+        dist[v] = BIG_NUMBER;
+        pred[v] = -1;
     }
+    touched.clear();
+}
 
-    // Create and bind buffers
-    GLuint ssbos[8]; // EdgeList, HasKeyword, Dist0, Dist1, Pred0, Pred1, OutputDist, OutputPred
-    glGenBuffers(8, ssbos);
-    
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[0]);
-    glBufferData(GL_SHADER_STORAGE_BUFFER, edges.size() * sizeof(VerboseEdge<int>), edges.data(), GL_STATIC_DRAW);
+// Landmark estimate of every cell. With U_w(L) = min over holders h of dist(h, L) and M_w(L) = max over
+// holders of dist(L, h), the triangle inequality gives for each landmark L
+//     dist(w, v) <= U_w(L) + dist(L, v)
+//     dist(w, v) >= dist(L, v) - M_w(L)   and   dist(w, v) >= U_w(L) - dist(v, L)
+// The rows are swept landmark by landmark so the inner loops stream over contiguous landmark tables
+ApproximationReport KeywordDistanceMatrix::calculate_matrix_approx(SparseGraph<int>* graph, int n_landmarks) {
+    return calculate_matrix_approx(CSRGraph<int>(*graph, W), n_landmarks);
+}
 
-    dynamicBatchSize = (V > dynamicBatchSizeCutoff) ? minBatchSize : BATCH_SIZE;
+ApproximationReport KeywordDistanceMatrix::calculate_matrix_approx(const CSRGraph<int>& csr, int n_landmarks) {
+    TRACE_ZONE("calculate_matrix_approx");
+    check_shape(csr);
+    allocate_dense();
+    ALTIndex index;
+    index.build(csr, n_landmarks);
+    const int L = index.n_landmarks();
 
-    ProgressTracker tracker("calculate_matrix_gpu", "All keywords processed.", W / dynamicBatchSize);
+    ProgressTracker tracker("calculate_matrix_approx", "All keywords processed.", W);
     tracker.begin();
 
-    // Process in batches
-    for (int batchStart = 0; batchStart < W; batchStart += dynamicBatchSize) {
-        const int batchSize = std::min(dynamicBatchSize, W - batchStart);
-
-        // Buffer 1: HasKeyword (batchSize × V)
-        std::vector<uint32_t> hasKeywordData(batchSize * V, 0);
-        for (int b = 0; b < batchSize; b++) {
-            int w = batchStart + b;
-            auto vertices = graph->get_vertices_with_keyword(w);
-            for (int v : vertices) {
-                if (v < V)
-                    hasKeywordData[b * V + v] = 1;
+    long finite = 0, exact = 0, unresolved = 0;
+    double gap_sum = 0, gap_max = 0;
+
+    #pragma omp parallel num_threads(get_num_threads()) reduction(+:finite, exact, unresolved, gap_sum) reduction(max:gap_max)
+    {
+        std::vector<unsigned> upper(V);
+        std::vector<unsigned> lower(V);
+        std::vector<int> via(V);
+        std::vector<char> unreachable(V);
+        std::vector<int> landmark_pred(L);
+        std::vector<int> near(V);
+        std::vector<int> near_pred(V);
+        std::vector<char> settled(V);
+        MinHeap heap;
+
+        #pragma omp for schedule(dynamic)
+        for (int w = 0; w < W; w++) {
+            if (tracker.cancelled()) continue;
+            TRACE_ZONE("approx_row");
+            std::fill(upper.begin(), upper.end(), (unsigned)BIG_NUMBER);
+            std::fill(lower.begin(), lower.end(), 0u);
+            std::fill(via.begin(), via.end(), -1);
+            std::fill(unreachable.begin(), unreachable.end(), 0);
+
+            for (int l = 0; l < L; l++) {
+                const int* from = index.from_row(l);
+                const int* to = index.to_row(l);
+
+                unsigned U = BIG_NUMBER, M = 0;
+                int closest = -1;
+                for (int i = csr.holders_begin(w); i < csr.holders_end(w); i++) {
+                    int h = csr.keyword_vertices[i];
+                    if ((unsigned)to[h] < U) closest = h;
+                    U = std::min(U, (unsigned)to[h]);
+                    M = std::max(M, (unsigned)from[h]);
+                }
+                if (csr.holders_begin(w) == csr.holders_end(w)) M = BIG_NUMBER;
+
+                // The landmark itself has no predecessor in its own tree; walk the closest holder's path into it instead
+                int landmark = index.get_landmarks()[l];
+                landmark_pred[l] = -1;
+                for (int u = closest; u != -1 && u != landmark; u = index.next_row(l)[u]) {
+                    landmark_pred[l] = u;
+                }
+
+                for (int v = 0; v < V; v++) {
+                    unsigned from_v = from[v], to_v = to[v];
+
+                    if (U != (unsigned)BIG_NUMBER && from_v != (unsigned)BIG_NUMBER && U + from_v < upper[v]) {
+                        upper[v] = U + from_v;
+                        via[v] = l;
+                    }
+
+                    // L reaches every holder but not v, or v reaches L while no holder does: v is unreachable
+                    if (M != (unsigned)BIG_NUMBER && from_v == (unsigned)BIG_NUMBER) unreachable[v] = 1;
+                    if (to_v != (unsigned)BIG_NUMBER && U == (unsigned)BIG_NUMBER) unreachable[v] = 1;
+
+                    if (M != (unsigned)BIG_NUMBER && from_v != (unsigned)BIG_NUMBER && from_v > M) lower[v] = std::max(lower[v], from_v - M);
+                    if (U != (unsigned)BIG_NUMBER && to_v != (unsigned)BIG_NUMBER && U > to_v) lower[v] = std::max(lower[v], U - to_v);
+                }
             }
-        }
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[1]);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, 
-                    hasKeywordData.size() * sizeof(uint32_t),
-                    hasKeywordData.data(), GL_DYNAMIC_DRAW);
-
-        const GLsizeiptr batchMatrixSize = batchSize * V * sizeof(uint32_t);
-        std::vector<uint32_t> initDist(batchSize * V, 0x7FFFFFFF);
-        std::vector<int> initPred(batchSize * V, -1);
-        
-        // Output pred buffers
-        for (int i = 2; i <= 3; i++) {
-            glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[i]);
-            glBufferData(GL_SHADER_STORAGE_BUFFER, batchMatrixSize, 
-                        initDist.data(), GL_DYNAMIC_DRAW);
-        }
 
-        // Input pred buffers
-        for (int i = 4; i <= 5; i++) {
-            glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[i]);
-            glBufferData(GL_SHADER_STORAGE_BUFFER, batchMatrixSize, 
-                        initPred.data(), GL_DYNAMIC_DRAW);
-        }
-        
-        // Output dist buffers
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[6]);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, batchMatrixSize, 
-                    initDist.data(), GL_DYNAMIC_COPY);
-        
-        // Output pred buffers
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[7]);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, batchSize * V * sizeof(int), 
-                    initPred.data(), GL_DYNAMIC_COPY);
-
-        // Bind all buffers
-        for (int i = 0; i < 8; i++) {
-            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, ssbos[i]);
-        }
+            // Landmarks bound cells far from the holders well but the close ones poorly, in relative terms, and
+            // cannot bound cells no landmark lies between. A Dijkstra from the holders that stops after
+            // settling approxSearchBudget vertices makes the close cells exact; a search that runs out of
+            // vertices first proves the rest unreachable, otherwise everything unsettled is at least as far
+            // as the frontier.
+            std::fill(near.begin(), near.end(), BIG_NUMBER);
+            std::fill(settled.begin(), settled.end(), 0);
+            while (!heap.empty()) heap.pop();
+            for (int i = csr.holders_begin(w); i < csr.holders_end(w); i++) {
+                int h = csr.keyword_vertices[i];
+                near[h] = 0;
+                near_pred[h] = h;
+                heap.push({0, h});
+            }
+            for (int n_settled = 0; !heap.empty() && n_settled < approxSearchBudget; ) {
+                auto [d, u] = heap.top();
+                heap.pop();
+                if (settled[u] || d > near[u]) continue;
+                settled[u] = 1;
+                ++n_settled;
+                for (int e = csr.edges_begin(u); e < csr.edges_end(u); e++) {
+                    int x = csr.targets[e];
+                    if (d + csr.weights[e] < near[x]) {
+                        near[x] = d + csr.weights[e];
+                        near_pred[x] = u;
+                        heap.push({near[x], x});
+                    }
+                }
+            }
+            bool exhausted = heap.empty();
+            unsigned frontier = exhausted ? 0 : (unsigned)heap.top().first;
+            for (int v = 0; v < V; v++) {
+                if ((unsigned)near[v] < upper[v]) {
+                    upper[v] = near[v];
+                    via[v] = NEAR_SEARCH;
+                }
+                if (settled[v]) lower[v] = upper[v];
+                else if (exhausted) unreachable[v] = 1;
+                else lower[v] = std::max(lower[v], frontier);
+            }
 
-        // Set uniforms
-        glUseProgram(computeProgram);
-        glUniform1ui(glGetUniformLocation(computeProgram, "V"), V);
-        glUniform1ui(glGetUniformLocation(computeProgram, "E"), E);
-        glUniform1ui(glGetUniformLocation(computeProgram, "W"), batchSize);
-
-        // Dispatch compute shader
-        GLuint workGroupsX = (batchSize * V + LOCAL_SIZE - 1) / LOCAL_SIZE;
-        glDispatchCompute(workGroupsX, 1, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-        glFinish();
-
-        // Read results for this batch
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[6]);
-        uint32_t* distData = (uint32_t*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
-       
-        if (!distData) {
-            std::cerr << "ERROR: Failed to map distance buffer in " << __func__ << std::endl;
-            glDeleteBuffers(8, ssbos);
-            glDeleteProgram(computeProgram);
-            return;
-        }
+            if (is_sparse()) sparse_rows[w].clear();
+            for (int v = 0; v < V; v++) {
+                int pred = -1;
+                if (upper[v] == 0) {
+                    pred = v;
+                } else if (via[v] == NEAR_SEARCH) {
+                    pred = near_pred[v];
+                } else if (via[v] != -1) {
+                    pred = index.get_landmarks()[via[v]] == v ? landmark_pred[via[v]] : index.pred_row(via[v])[v];
+                }
+
+                if (upper[v] == (unsigned)BIG_NUMBER) {
+                    if (!unreachable[v]) {
+                        ++unresolved;
+                        gap_sum += 1.0;
+                        gap_max = 1.0;
+                    }
+                } else {
+                    ++finite;
+                    if (lower[v] >= upper[v]) ++exact;
+                    double gap = upper[v] == 0 ? 0.0 : (double)(upper[v] - std::min(lower[v], upper[v])) / upper[v];
+                    gap_sum += gap;
+                    gap_max = std::max(gap_max, gap);
+                }
 
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[7]);
-        int* predData = (int*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
+                if (!is_sparse()) {
+                    matrix[w][v] = {pred, (int)upper[v]};
+                } else if (upper[v] <= (unsigned)max_radius) {
+                    sparse_rows[w].push_back({v, (int)upper[v], pred});
+                }
+            }
 
-        if (!predData) {
-            std::cerr << "ERROR: Failed to map pred buffer in " << __func__ << std::endl;
-            glDeleteBuffers(8, ssbos);
-            glDeleteProgram(computeProgram);
-            return;
+            tracker.increment();
         }
+    }
 
-        for (int b = 0; b < batchSize; b++) {
-            int w = batchStart + b;
-            for (int v = 0; v < V; v++) {
-                (matrix[w][v]).store({(int)distData[b * V + v], predData[b * V + v]});
+    tracker.throw_if_cancelled();
+    tracker.finish();
+    approximation = ApproximationReport();
+    approximation.n_landmarks = L;
+    approximation.finite_cells = finite;
+    approximation.exact_cells = exact;
+    approximation.unresolved_cells = unresolved;
+    approximation.mean_relative_gap = finite + unresolved ? gap_sum / (finite + unresolved) : 0.0;
+    approximation.max_relative_gap = gap_max;
+    return approximation;
+}
+
+ApproximationReport KeywordDistanceMatrix::validate_approximation(const KeywordDistanceMatrix& exact) const {
+    ApproximationReport report = approximation;
+    report.compared_cells = 0;
+    report.missed_cells = 0;
+
+    double error_sum = 0, error_max = 0;
+    for (int w = 0; w < W; w++) {
+        for (int v = 0; v < V; v++) {
+            int approx_dist = (*this)(w, v).dist;
+            int exact_dist = exact(w, v).dist;
+            if (exact_dist == BIG_NUMBER) continue;
+            if (approx_dist == BIG_NUMBER) {
+                ++report.missed_cells;
+                continue;
             }
+
+            double error = exact_dist == 0 ? (approx_dist == 0 ? 0.0 : 1.0) : (double)(approx_dist - exact_dist) / exact_dist;
+            error_sum += error;
+            error_max = std::max(error_max, error);
+            ++report.compared_cells;
         }
+    }
+
+    report.mean_relative_error = report.compared_cells ? error_sum / report.compared_cells : 0.0;
+    report.max_relative_error = error_max;
+    return report;
+}
+
+// Rows are decoded straight from the mapping, compressed files one row per thread at a time
+void KeywordDistanceMatrix::load_matrix(const BinaryMatrixReader& file) {
+    TRACE_ZONE("KeywordDistanceMatrix::load_matrix");
+    Pair size = file.get_size();
+    if (size.pred != W || size.dist != V || file.get_max_radius() != max_radius) {
+        throw std::runtime_error("Stored matrix is " + std::to_string(size.pred) + "x" + std::to_string(size.dist) + " with radius " +
+                                 std::to_string(file.get_max_radius()) + " but the matrix is " + std::to_string(W) + "x" + std::to_string(V) +
+                                 " with radius " + std::to_string(max_radius));
+    }
+
+    allocate_dense();
+    std::atomic<int> corrupt_row(-1);
+    #pragma omp parallel num_threads(get_num_threads())
+    {
+        std::vector<Pair> row;
 
-        for (int i = 6; i < 7; i++) {
-            glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[i]);
-            glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        #pragma omp for schedule(dynamic)
+        for (int w = 0; w < W; w++) {
+            try {
+                if (is_sparse()) {
+                    file.decode_row(w, sparse_rows[w]);
+                } else {
+                    file.decode_row(w, row);
+                    std::copy(row.begin(), row.end(), matrix[w]);
+                }
+            } catch (const std::exception&) {
+                corrupt_row = w;
+            }
         }
-        
-        tracker.increment_and_print();
     }
 
-    glDeleteBuffers(8, ssbos);
-    glDeleteProgram(computeProgram);
+    if (corrupt_row >= 0) {
+        throw std::runtime_error("Corrupt row " + std::to_string(corrupt_row.load()) + " in stored matrix");
+    }
+}
 
+std::ostream& operator<<(std::ostream& os, const ApproximationReport& report) {
+    os << "Approximation with " << report.n_landmarks << " landmarks: "
+       << report.finite_cells << " finite cells, "
+       << report.exact_cells << " proven exact, "
+       << report.unresolved_cells << " unresolved, "
+       << "mean bound gap " << report.mean_relative_gap * 100 << "%, "
+       << "max bound gap " << report.max_relative_gap * 100 << "%";
+    if (report.compared_cells) {
+        os << ", mean error " << report.mean_relative_error * 100 << "%"
+           << ", max error " << report.max_relative_error * 100 << "%"
+           << ", " << report.missed_cells << " missed";
+    }
+    return os;
 }
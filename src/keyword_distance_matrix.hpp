@@ -1,46 +1,116 @@
 #ifndef EVA_KEYWORD_DISTANCE_MATRIX
 #define EVA_KEYWORD_DISTANCE_MATRIX
 
+#include <vector>
 #include "graph.hpp"
-#include "shader_util.hpp"
+#include "csr_graph.hpp"
+#include "ordered_row_queue.hpp"
+
+class GraphCondensation;
+class BinaryMatrixReader;
+class MatrixCheckpoint;
 
 /*! This class is used to generate a WxV matrix where each cell represents the distance
    between a vertex v_i and a keyword w_j, stored as a pair (v_j, Dist(v_i, v_j)) where
-   v_j is the predecessor of the closest vertex containing keyword w_j 
+   v_j is the predecessor of the closest vertex containing keyword w_j
 */
 
+const int BIG_NUMBER = 0x7FFFFFFF;  //!< Distance stored for unreachable cells
+
 struct alignas(16) Pair {
     int pred;             //!< ID of predecessor vertex
     int dist;             //!< Distance to closest vertex
 };
 
+//! A single cell of a distance-bounded (sparse) matrix row
+struct SparseEntry {
+    int vert;             //!< ID of vertex
+    int dist;             //!< Distance to closest vertex containing the keyword
+    int pred;             //!< ID of predecessor vertex
+};
+
+/*! Quality of a matrix computed by calculate_matrix_approx(). Every approximate cell is an upper bound
+ * on the true distance, and the landmarks also give a lower bound, so the gap between the two bounds the
+ * error of each cell without knowing the exact answer. The *_error fields are only filled in by
+ * validate_approximation(), which compares against an exact matrix.
+ */
+struct ApproximationReport {
+    int    n_landmarks = 0;
+    long   finite_cells = 0;            //!< Cells with a finite upper bound
+    long   exact_cells = 0;             //!< Cells whose lower and upper bounds agree
+    long   unresolved_cells = 0;        //!< Cells reported unreachable without a proof that they are
+    double mean_relative_gap = 0;       //!< Mean of (upper - lower) / upper over finite cells, unresolved cells count as 1
+    double max_relative_gap = 0;        //!< 1 when any cell is unresolved
+    long   compared_cells = 0;
+    double mean_relative_error = 0;     //!< Mean of (approx - exact) / exact over cells reachable in both
+    double max_relative_error = 0;
+    long   missed_cells = 0;            //!< Cells that are reachable but were reported unreachable
+};
+
+std::ostream& operator<<(std::ostream& os, const ApproximationReport& report);
+
+//! A finished row on its way to a streaming writer, only the member matching the matrix mode is filled
+struct MatrixRow {
+    std::vector<Pair>        dense;
+    std::vector<SparseEntry> sparse;
+};
+
 class KeywordDistanceMatrix {
 public:
-    KeywordDistanceMatrix(int W, int V, int max_weight); 
+    KeywordDistanceMatrix(int W, int V, int max_weight, int max_radius = 0); //!< max_radius > 0 selects sparse mode
     ~KeywordDistanceMatrix();
 
-    Pair& operator()(int w, int v) const; 
+    Pair operator()(int w, int v) const;
     void calculate_matrix_cpu(SparseGraph<int>* graph);
-    void calculate_matrix_gpu(SparseGraph<int>* graph);
+    void calculate_matrix_cpu(const CSRView<int>& graph);
+    void calculate_matrix_cpu(SparseGraph<int>* graph, OrderedRowQueue<MatrixRow>& rows); //!< Pushes every row to rows instead of storing the matrix
+    void calculate_matrix_cpu(const CSRView<int>& graph, OrderedRowQueue<MatrixRow>& rows);
+    void calculate_matrix_cpu(const CSRView<int>& graph, OrderedRowQueue<MatrixRow>& rows, int first_keyword, int last_keyword); //!< Only rows [first_keyword, last_keyword), pushed as w - first_keyword
+    void calculate_matrix_gpu(SparseGraph<int>* graph); //!< Needs a GL context, defined in keyword_distance_matrix_gpu.cpp which only the GUI links
+    ApproximationReport calculate_matrix_approx(SparseGraph<int>* graph, int n_landmarks); //!< More landmarks are slower but tighter
+    ApproximationReport calculate_matrix_approx(const CSRGraph<int>& graph, int n_landmarks);
+    ApproximationReport validate_approximation(const KeywordDistanceMatrix& exact) const;   //!< Measures the real error of an approximate matrix
+    void load_matrix(const BinaryMatrixReader& file);                                       //!< Fills the matrix from a stored one of the same shape
 
     Pair get_size() const;
+    uint64_t memory_bytes() const;  //!< Heap bytes held by the stored rows, see heap_model.hpp
 
-    void set_batch_cutoff(int i)      { dynamicBatchSizeCutoff = i; }; //!< Set optimization option 
+    bool is_sparse() const                                  { return max_radius > 0;  }
+    int  get_max_radius() const                             { return max_radius;      }
+    const std::vector<SparseEntry>& sparse_row(int w) const { return sparse_rows[w];  } //!< Cells of row w within the radius, sorted by vertex
+    const Pair* dense_row(int w) const                      { return matrix[w];       } //!< Row w of a dense matrix
+
+    void set_batch_cutoff(int i)      { dynamicBatchSizeCutoff = i; }; //!< Set optimization option
     void set_vertex_chunk_size(int i) { vertexChunkSize = i;        }; //!< Set optimization option
     void set_min_batch_size(int i)    { minBatchSize = i;           }; //!< Set optimization option
+    void set_approx_search_budget(int i) { approxSearchBudget = i;  }; //!< Vertices calculate_matrix_approx() settles exactly per keyword, 0 uses the landmarks only
+    void set_checkpoint(MatrixCheckpoint* c) { checkpoint = c;      }; //!< calculate_matrix_cpu() saves rows to c and skips the ones it already has, nullptr disables
 
 
 private:
-    Pair** matrix;      //!< WxV matrix
+    struct Workspace;
+
+    void allocate_dense();
+    void check_shape(const CSRView<int>& graph) const; //!< Throws if graph does not match W and V
+    void calculate_rows_cpu(const CSRView<int>& graph, const GraphCondensation* condensation, OrderedRowQueue<MatrixRow>* rows, int first, int last);
+    void compute_dense_row(const CSRView<int>& graph, const GraphCondensation& condensation, int w, Pair* row, Workspace& ws) const;
+    void compute_sparse_row(const CSRView<int>& graph, int w, std::vector<SparseEntry>& row, Workspace& ws) const;
+
+    Pair** matrix;      //!< WxV matrix, allocated on first use and unused in sparse mode
+    std::vector<std::vector<SparseEntry>> sparse_rows; //!< W rows of cells with dist <= max_radius
     int W;              //!< Number of keywords
     int V;              //!< Number of vertices
     int MAX_WEIGHT;
+    int max_radius;     //!< Largest distance stored in sparse mode, 0 for a dense matrix
+    ApproximationReport approximation;  //!< Report of the last calculate_matrix_approx() call
+    MatrixCheckpoint* checkpoint = nullptr;    //!< Not owned
 
     // Optimization options
     int dynamicBatchSize;               //!< Number of keywords to process at once
     int dynamicBatchSizeCutoff = 1000;  //!< if V > dynamicBatchSizeCutoff then batchSize = minBatchSize
     int vertexChunkSize = 50000;        //!< Maximum number of vertices to process at once
     int minBatchSize = 1;               //!< Minimum keywords to process at once
+    int approxSearchBudget = 4096;      //!< Vertices settled by the bounded search around each keyword's holders
 };
 
-#endif 
+#endif
@@ -0,0 +1,215 @@
+#include "keyword_distance_matrix.hpp"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include "shader_util.hpp"
+#include "percent_tracker.hpp"
+#include "graph_condensation.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+// The compute-shader engine. It needs a current GL context, so it lives apart from the rest of the matrix
+// code and is only built into the graphical executable
+
+const int BATCH_SIZE = 50; // keywords to process per batch
+const int LOCAL_SIZE = 1024; // threads per work group
+
+void setUniforms(GLuint computeProgram, int V, int E, int W) {
+    glUseProgram(computeProgram);
+
+    auto setUniformChecked = [&](const char* name, GLuint value) {
+        GLint loc = glGetUniformLocation(computeProgram, name);
+        if (loc != -1) {
+            glUniform1ui(loc, value);
+            std::cout << "Set uniform " << name << " = " << value << std::endl;
+        } else {
+            std::cerr << "Warning: Uniform " << name << " not found (may be optimized out)" << std::endl;
+        }
+    };
+
+    setUniformChecked("V", V);
+    setUniformChecked("E", E);
+    setUniformChecked("W", W);
+}
+
+void KeywordDistanceMatrix::calculate_matrix_gpu(SparseGraph<int>* graph) {
+    TRACE_ZONE("calculate_matrix_gpu");
+    if (is_sparse()) {
+        std::cerr << "Sparse matrices are not supported by " << __func__ << ", using the CPU instead" << std::endl;
+        calculate_matrix_cpu(graph);
+        return;
+    }
+
+    allocate_dense();
+    GLuint computeProgram = createShaderProgram("keyword_matrix.comp");
+    if (computeProgram == 0) {
+        std::cerr << "Unable to compile shaders for " << __func__ << std::endl;
+        return;
+    }
+
+    GLint status;
+    glGetProgramiv(computeProgram, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        GLchar log[1024];
+        glGetProgramInfoLog(computeProgram, sizeof(log), nullptr, log);
+        std::cerr << "Program link failed:\n" << log << std::endl;
+        return;
+    }
+
+    CSRGraph<int> csr(*graph, W);
+    if (csr.n_edges() == 0) {
+        std::cerr << "No edges found for " << __func__ << std::endl;
+        return;
+    }
+
+    GraphCondensation condensation(csr);
+    std::vector<VerboseEdge<int>> edges;
+    std::vector<char> reachable;
+
+    // Create and bind buffers
+    GLuint ssbos[8]; // EdgeList, HasKeyword, Dist0, Dist1, Pred0, Pred1, OutputDist, OutputPred
+    glGenBuffers(8, ssbos);
+
+    dynamicBatchSize = (V > dynamicBatchSizeCutoff) ? minBatchSize : BATCH_SIZE;
+
+    ProgressTracker tracker("calculate_matrix_gpu", "All keywords processed.", (W + dynamicBatchSize - 1) / dynamicBatchSize);
+    static Counter& edges_uploaded = Metrics::global().counter("gpu_edges_uploaded");
+    tracker.begin();
+
+    // Process in batches
+    for (int batchStart = 0; batchStart < W; batchStart += dynamicBatchSize) {
+        const int batchSize = std::min(dynamicBatchSize, W - batchStart);
+        TRACE_ZONE("gpu_batch");
+
+        // Only edges leaving a component reachable from one of the batch's holders can change a distance,
+        // so the shader is handed that subset. Holder lists of consecutive keywords are contiguous in the CSR
+        const int* batchHolders = csr.keyword_vertices.data() + csr.holders_begin(batchStart);
+        int nBatchHolders = csr.holders_end(batchStart + batchSize - 1) - csr.holders_begin(batchStart);
+        condensation.mark_reachable(batchHolders, nBatchHolders, reachable);
+
+        edges.clear();
+        for (int v = 0; v < V; v++) {
+            if (!reachable[condensation.component[v]]) continue;
+            for (int e = csr.edges_begin(v); e < csr.edges_end(v); e++) {
+                edges.push_back({v, csr.targets[e], csr.weights[e]});
+            }
+        }
+        int E = edges.size();
+        edges_uploaded.add(E);
+
+        // Nothing to relax: every cell is unreachable apart from the holders themselves
+        if (E == 0) {
+            for (int b = 0; b < batchSize; b++) {
+                int w = batchStart + b;
+                std::fill_n(matrix[w], V, Pair{-1, BIG_NUMBER});
+                for (int i = csr.holders_begin(w); i < csr.holders_end(w); i++) {
+                    int v = csr.keyword_vertices[i];
+                    matrix[w][v] = {v, 0};
+                }
+            }
+
+            tracker.increment();
+            continue;
+        }
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[0]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, edges.size() * sizeof(VerboseEdge<int>), edges.data(), GL_DYNAMIC_DRAW);
+
+        // Buffer 1: HasKeyword (batchSize × V)
+        std::vector<uint32_t> hasKeywordData(batchSize * V, 0);
+        for (int b = 0; b < batchSize; b++) {
+            int w = batchStart + b;
+            for (int i = csr.holders_begin(w); i < csr.holders_end(w); i++) {
+                hasKeywordData[b * V + csr.keyword_vertices[i]] = 1;
+            }
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[1]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, 
+                    hasKeywordData.size() * sizeof(uint32_t),
+                    hasKeywordData.data(), GL_DYNAMIC_DRAW);
+
+        const GLsizeiptr batchMatrixSize = batchSize * V * sizeof(uint32_t);
+        std::vector<uint32_t> initDist(batchSize * V, 0x7FFFFFFF);
+        std::vector<int> initPred(batchSize * V, -1);
+        
+        // Output pred buffers
+        for (int i = 2; i <= 3; i++) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, batchMatrixSize, 
+                        initDist.data(), GL_DYNAMIC_DRAW);
+        }
+
+        // Input pred buffers
+        for (int i = 4; i <= 5; i++) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, batchMatrixSize, 
+                        initPred.data(), GL_DYNAMIC_DRAW);
+        }
+        
+        // Output dist buffers
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[6]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, batchMatrixSize, 
+                    initDist.data(), GL_DYNAMIC_COPY);
+        
+        // Output pred buffers
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[7]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, batchSize * V * sizeof(int), 
+                    initPred.data(), GL_DYNAMIC_COPY);
+
+        // Bind all buffers
+        for (int i = 0; i < 8; i++) {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, ssbos[i]);
+        }
+
+        // Set uniforms
+        glUseProgram(computeProgram);
+        glUniform1ui(glGetUniformLocation(computeProgram, "V"), V);
+        glUniform1ui(glGetUniformLocation(computeProgram, "E"), E);
+        glUniform1ui(glGetUniformLocation(computeProgram, "W"), batchSize);
+
+        // Dispatch compute shader
+        GLuint workGroupsX = (batchSize * V + LOCAL_SIZE - 1) / LOCAL_SIZE;
+        glDispatchCompute(workGroupsX, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glFinish();
+
+        // Read results for this batch
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[6]);
+        uint32_t* distData = (uint32_t*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
+       
+        if (!distData) {
+            std::cerr << "ERROR: Failed to map distance buffer in " << __func__ << std::endl;
+            glDeleteBuffers(8, ssbos);
+            glDeleteProgram(computeProgram);
+            return;
+        }
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[7]);
+        int* predData = (int*)glMapBuffer(GL_SHADER_STORAGE_BUFFER, GL_READ_ONLY);
+
+        if (!predData) {
+            std::cerr << "ERROR: Failed to map pred buffer in " << __func__ << std::endl;
+            glDeleteBuffers(8, ssbos);
+            glDeleteProgram(computeProgram);
+            return;
+        }
+
+        for (int b = 0; b < batchSize; b++) {
+            int w = batchStart + b;
+            for (int v = 0; v < V; v++) {
+                matrix[w][v] = {predData[b * V + v], (int)distData[b * V + v]};
+            }
+        }
+
+        for (int i = 6; i < 7; i++) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbos[i]);
+            glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        }
+        
+        tracker.increment();
+    }
+
+    glDeleteBuffers(8, ssbos);
+    glDeleteProgram(computeProgram);
+    tracker.finish();
+}
@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <queue>
+#include <stdexcept>
+#include <immintrin.h>
+#include <omp.h>
+#include "keyword_search.hpp"
+#include "thread_config.hpp"
+
+// Costs saturate at BIG_NUMBER, so one unreachable keyword keeps a root unreachable. Distances are below
+// 2^31, so two of them never wrap a uint32 before the saturating min
+const uint32_t UNREACHABLE = BIG_NUMBER;
+
+typedef std::pair<uint32_t, int> Candidate; // (cost, root), ordered so that ties go to the lower vertex id
+
+KeywordSearchEngine::KeywordSearchEngine(const KeywordDistanceMatrix& mat) : matrix(&mat) {
+    Pair size = mat.get_size();
+    W = size.pred;
+    V = size.dist;
+    sparse = mat.is_sparse();
+    dist_stride = sizeof(Pair) / sizeof(int);
+    build_index();
+}
+
+KeywordSearchEngine::KeywordSearchEngine(const BinaryMatrixReader& reader) : file(&reader) {
+    if (reader.is_compressed()) {
+        throw std::runtime_error("Keyword search needs an uncompressed matrix file, write it with --format bin");
+    }
+    Pair size = reader.get_size();
+    W = size.pred;
+    V = size.dist;
+    sparse = reader.is_sparse();
+    dist_stride = 1;
+    build_index();
+}
+
+const int* KeywordSearchEngine::dense_dist(int w) const {
+    if (file) return file->dist_row(w);
+    return &matrix->dense_row(w)->dist;
+}
+
+const SparseEntry* KeywordSearchEngine::sparse_cells(int w, size_t& n) const {
+    if (file) {
+        n = file->sparse_row_size(w);
+        return file->sparse_row(w);
+    }
+    n = matrix->sparse_row(w).size();
+    return matrix->sparse_row(w).data();
+}
+
+uint32_t KeywordSearchEngine::distance(int w, int v) const {
+    if (!sparse) return dense_dist(w)[(size_t)v * dist_stride];
+
+    size_t n;
+    const SparseEntry* cells = sparse_cells(w, n);
+    const SparseEntry* it = std::lower_bound(cells, cells + n, v, [](const SparseEntry& e, int vert) { return e.vert < vert; });
+    return it != cells + n && it->vert == v ? it->dist : UNREACHABLE;
+}
+
+void KeywordSearchEngine::build_index() {
+    sorted_offsets.assign(W + 1, 0);
+
+    #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic)
+    for (int w = 0; w < W; w++) {
+        size_t reachable = 0;
+        if (sparse) {
+            sparse_cells(w, reachable);
+        } else {
+            const int* d = dense_dist(w);
+            for (int v = 0; v < V; v++) reachable += d[(size_t)v * dist_stride] != BIG_NUMBER;
+        }
+        sorted_offsets[w + 1] = reachable;
+    }
+
+    for (int w = 0; w < W; w++) {
+        sorted_offsets[w + 1] += sorted_offsets[w];
+    }
+    sorted.resize(sorted_offsets[W]);
+
+    #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic)
+    for (int w = 0; w < W; w++) {
+        int* out = sorted.data() + sorted_offsets[w];
+        size_t n = 0;
+        if (sparse) {
+            const SparseEntry* cells = sparse_cells(w, n);
+            thread_local std::vector<std::pair<int, int>> keyed;
+            keyed.resize(n);
+            for (size_t i = 0; i < n; i++) keyed[i] = {cells[i].dist, cells[i].vert};
+            std::sort(keyed.begin(), keyed.end());
+            for (size_t i = 0; i < n; i++) out[i] = keyed[i].second;
+        } else {
+            const int* d = dense_dist(w);
+            const int stride = dist_stride;
+            for (int v = 0; v < V; v++) {
+                if (d[(size_t)v * stride] != BIG_NUMBER) out[n++] = v;
+            }
+            std::sort(out, out + n, [d, stride](int a, int b) {
+                int da = d[(size_t)a * stride], db = d[(size_t)b * stride];
+                return da != db ? da < db : a < b;
+            });
+        }
+    }
+}
+
+void KeywordSearchEngine::check_keywords(const std::vector<int>& keywords) const {
+    for (int w : keywords) {
+        if (w < 0 || w >= W) throw std::runtime_error("Keyword " + std::to_string(w) + " is out of range");
+    }
+}
+
+// Follows pred from the root back to a holder of each keyword and merges the chains into one edge set
+void KeywordSearchEngine::build_tree(SearchResult& result, const std::vector<int>& keywords) const {
+    for (int w : keywords) {
+        int v = result.root;
+        for (int steps = 0; steps < V; steps++) {
+            Pair p = cell(w, v);
+            if (p.pred < 0 || p.pred == v) break;
+            int pred_dist = cell(w, p.pred).dist;
+            result.tree.push_back({p.pred, v, p.dist - pred_dist});
+            v = p.pred;
+        }
+    }
+
+    auto key = [](const VerboseEdge<int>& e) { return std::make_pair(e.start, e.end); };
+    std::sort(result.tree.begin(), result.tree.end(), [&](const VerboseEdge<int>& a, const VerboseEdge<int>& b) { return key(a) < key(b); });
+    result.tree.erase(std::unique(result.tree.begin(), result.tree.end(), [&](const VerboseEdge<int>& a, const VerboseEdge<int>& b) { return key(a) == key(b); }), result.tree.end());
+}
+
+static void keep_best(std::priority_queue<Candidate>& best, Candidate c, int k) {
+    if ((int)best.size() < k) {
+        best.push(c);
+    } else if (c < best.top()) {
+        best.pop();
+        best.push(c);
+    }
+}
+
+static std::vector<SearchResult> drain(std::priority_queue<Candidate>& best) {
+    std::vector<SearchResult> results(best.size());
+    for (size_t i = results.size(); i-- > 0;) {
+        results[i].root = best.top().second;
+        results[i].cost = best.top().first;
+        best.pop();
+    }
+    return results;
+}
+
+// Fagin's threshold algorithm: walk every keyword's sorted row in lockstep, fully score each newly seen
+// vertex by random access, and stop once the k-th best cost beats the sum of the distances at the current
+// depth, which no unseen vertex can undercut. A vertex missing from any row is unreachable for that
+// keyword, so once the shortest row is exhausted every candidate has been seen
+std::vector<SearchResult> KeywordSearchEngine::query(const std::vector<int>& keywords, int k) const {
+    std::vector<SearchResult> results;
+    if (keywords.empty() || k <= 0) return results;
+    check_keywords(keywords);
+
+    thread_local std::vector<char> seen;
+    thread_local std::vector<int> touched;
+    if ((int)seen.size() != V) seen.assign(V, 0);
+
+    std::priority_queue<Candidate> best;
+    const size_t q = keywords.size();
+    for (size_t depth = 0;; depth++) {
+        uint64_t threshold = 0;
+        bool exhausted = false;
+
+        for (size_t i = 0; i < q; i++) {
+            int w = keywords[i];
+            size_t pos = sorted_offsets[w] + depth;
+            if (pos >= sorted_offsets[w + 1]) {
+                exhausted = true;
+                break;
+            }
+
+            int v = sorted[pos];
+            threshold += distance(w, v);
+            if (seen[v]) continue;
+            seen[v] = 1;
+            touched.push_back(v);
+
+            uint64_t cost = 0;
+            for (int other : keywords) {
+                cost += distance(other, v);
+                if (cost >= UNREACHABLE) break;
+            }
+            if (cost < UNREACHABLE) keep_best(best, {(uint32_t)cost, v}, k);
+        }
+
+        if (exhausted) break;
+        if ((int)best.size() == k && best.top().first < threshold) break;
+    }
+
+    for (int v : touched) seen[v] = 0;
+    touched.clear();
+
+    results = drain(best);
+    for (SearchResult& r : results) build_tree(r, keywords);
+    return results;
+}
+
+// Dense rows are summed eight lanes at a time with saturation, then scanned for the k smallest costs
+// skipping whole blocks that cannot beat the current k-th. Pair rows interleave pred and dist, so their
+// distances are gathered instead of loaded. Sparse rows are intersected by walking the shortest one and
+// looking its vertices up in the others, which only ever move forward
+std::vector<SearchResult> KeywordSearchEngine::query_scan(const std::vector<int>& keywords, int k) const {
+    std::vector<SearchResult> results;
+    if (keywords.empty() || k <= 0) return results;
+    check_keywords(keywords);
+    std::priority_queue<Candidate> best;
+
+    if (sparse) {
+        thread_local std::vector<const SparseEntry*> begin, end;
+        begin.resize(keywords.size());
+        end.resize(keywords.size());
+        size_t shortest = 0;
+        for (size_t i = 0; i < keywords.size(); i++) {
+            size_t n;
+            begin[i] = sparse_cells(keywords[i], n);
+            end[i] = begin[i] + n;
+            if (n < (size_t)(end[shortest] - begin[shortest])) shortest = i;
+        }
+
+        for (const SparseEntry* e = begin[shortest]; e != end[shortest]; ++e) {
+            uint64_t cost = 0;
+            bool reachable = true;
+            for (size_t i = 0; i < keywords.size() && reachable; i++) {
+                begin[i] = std::lower_bound(begin[i], end[i], e->vert, [](const SparseEntry& c, int vert) { return c.vert < vert; });
+                reachable = begin[i] != end[i] && begin[i]->vert == e->vert;
+                if (reachable) cost += begin[i]->dist;
+            }
+            if (reachable && cost < UNREACHABLE) keep_best(best, {(uint32_t)cost, e->vert}, k);
+        }
+
+        results = drain(best);
+        for (SearchResult& r : results) build_tree(r, keywords);
+        return results;
+    }
+
+    thread_local std::vector<uint32_t> acc;
+    acc.resize(V);
+    const int blocks = V / 8 * 8;
+    const int stride = dist_stride;
+    const __m256i lanes = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+    const __m256i saturated = _mm256_set1_epi32(UNREACHABLE);
+    auto load = [&](const int* d, int v) {
+        if (stride == 1) return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(d + v));
+        return _mm256_i32gather_epi32(d + (size_t)v * stride, lanes, 4);
+    };
+
+    for (size_t i = 0; i < keywords.size(); i++) {
+        const int* d = dense_dist(keywords[i]);
+        for (int v = 0; v < blocks; v += 8) {
+            __m256i b = load(d, v);
+            __m256i sum = i == 0 ? b : _mm256_min_epu32(_mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc.data() + v)), b), saturated);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc.data() + v), sum);
+        }
+        for (int v = blocks; v < V; v++) {
+            uint32_t b = d[(size_t)v * stride];
+            acc[v] = i == 0 ? b : std::min<uint32_t>(acc[v] + b, UNREACHABLE);
+        }
+    }
+
+    uint32_t cutoff = UNREACHABLE; // Cost of the current k-th result
+    auto consider = [&](int v) {
+        if (acc[v] >= UNREACHABLE) return;
+        keep_best(best, {acc[v], v}, k);
+        if ((int)best.size() == k) cutoff = best.top().first;
+    };
+
+    // Costs stay below 2^31, so a signed compare is enough
+    for (int v = 0; v < blocks; v += 8) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc.data() + v));
+        int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a, _mm256_set1_epi32(cutoff)))) & 0xFF;
+        while (mask) {
+            int lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            consider(v + lane);
+        }
+    }
+    for (int v = blocks; v < V; v++) {
+        consider(v);
+    }
+
+    results = drain(best);
+    for (SearchResult& r : results) build_tree(r, keywords);
+    return results;
+}
+
+BatchStats KeywordSearchEngine::query_batch(const std::vector<std::vector<int>>& queries, int k, std::vector<std::vector<SearchResult>>& results, bool scan) const {
+    BatchStats stats;
+    results.assign(queries.size(), {});
+    for (const std::vector<int>& keywords : queries) check_keywords(keywords);
+
+    double latency_sum = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic) reduction(+:latency_sum)
+    for (size_t i = 0; i < queries.size(); i++) {
+        auto query_start = std::chrono::steady_clock::now();
+        results[i] = scan ? query_scan(queries[i], k) : query(queries[i], k);
+        latency_sum += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - query_start).count();
+    }
+
+    stats.queries = queries.size();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.queries_per_second = stats.seconds > 0 ? stats.queries / stats.seconds : 0;
+    stats.mean_latency_us = stats.queries ? latency_sum / stats.queries : 0;
+    return stats;
+}
+
+std::ostream& operator<<(std::ostream& os, const BatchStats& stats) {
+    os << stats.queries << " queries in " << stats.seconds << " s: " << (long)stats.queries_per_second
+       << " queries/s, mean latency " << stats.mean_latency_us << " us";
+    return os;
+}
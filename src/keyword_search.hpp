@@ -0,0 +1,63 @@
+#ifndef EVA_KEYWORD_SEARCH
+#define EVA_KEYWORD_SEARCH
+
+#include <vector>
+#include "graph.hpp"
+#include "keyword_distance_matrix.hpp"
+#include "binary_matrix.hpp"
+
+//! One answer to a keyword group query: a root vertex and the shortest-path tree connecting it to the keywords
+struct SearchResult {
+    int root;
+    long cost;                              //!< Sum over the query keywords of dist(w, root)
+    std::vector<VerboseEdge<int>> tree;     //!< Edges of the union of the pred chains, weight is the edge length
+};
+
+struct BatchStats {
+    long   queries = 0;
+    double seconds = 0;
+    double queries_per_second = 0;
+    double mean_latency_us = 0;
+};
+
+std::ostream& operator<<(std::ostream& os, const BatchStats& stats);
+
+/*! Answers group Steiner-style keyword queries over a computed matrix: given keywords w_1..w_q, find the
+ * k roots v minimizing sum_i dist(w_i, v) and rebuild their connecting trees by following Pair::pred back
+ * to a holder of each keyword. Distances are read in place from a KeywordDistanceMatrix or an uncompressed
+ * BinaryMatrixReader, which must outlive the engine. Dense rows are summed eight lanes at a time, sparse
+ * rows (max_radius > 0, cells beyond the radius count as unreachable) are intersected. The only index the
+ * engine keeps is each row's reachable vertices sorted by distance for threshold-algorithm early
+ * termination, one int per reachable cell.
+ */
+class KeywordSearchEngine {
+public:
+    KeywordSearchEngine(const KeywordDistanceMatrix& matrix);
+    KeywordSearchEngine(const BinaryMatrixReader& matrix);   //!< Throws for compressed files, which have no random access
+
+    std::vector<SearchResult> query(const std::vector<int>& keywords, int k) const;      //!< Threshold algorithm over the sorted rows
+    std::vector<SearchResult> query_scan(const std::vector<int>& keywords, int k) const; //!< SIMD sum of dense rows, intersection of sparse ones
+    BatchStats query_batch(const std::vector<std::vector<int>>& queries, int k, std::vector<std::vector<SearchResult>>& results, bool scan = false) const;
+
+    int n_keywords() const { return W; }
+
+private:
+    void            build_index();
+    void            check_keywords(const std::vector<int>& keywords) const;
+    void            build_tree(SearchResult& result, const std::vector<int>& keywords) const;
+    Pair            cell(int w, int v) const    { return matrix ? (*matrix)(w, v) : (*file)(w, v); }
+    uint32_t        distance(int w, int v) const;                   //!< BIG_NUMBER when unreachable or beyond the radius
+    const int*      dense_dist(int w) const;                        //!< dist of cell v is at [v * dist_stride]
+    const SparseEntry* sparse_cells(int w, size_t& n) const;
+
+    const KeywordDistanceMatrix* matrix = nullptr;
+    const BinaryMatrixReader*    file = nullptr;
+    bool   sparse;
+    int    dist_stride;                     //!< ints between two dense cells, 1 in files, 4 in Pair rows
+    int    W;
+    int    V;
+    std::vector<size_t> sorted_offsets;     //!< W + 1 entries into sorted
+    std::vector<int>    sorted;             //!< Reachable vertices of each row in increasing distance
+};
+
+#endif
@@ -5,12 +5,22 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <cstdlib>
+#include <algorithm>
+#include <memory>
 #include "graph.hpp"
 #include "graph_generator.hpp"
 #include "force_directed_layout.hpp"
 #include "renderer.hpp"
 #include "keyword_distance_matrix.hpp"
 #include "csv_writer.hpp"
+#include "binary_matrix.hpp"
+#include "matrix_pipeline.hpp"
+#include "graph_snapshot.hpp"
+#include "graph_loader.hpp"
+#include "sharded_writer.hpp"
+#include "graph_cache.hpp"
+#include "background_task.hpp"
+#include "metrics.hpp"
 
 #define GLEW_STATIC
 
@@ -21,6 +31,16 @@ ForceDirectedParams params;
 GPUGraph* gpuGraph;
 
 GraphParameters graph_p;
+RenderStyle renderStyle;
+unsigned graphSeed = 0;
+bool randomSeed = true; // Draw a new seed for every generated graph instead of using graphSeed
+bool graphCacheable = false; // The current graph came from the generator with graphSeed
+bool useCache = false;
+std::string cacheDirectory = "graph_cache";
+int cacheBudgetMB = 4096;
+std::string snapshotPath = "graph.snapshot";
+std::string edgeListPath = "edges.txt";
+std::string keywordListPath = "keywords.txt";
 
 int original_w = params.width;
 int original_h = params.height;
@@ -38,6 +58,13 @@ float ZOOM_SENSITIVITY = 0.1f;
 float simSpeed = 0.016f;
 bool renderGraph = true;
 bool gpuComputation = true;
+int approxLandmarks = 0; // 0 computes the exact matrix
+bool binaryOutput = false;
+bool compressOutput = false; // Varint rows, zstd on top when available
+bool streamOutput = false; // Write rows while they are computed instead of keeping the whole matrix
+std::string outputName = "keyword_distance_matrix";
+int outputShards = 1;
+BackgroundTask task; // Generation or matrix computation running behind the render loop
 
 void resetView() {
     view.x = -params.width/4;
@@ -45,35 +72,243 @@ void resetView() {
     view.zoom = 1.0;
 }
 
-void keyDistMatrix() {
-    KeywordDistanceMatrix mat(graph_p.n_keywords, graph_p.n_vertices, graph_p.max_weight); 
-    
-    if (gpuComputation) mat.calculate_matrix_gpu(graph);
-    else mat.calculate_matrix_cpu(graph);
+//! Settings of one matrix computation, copied so the menu can keep changing while it runs in the background
+struct MatrixJob {
+    std::shared_ptr<const CSRGraph<int>> graph;
+    GraphParameters   params;
+    unsigned          seed;
+    MatrixOptions     options;
+    bool              cached;
+    std::string       cacheDirectory;
+    uint64_t          cacheBytes;
+    bool              binary;
+    BinaryMatrixDtype dtype;
+    bool              stream;
+    std::string       name;
+    int               shards;
+};
+
+GraphCache openCache(const std::string& directory, uint64_t bytes) {
+    return GraphCache(directory, bytes);
+}
 
-    std::cout << "Finished calculating keyword-distance matrix" << std::endl;
+// A matrix that cannot be cached is still a valid result, so failures are only reported
+void cacheMatrix(const MatrixJob& job, const KeywordDistanceMatrix* mat, const std::string& filepath) {
+    try {
+        GraphCache cache = openCache(job.cacheDirectory, job.cacheBytes);
+        if (mat) cache.store_matrix(*mat, job.params, job.seed, job.options);
+        else cache.store_matrix_file(filepath, job.params, job.seed, job.options);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
 
-    CSVWriter writer;
-    writer.write("keyword_distance_matrix.csv", mat);
+// The job's matrix if the cache holds it, nullptr otherwise. A reader keeps its mapping even if the file is evicted
+std::unique_ptr<BinaryMatrixReader> findCachedMatrix(const MatrixJob& job) {
+    if (!job.cached) return nullptr;
+    try {
+        return openCache(job.cacheDirectory, job.cacheBytes).find_matrix(job.params, job.seed, job.options);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return nullptr;
+    }
 }
 
-void genGraph() {
-    GraphGenerator<int> gen(std::time(nullptr), 5, 5);
-    
+// Stores a freshly computed matrix in the cache and writes it, on the background task's thread
+void writeMatrix(const MatrixJob& job, const KeywordDistanceMatrix& mat, bool computed) {
+    std::string filepath = job.name + (job.binary ? ".bin" : ".csv");
+    TaskControl* control = TaskControl::current();
+    if (computed && job.cached) {
+        if (control) control->set_stage("Caching matrix");
+        cacheMatrix(job, &mat, "");
+    }
+
+    if (control) control->set_stage("Writing " + filepath);
+    if (job.shards > 1) {
+        ShardedMatrixWriter writer(".", job.name);
+        writer.set_shard_count(job.shards);
+        writer.set_binary(job.binary, job.dtype);
+        writer.write(mat);
+    } else if (job.binary) {
+        BinaryMatrixWriter writer(job.dtype);
+        writer.write(filepath, mat);
+    } else {
+        CSVWriter writer;
+        writer.write(filepath, mat);
+    }
+}
+
+// Runs on the background task's thread with the CPU engines, the GPU engine is handled by keyDistMatrix()
+void computeMatrix(const MatrixJob& job) {
+    const GraphParameters& p = job.params;
+    KeywordDistanceMatrix mat(p.n_keywords, p.n_vertices, p.max_weight);
+    std::string filepath = job.name + (job.binary ? ".bin" : ".csv");
+    std::unique_ptr<BinaryMatrixReader> stored = findCachedMatrix(job);
+
+    if (!stored && job.stream && job.options.engine == ENGINE_CPU) {
+        stream_matrix_cpu(mat, *job.graph, filepath, job.binary, job.dtype);
+        std::cout << "Finished calculating keyword-distance matrix" << std::endl;
+        if (job.cached && job.binary) cacheMatrix(job, nullptr, filepath);
+        return;
+    }
+
+    if (stored) {
+        mat.load_matrix(*stored);
+    } else {
+        if (job.options.engine == ENGINE_APPROX) std::cout << mat.calculate_matrix_approx(*job.graph, job.options.n_landmarks) << std::endl;
+        else mat.calculate_matrix_cpu(*job.graph);
+        std::cout << "Finished calculating keyword-distance matrix" << std::endl;
+    }
+    writeMatrix(job, mat, !stored);
+}
+
+void keyDistMatrix() {
+    if (!graph || task.busy()) return;
+
+    MatrixJob job;
+    job.params = graph_p;
+    job.seed = graphSeed;
+    job.options.engine = approxLandmarks > 0 ? ENGINE_APPROX : gpuComputation ? ENGINE_GPU : ENGINE_CPU;
+    job.options.n_landmarks = approxLandmarks;
+    job.cached = useCache && graphCacheable;
+    job.cacheDirectory = cacheDirectory;
+    job.cacheBytes = (uint64_t)std::max(cacheBudgetMB, 0) << 20;
+    job.binary = binaryOutput;
+    job.dtype = !compressOutput ? DTYPE_INT32 : BINARY_MATRIX_HAS_ZSTD ? DTYPE_VARINT_ZSTD : DTYPE_VARINT;
+    job.stream = streamOutput;
+    job.name = outputName;
+    job.shards = outputShards;
+
+    // Only the GPU engine itself needs the GL context of the main thread. The finished matrix, or the cached
+    // one, is handed to the background task, which stores and writes it behind the render loop
+    if (job.options.engine == ENGINE_GPU) {
+        std::shared_ptr<BinaryMatrixReader> stored = findCachedMatrix(job);
+        std::shared_ptr<KeywordDistanceMatrix> mat;
+        if (!stored) {
+            try {
+                mat = std::make_shared<KeywordDistanceMatrix>(graph_p.n_keywords, graph_p.n_vertices, graph_p.max_weight);
+                mat->calculate_matrix_gpu(graph);
+                std::cout << "Finished calculating keyword-distance matrix" << std::endl;
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return;
+            }
+        }
+
+        task.start("Keyword-distance matrix", [job, stored, mat](TaskControl&) -> BackgroundTask::Commit {
+            if (mat) {
+                writeMatrix(job, *mat, true);
+            } else {
+                const GraphParameters& p = job.params;
+                KeywordDistanceMatrix loaded(p.n_keywords, p.n_vertices, p.max_weight);
+                loaded.load_matrix(*stored);
+                writeMatrix(job, loaded, false);
+            }
+            return nullptr;
+        });
+        return;
+    }
+
+    // The worker gets its own flattened copy, so the displayed graph may be replaced while it runs
+    job.graph = std::make_shared<const CSRGraph<int>>(*graph, graph_p.n_keywords);
+    task.start("Keyword-distance matrix", [job](TaskControl&) -> BackgroundTask::Commit {
+        computeMatrix(job);
+        return nullptr;
+    });
+}
+
+// Swaps a finished graph in, on the main thread because the renderer owns GL buffers
+void showGraph(SparseGraph<int>* loaded) {
     if (graph) delete graph;
     if (gpuGraph) delete gpuGraph;
-    //layout.reset_positions();
-
-    graph = gen.generate(
-            graph_p.n_vertices,
-            graph_p.n_keywords,
-            graph_p.min_keywords,
-            graph_p.max_keywords,
-            graph_p.min_degree,
-            graph_p.max_degree,
-            graph_p.min_weight,
-            graph_p.max_weight);
-    gpuGraph = new GPUGraph(*graph, graph_p);
+    graph = loaded;
+    gpuGraph = new GPUGraph(*graph, renderStyle);
+}
+
+void genGraph() {
+    if (task.busy()) return;
+    if (randomSeed) graphSeed = std::time(nullptr);
+
+    GraphParameters p = graph_p;
+    unsigned seed = graphSeed;
+    bool cached = useCache;
+    std::string directory = cacheDirectory;
+    uint64_t bytes = (uint64_t)std::max(cacheBudgetMB, 0) << 20;
+
+    task.start("Generate graph", [=](TaskControl&) -> BackgroundTask::Commit {
+        SparseGraph<int>* loaded = nullptr;
+        if (cached) {
+            try {
+                std::unique_ptr<GraphSnapshotReader> stored = openCache(directory, bytes).find_graph(p, seed);
+                if (stored) loaded = stored->to_sparse_graph();
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+            }
+        }
+
+        if (!loaded) {
+            GraphGenerator<int> gen(seed, 5, 5);
+            loaded = gen.generate(p.n_vertices, p.n_keywords, p.min_keywords, p.max_keywords, p.min_degree, p.max_degree, p.min_weight, p.max_weight);
+
+            if (cached) {
+                try {
+                    openCache(directory, bytes).store_graph(CSRGraph<int>(*loaded, p.n_keywords), p, seed);
+                } catch (const std::exception& e) {
+                    std::cerr << e.what() << std::endl;
+                }
+            }
+        }
+
+        return [=] {
+            graph_p = p;
+            graphSeed = seed;
+            graphCacheable = true;
+            showGraph(loaded);
+        };
+    });
+}
+
+void saveSnapshot() {
+    if (!graph) return;
+
+    try {
+        GraphSnapshotWriter writer;
+        writer.write(snapshotPath, CSRGraph<int>(*graph, graph_p.n_keywords), graph_p, graphSeed);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+void loadSnapshot() {
+    try {
+        GraphSnapshotReader reader(snapshotPath);
+        SparseGraph<int>* loaded = reader.to_sparse_graph();
+
+        graph_p = reader.get_params();
+        graphSeed = reader.get_seed();
+        graphCacheable = false; // Snapshots may come from other generator versions
+        showGraph(loaded);
+        std::cout << "Loaded " << snapshotPath << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
+}
+
+void importGraph() {
+    try {
+        GraphLoader loader;
+        CSRGraph<int> csr = loader.load(edgeListPath, keywordListPath);
+        SparseGraph<int>* loaded = csr.to_sparse_graph();
+
+        graph_p.n_vertices = csr.n_vertices;
+        graph_p.n_keywords = csr.n_keywords;
+        graph_p.max_weight = loader.get_max_weight();
+        graphSeed = 0;
+        graphCacheable = false;
+        showGraph(loaded);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+    }
 }
 
 void reshape(int w, int h) {
@@ -126,10 +361,14 @@ void keyboard_input(GLFWwindow *win, int key, int scancode, int action, int mods
         resetView();
     }
 
-    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+    if (key == GLFW_KEY_P && action == GLFW_PRESS && graph) {
         std::cout << *graph << std::endl;
     }
 
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        task.cancel();
+    }
+
     if (key == GLFW_KEY_M && action == GLFW_PRESS) {
         keyDistMatrix(); 
     }
@@ -154,17 +393,44 @@ void showMenu(ImGuiIO& io) {
     ImGui::InputInt("Min Weight", &graph_p.min_weight);
     ImGui::InputInt("Max Weight", &graph_p.max_weight);
 
-    ImGui::ColorEdit3("Vertex Color", (float*)&graph_p.vertex_color);
-    ImGui::ColorEdit3("Edge Color", (float*)&graph_p.edge_color);
+    ImGui::ColorEdit3("Vertex Color", &renderStyle.vertex_color.x);
+    ImGui::ColorEdit3("Edge Color", &renderStyle.edge_color.x);
     ImGui::InputFloat("Simulation Speed", &simSpeed);
 
-    if (ImGui::Button("Generate Graph (G)")) genGraph();
-    if (ImGui::Button("Print Graph (P)")) std::cout << *graph << std::endl;
-    if (ImGui::Button("Calculate Keyword-Distance Matrix (M)")) keyDistMatrix(); 
+    ImGui::Checkbox("Random seed", &randomSeed);
+    ImGui::InputScalar("Seed", ImGuiDataType_U32, &graphSeed);
+    ImGui::Checkbox("Cache graphs and matrices", &useCache);
+    ImGui::InputText("Cache directory", &cacheDirectory);
+    ImGui::InputInt("Cache budget (MB, 0 = unbounded)", &cacheBudgetMB);
+
+    if (task.busy()) {
+        std::string stage = task.get_stage();
+        ImGui::ProgressBar(task.get_progress(), ImVec2(-1.0f, 0.0f), stage.c_str());
+        if (ImGui::Button("Cancel (C)")) task.cancel();
+    } else {
+        if (ImGui::Button("Generate Graph (G)")) genGraph();
+        if (ImGui::Button("Calculate Keyword-Distance Matrix (M)")) keyDistMatrix(); 
+    }
+    if (ImGui::Button("Print Graph (P)") && graph) std::cout << *graph << std::endl;
     if (ImGui::Button("Reset View (R)")) resetView();
 
+    ImGui::InputText("Snapshot file", &snapshotPath);
+    if (ImGui::Button("Save Graph Snapshot")) saveSnapshot();
+    ImGui::SameLine();
+    if (ImGui::Button("Load Graph Snapshot")) loadSnapshot();
+
+    ImGui::InputText("Edge list file", &edgeListPath);
+    ImGui::InputText("Keyword list file", &keywordListPath);
+    if (ImGui::Button("Import Graph")) importGraph();
+
     ImGui::Checkbox("Render Graph", &renderGraph);
     ImGui::Checkbox("Use GPU to compute keyword-distance matrices", &gpuComputation);
+    ImGui::InputInt("Approximation landmarks (0 = exact)", &approxLandmarks);
+    ImGui::Checkbox("Write matrix in binary format", &binaryOutput);
+    ImGui::Checkbox("Compress binary matrix", &compressOutput);
+    ImGui::Checkbox("Stream CPU matrix rows to disk", &streamOutput);
+    ImGui::InputText("Matrix output name", &outputName);
+    ImGui::InputInt("Matrix output shards", &outputShards);
 
     ImGui::TextWrapped("Use WASD to pan view, Page Up/Down to zoom");
 
@@ -187,9 +453,15 @@ void display() {
     if (params.width != io.DisplaySize.x || params.height != io.DisplaySize.y)
         reshape(io.DisplaySize.x, io.DisplaySize.y);
 
+    try {
+        if (task.poll()) std::cout << task.get_name() << " done" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << task.get_name() << " failed: " << e.what() << std::endl;
+    }
+
     showMenu(io);
 
-    if (renderGraph) {
+    if (renderGraph && gpuGraph) {
 
         gpuGraph->simulate(simSpeed);
         glm::mat4 proj = glm::ortho((d_w + view.x) / view.zoom, ((float)params.width + view.x) / view.zoom, (d_h + view.y) / view.zoom, ((float)params.height + view.y) / view.zoom);
@@ -286,6 +558,10 @@ int main(int argc, char** argv) {
 
     }
 
+    // Console progress of the background tasks, the window shows the same in its progress bar
+    MetricsReporter reporter(std::cout);
+    reporter.start();
+
     genGraph();
 
     glfwSwapInterval(1);
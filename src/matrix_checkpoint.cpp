@@ -0,0 +1,274 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "matrix_checkpoint.hpp"
+#include "hash_util.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+static std::string failure(const std::string& what, const std::string& filepath) {
+    return what + " " + filepath + ": " + std::strerror(errno);
+}
+
+static void pwrite_all(int fd, const void* buffer, size_t n, off_t offset, const std::string& filepath) {
+    static Counter& bytes_written = Metrics::global().counter("bytes_written");
+    bytes_written.add(n);
+    const char* bytes = static_cast<const char*>(buffer);
+    while (n > 0) {
+        ssize_t written = pwrite(fd, bytes, n, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(failure("Unable to write to file", filepath));
+        }
+        bytes += written;
+        offset += written;
+        n -= written;
+    }
+}
+
+// Returns false at the end of the file
+static bool pread_all(int fd, void* buffer, size_t n, off_t offset) {
+    char* bytes = static_cast<char*>(buffer);
+    while (n > 0) {
+        ssize_t got = pread(fd, bytes, n, offset);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        bytes += got;
+        offset += got;
+        n -= got;
+    }
+    return true;
+}
+
+uint64_t graph_fingerprint(const CSRGraph<int>& graph) {
+    const std::vector<int>* arrays[5] = {&graph.offsets, &graph.targets, &graph.weights, &graph.keyword_offsets, &graph.keyword_vertices};
+    uint64_t hashes[7] = {(uint64_t)graph.n_vertices, (uint64_t)graph.n_keywords};
+    for (int i = 0; i < 5; i++) {
+        hashes[i + 2] = hash_block(arrays[i]->data(), arrays[i]->size() * sizeof(int));
+    }
+    return fnv1a64(hashes, sizeof(hashes));
+}
+
+MatrixCheckpoint::MatrixCheckpoint(std::string path, const CSRGraph<int>& graph, int max_radius, uint64_t seed, bool resume) {
+    filepath = path;
+    rows_path = path + ".rows";
+    rows_fd = -1;
+    last_commit = steady_seconds();
+    resumed_at.assign(graph.n_keywords, NO_ROW);
+    bitmap.assign((graph.n_keywords + 7) / 8, 0);
+
+    header = {};
+    std::memcpy(header.magic, MATRIX_CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = MATRIX_CHECKPOINT_VERSION;
+    header.max_radius = max_radius > 0 ? max_radius : 0;
+    header.W = graph.n_keywords;
+    header.V = graph.n_vertices;
+    header.fingerprint = graph_fingerprint(graph);
+    header.seed = seed;
+
+    MatrixCheckpointHeader stored;
+    if (resume && read_header(filepath, stored)) {
+        load(graph, stored, max_radius);
+        return;
+    }
+
+    rows_fd = open(rows_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (rows_fd < 0) {
+        throw std::runtime_error("Unable to create file " + rows_path);
+    }
+    commit(); // An empty checkpoint already records the seed
+}
+
+MatrixCheckpoint::~MatrixCheckpoint() {
+    if (rows_fd >= 0) close(rows_fd);
+}
+
+bool MatrixCheckpoint::read_header(std::string path, MatrixCheckpointHeader& stored) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    bool ok = pread_all(fd, &stored, sizeof(stored), 0);
+    close(fd);
+
+    if (!ok || std::memcmp(stored.magic, MATRIX_CHECKPOINT_MAGIC, sizeof(stored.magic)) != 0) {
+        throw std::runtime_error("Not a matrix checkpoint: " + path);
+    }
+    if (stored.version != MATRIX_CHECKPOINT_VERSION) {
+        throw std::runtime_error("Unsupported matrix checkpoint version in " + path);
+    }
+    return true;
+}
+
+// Reads the bitmap, cuts the rows file back to what it covers and indexes the records in it
+void MatrixCheckpoint::load(const CSRGraph<int>& graph, const MatrixCheckpointHeader& stored, int max_radius) {
+    TRACE_ZONE("MatrixCheckpoint::load");
+    if (stored.W != header.W || stored.V != header.V || stored.max_radius != header.max_radius) {
+        throw std::runtime_error("Checkpoint " + filepath + " is for a " + std::to_string(stored.W) + "x" + std::to_string(stored.V) + " matrix with radius " +
+                                 std::to_string(stored.max_radius) + " but the matrix is " + std::to_string(graph.n_keywords) + "x" +
+                                 std::to_string(graph.n_vertices) + " with radius " + std::to_string(max_radius));
+    }
+    if (stored.fingerprint != header.fingerprint) {
+        throw std::runtime_error("Checkpoint " + filepath + " was made for a different graph (seed " + std::to_string(stored.seed) + ")");
+    }
+    header.seed = stored.seed;
+
+    int fd = open(filepath.c_str(), O_RDONLY);
+    bool ok = fd >= 0 && pread_all(fd, bitmap.data(), bitmap.size(), sizeof(stored));
+    if (fd >= 0) close(fd);
+    if (!ok || hash_block(bitmap.data(), bitmap.size()) != stored.checksum) {
+        throw std::runtime_error("Corrupt matrix checkpoint " + filepath);
+    }
+
+    rows_fd = open(rows_path.c_str(), O_RDWR);
+    if (rows_fd < 0) {
+        throw std::runtime_error("Unable to open file " + rows_path);
+    }
+    if (ftruncate(rows_fd, stored.rows_bytes) != 0) {
+        throw std::runtime_error(failure("Unable to truncate file", rows_path));
+    }
+
+    const size_t cell_bytes = header.max_radius > 0 ? sizeof(SparseEntry) : 2 * sizeof(int32_t);
+    uint64_t at = 0;
+    while (at < stored.rows_bytes) {
+        MatrixCheckpointRecord record;
+        if (!pread_all(rows_fd, &record, sizeof(record), at) || record.keyword < 0 || (uint32_t)record.keyword >= header.W ||
+            resumed_at[record.keyword] != NO_ROW || !(bitmap[record.keyword / 8] & (1 << record.keyword % 8))) {
+            throw std::runtime_error("Corrupt record at byte " + std::to_string(at) + " of " + rows_path);
+        }
+        resumed_at[record.keyword] = at;
+        resumed++;
+        at += sizeof(record) + record.cells * cell_bytes;
+    }
+    if (at != stored.rows_bytes || (uint64_t)resumed != stored.completed) {
+        throw std::runtime_error("Truncated matrix checkpoint " + rows_path);
+    }
+
+    rows_end = at;
+    completed = resumed;
+}
+
+void MatrixCheckpoint::read_cells(int w, void* cells, uint64_t n, size_t cell_bytes) const {
+    MatrixCheckpointRecord record;
+    uint64_t at = resumed_at[w];
+    if (!pread_all(rows_fd, &record, sizeof(record), at) || record.cells != n ||
+        !pread_all(rows_fd, cells, n * cell_bytes, at + sizeof(record)) || hash_block(cells, n * cell_bytes) != record.hash) {
+        throw std::runtime_error("Corrupt row " + std::to_string(w) + " in " + rows_path);
+    }
+}
+
+uint64_t MatrixCheckpoint::record_cells(int w) const {
+    MatrixCheckpointRecord record;
+    if (!pread_all(rows_fd, &record, sizeof(record), resumed_at[w])) {
+        throw std::runtime_error("Corrupt row " + std::to_string(w) + " in " + rows_path);
+    }
+    return record.cells;
+}
+
+void MatrixCheckpoint::read_row(int w, Pair* row) const {
+    thread_local std::vector<int32_t> cells;
+    const int V = header.V;
+    cells.resize(2 * V);
+    read_cells(w, cells.data(), V, 2 * sizeof(int32_t));
+    for (int v = 0; v < V; v++) {
+        row[v] = {cells[2 * v + 1], cells[2 * v]};
+    }
+}
+
+void MatrixCheckpoint::read_row(int w, std::vector<SparseEntry>& row) const {
+    row.resize(record_cells(w));
+    read_cells(w, row.data(), row.size(), sizeof(SparseEntry));
+}
+
+void MatrixCheckpoint::add_row(int w, const Pair* row) {
+    // Pair is padded to 16 bytes, the record keeps only the (dist, pred) values
+    thread_local std::vector<int32_t> cells;
+    const int V = header.V;
+    cells.resize(2 * V);
+    for (int v = 0; v < V; v++) {
+        cells[2 * v] = row[v].dist;
+        cells[2 * v + 1] = row[v].pred;
+    }
+    append(w, cells.data(), V, 2 * sizeof(int32_t));
+}
+
+void MatrixCheckpoint::add_row(int w, const std::vector<SparseEntry>& row) {
+    append(w, row.data(), row.size(), sizeof(SparseEntry));
+}
+
+void MatrixCheckpoint::append(int w, const void* cells, uint64_t n, size_t cell_bytes) {
+    MatrixCheckpointRecord record = {w, 0, n, hash_block(cells, n * cell_bytes)};
+
+    // Records are written while holding the lock, so everything below rows_end is on its way to the file
+    std::lock_guard<std::mutex> guard(append_lock);
+    pwrite_all(rows_fd, &record, sizeof(record), rows_end, rows_path);
+    pwrite_all(rows_fd, cells, n * cell_bytes, rows_end + sizeof(record), rows_path);
+    rows_end += sizeof(record) + n * cell_bytes;
+    bitmap[w / 8] |= 1 << w % 8;
+    completed++;
+}
+
+void MatrixCheckpoint::maybe_commit() {
+    if (steady_seconds() - last_commit.load(std::memory_order_relaxed) < interval) return;
+
+    std::unique_lock<std::mutex> committing(commit_lock, std::try_to_lock);
+    if (!committing.owns_lock()) return;
+    if (steady_seconds() - last_commit < interval) return; // Another thread just committed
+
+    committing.unlock();
+    commit();
+}
+
+// The bitmap is taken before the rows file is synced, so it never names a row that is not on disk yet. The
+// header and bitmap are written aside and renamed over the old ones, a crash leaves one or the other
+void MatrixCheckpoint::commit() {
+    TRACE_ZONE("MatrixCheckpoint::commit");
+    std::lock_guard<std::mutex> committing(commit_lock);
+
+    MatrixCheckpointHeader current = header;
+    std::vector<uint8_t> done;
+    {
+        std::lock_guard<std::mutex> guard(append_lock);
+        current.rows_bytes = rows_end;
+        current.completed = completed;
+        done = bitmap;
+    }
+    current.checksum = hash_block(done.data(), done.size());
+
+    if (fdatasync(rows_fd) != 0) {
+        throw std::runtime_error(failure("Unable to sync file", rows_path));
+    }
+
+    std::string temp = filepath + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to create file " + temp);
+    }
+    try {
+        pwrite_all(fd, &current, sizeof(current), 0, temp);
+        pwrite_all(fd, done.data(), done.size(), sizeof(current), temp);
+        if (fsync(fd) != 0) throw std::runtime_error(failure("Unable to sync file", temp));
+    } catch (...) {
+        close(fd);
+        std::remove(temp.c_str());
+        throw;
+    }
+    close(fd);
+
+    if (std::rename(temp.c_str(), filepath.c_str()) != 0) {
+        std::string reason = failure("Unable to replace file", filepath);
+        std::remove(temp.c_str());
+        throw std::runtime_error(reason);
+    }
+    last_commit = steady_seconds();
+}
+
+void MatrixCheckpoint::remove() {
+    std::lock_guard<std::mutex> committing(commit_lock);
+    if (rows_fd >= 0) close(rows_fd);
+    rows_fd = -1;
+    std::remove(filepath.c_str());
+    std::remove(rows_path.c_str());
+    std::remove((filepath + ".tmp").c_str()); // Left behind by a run killed while committing
+}
@@ -0,0 +1,101 @@
+#ifndef EVA_MATRIX_CHECKPOINT
+#define EVA_MATRIX_CHECKPOINT
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "csr_graph.hpp"
+#include "keyword_distance_matrix.hpp"
+
+/*! Periodic checkpoint of a calculate_matrix_cpu() run, so a run that is killed only loses the rows finished
+ * since the last checkpoint.
+ *
+ * Finished rows are appended to <file>.rows as they come in, each record a MatrixCheckpointRecord followed
+ * by the row: V (dist, pred) int32 pairs for a dense matrix or the SparseEntry cells of a sparse one. Every
+ * interval the rows file is synced and <file> is replaced (written aside and renamed) by a 64-byte
+ * MatrixCheckpointHeader and a bitmap of the finished keywords. The header records how many bytes of the
+ * rows file those keywords cover, so records appended after the last checkpoint are dropped on resume, and
+ * a fingerprint of the graph, so a checkpoint is never resumed against a different graph.
+ */
+
+const char     MATRIX_CHECKPOINT_MAGIC[8] = {'E', 'V', 'A', 'C', 'K', 'P', 'T', 0};
+const uint32_t MATRIX_CHECKPOINT_VERSION = 1;
+const double   MATRIX_CHECKPOINT_DEFAULT_INTERVAL = 300;   //!< Seconds between two checkpoints
+
+struct MatrixCheckpointHeader {
+    char     magic[8];
+    uint32_t version;
+    int32_t  max_radius;
+    uint32_t W;
+    uint32_t V;
+    uint64_t fingerprint;           //!< graph_fingerprint() of the graph the rows belong to
+    uint64_t seed;                  //!< Seed the graph was generated with, so a resumed run can regenerate it
+    uint64_t rows_bytes;            //!< Bytes of the rows file covered by the bitmap
+    uint64_t completed;             //!< Keywords set in the bitmap
+    uint64_t checksum;              //!< hash_block() of the bitmap
+};
+static_assert(sizeof(MatrixCheckpointHeader) == 64, "MatrixCheckpointHeader must stay 64 bytes");
+
+struct MatrixCheckpointRecord {
+    int32_t  keyword;
+    uint32_t reserved;
+    uint64_t cells;
+    uint64_t hash;                  //!< hash_block() of the cells
+};
+
+uint64_t graph_fingerprint(const CSRGraph<int>& graph);     //!< Hash of every CSR array
+
+/*! Hand one to KeywordDistanceMatrix::set_checkpoint(). Rows are added and read from the worker threads,
+ * every member is safe to call concurrently.
+ */
+class MatrixCheckpoint {
+public:
+    //! Starts a new checkpoint, or with resume continues the one in filepath if there is one. Throws if it belongs to another graph
+    MatrixCheckpoint(std::string filepath, const CSRGraph<int>& graph, int max_radius, uint64_t seed, bool resume);
+    ~MatrixCheckpoint();
+    MatrixCheckpoint(const MatrixCheckpoint&) = delete;
+    MatrixCheckpoint& operator=(const MatrixCheckpoint&) = delete;
+
+    static bool read_header(std::string filepath, MatrixCheckpointHeader& header); //!< false if there is no checkpoint in filepath
+
+    bool has_row(int w) const       { return resumed_at[w] != NO_ROW; } //!< Finished before this run started
+    int  resumed_rows() const       { return resumed; }
+    void read_row(int w, Pair* row) const;
+    void read_row(int w, std::vector<SparseEntry>& row) const;
+
+    void add_row(int w, const Pair* row);
+    void add_row(int w, const std::vector<SparseEntry>& row);
+    void maybe_commit();            //!< Commits if the interval has passed and no other thread is committing
+    void commit();                  //!< Makes every added row survive a crash
+    void remove();                  //!< Deletes the files once the matrix is safely written
+
+    void set_interval(double seconds) { interval = seconds; }
+
+private:
+    static constexpr uint64_t NO_ROW = ~0ULL;
+
+    void load(const CSRGraph<int>& graph, const MatrixCheckpointHeader& stored, int max_radius);
+    void append(int w, const void* cells, uint64_t n, size_t cell_bytes);
+    void read_cells(int w, void* cells, uint64_t n, size_t cell_bytes) const;
+    uint64_t record_cells(int w) const;        //!< Cell count of a resumed row
+
+    std::string           filepath;
+    std::string           rows_path;
+    int                   rows_fd;
+    MatrixCheckpointHeader header;
+    std::vector<uint64_t> resumed_at;   //!< Record offset of the rows finished by an earlier run, NO_ROW otherwise
+    int                   resumed = 0;
+
+    std::mutex            append_lock;  //!< Guards the end of the rows file and the bitmap
+    uint64_t              rows_end = 0;
+    uint64_t              completed = 0;
+    std::vector<uint8_t>  bitmap;
+
+    std::mutex            commit_lock;
+    std::atomic<double>   last_commit;
+    double                interval = MATRIX_CHECKPOINT_DEFAULT_INTERVAL;
+};
+
+#endif
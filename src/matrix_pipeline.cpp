@@ -0,0 +1,71 @@
+#include <cstdio>
+#include <exception>
+#include <thread>
+#include "matrix_pipeline.hpp"
+#include "ordered_row_queue.hpp"
+#include "csv_writer.hpp"
+#include "trace.hpp"
+
+void stream_matrix_cpu(KeywordDistanceMatrix& mat, SparseGraph<int>* graph, std::string filepath, bool binary, BinaryMatrixDtype dtype, int queue_rows) {
+    Pair p = mat.get_size();
+    stream_matrix_cpu(mat, CSRGraph<int>(*graph, p.pred), filepath, binary, dtype, queue_rows);
+}
+
+void stream_matrix_cpu(KeywordDistanceMatrix& mat, const CSRView<int>& graph, std::string filepath, bool binary, BinaryMatrixDtype dtype, int queue_rows) {
+    stream_matrix_range_cpu(mat, graph, 0, mat.get_size().pred, filepath, binary, dtype, queue_rows);
+}
+
+uint64_t stream_matrix_range_cpu(KeywordDistanceMatrix& mat, const CSRView<int>& graph, int first_keyword, int last_keyword, std::string filepath, bool binary,
+                                 BinaryMatrixDtype dtype, int queue_rows) {
+    int W = last_keyword - first_keyword;
+    int V = mat.get_size().dist;
+    uint64_t checksum = 0;
+
+    OrderedRowQueue<MatrixRow> rows(W, queue_rows);
+    std::exception_ptr failure;
+
+    // A failing writer closes the queue, which makes the workers skip the keywords that are left
+    std::thread writer([&] {
+        TRACE_ZONE("stream_writer");
+        try {
+            CSVWriter csv;
+            BinaryMatrixWriter bin(binary ? dtype : DTYPE_INT32);
+            if (binary) bin.begin_stream(filepath, W, V, mat.get_max_radius());
+            else csv.begin_stream(filepath, V);
+
+            MatrixRow row;
+            while (rows.pop(row)) {
+                if (mat.is_sparse()) {
+                    if (binary) bin.stream_row(row.sparse.data(), row.sparse.size());
+                    else csv.stream_row(row.sparse.data(), row.sparse.size());
+                } else {
+                    if (binary) bin.stream_row(row.dense.data());
+                    else csv.stream_row(row.dense.data());
+                }
+            }
+
+            // Interrupted by a failure or cancellation on the computing side, the file is removed below
+            if (rows.next_index() < W) return;
+
+            if (binary) bin.end_stream();
+            else csv.end_stream();
+            checksum = binary ? bin.stream_checksum() : csv.stream_checksum();
+        } catch (...) {
+            failure = std::current_exception();
+            rows.close();
+        }
+    });
+
+    try {
+        mat.calculate_matrix_cpu(graph, rows, first_keyword, last_keyword);
+    } catch (...) {
+        rows.close();
+        writer.join();
+        std::remove(filepath.c_str());
+        throw;
+    }
+
+    writer.join();
+    if (failure) std::rethrow_exception(failure);
+    return checksum;
+}
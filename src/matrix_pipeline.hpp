@@ -0,0 +1,23 @@
+#ifndef EVA_MATRIX_PIPELINE
+#define EVA_MATRIX_PIPELINE
+
+#include <string>
+#include "graph.hpp"
+#include "keyword_distance_matrix.hpp"
+#include "binary_matrix.hpp"
+
+const int PIPELINE_QUEUE_ROWS = 64; //!< Finished rows allowed to wait for the writer
+
+/*! Computes the matrix on the CPU and writes it to filepath while it is being computed. Worker threads
+ * push finished rows into an OrderedRowQueue and a writer thread drains it in keyword order, so the file
+ * is identical to the one written after a full calculate_matrix_cpu() but only about queue_rows rows are
+ * held in memory at once. The matrix itself is left empty. dtype selects the encoding of binary output.
+ */
+void stream_matrix_cpu(KeywordDistanceMatrix& mat, SparseGraph<int>* graph, std::string filepath, bool binary, BinaryMatrixDtype dtype = DTYPE_INT32, int queue_rows = PIPELINE_QUEUE_ROWS);
+void stream_matrix_cpu(KeywordDistanceMatrix& mat, const CSRView<int>& graph, std::string filepath, bool binary, BinaryMatrixDtype dtype = DTYPE_INT32, int queue_rows = PIPELINE_QUEUE_ROWS);
+
+//! Streams only rows [first_keyword, last_keyword), the file is a complete matrix of last_keyword - first_keyword rows. Returns its checksum
+uint64_t stream_matrix_range_cpu(KeywordDistanceMatrix& mat, const CSRView<int>& graph, int first_keyword, int last_keyword, std::string filepath, bool binary,
+                                 BinaryMatrixDtype dtype = DTYPE_INT32, int queue_rows = PIPELINE_QUEUE_ROWS);
+
+#endif
@@ -0,0 +1,135 @@
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "memory_budget.hpp"
+#include "graph.hpp"
+#include "graph_cache.hpp"
+#include "keyword_distance_matrix.hpp"
+#include "matrix_pipeline.hpp"
+
+const uint64_t WRITER_BATCH_BYTES = 64 << 20;      // BATCH_BYTES of the CSV and binary writers
+const uint64_t STREAM_BUFFER_ALLOWANCE = 4 << 20;  // Buffer of a streaming CSV writer
+const uint64_t MAX_CELL_TEXT = 3 * 11 + 3;         // Longest CSV cell
+
+static std::string megabytes(uint64_t bytes) {
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(1) << bytes / 1048576.0 << " MB";
+    return ss.str();
+}
+
+std::ostream& operator<<(std::ostream& os, const MemoryEstimate& e) {
+    os << "peak " << megabytes(e.peak) << " (graph " << megabytes(e.graph) << ", csr " << megabytes(e.csr)
+       << ", index " << megabytes(e.index) << ", matrix " << megabytes(e.matrix) << ", workspaces " << megabytes(e.workspaces)
+       << ", writer " << megabytes(e.writer) << ")" << (e.streamed ? " streamed" : "");
+    return os;
+}
+
+// Vertices a multi-source search from the holders of one keyword reaches within the radius. Each hop
+// costs at least min_weight, so no path within the radius has more than radius / min_weight edges
+static double sparse_row_cells(const GraphParameters& p, int radius, double holders, double degree) {
+    double hops = p.min_weight > 0 ? std::floor((double)radius / p.min_weight) : INFINITY;
+    double frontier = holders, reached = holders;
+    for (int h = 0; h < hops && reached < p.n_vertices; h++) {
+        frontier *= degree;
+        reached += frontier;
+    }
+    return std::min(reached, (double)p.n_vertices);
+}
+
+MemoryEstimate estimate_memory(const GraphParameters& p, const MatrixOptions& options, int threads, bool generate, bool stream, bool output) {
+    MemoryEstimate e;
+    const double V = p.n_vertices;
+    const double W = p.n_keywords;
+    const double degree = (p.min_degree + p.max_degree) / 2.0;
+    const double E = V * degree;
+    const double K = V * (p.min_keywords + p.max_keywords) / 2.0;
+    const bool sparse = options.max_radius > 0;
+    const bool approx = options.engine == ENGINE_APPROX;
+    threads = std::max(1, threads);
+
+    if (generate) {
+        // Per-vertex allocations, one tree node per edge and two per keyword, and the keyword queue they are built from
+        e.graph = V * (sizeof(Vertex<int>*) + heap_chunk_bytes(sizeof(Vertex<int>))) + E * multimap_node_bytes<int, Edge<int>>()
+                + K * (2 * multimap_node_bytes<int, int>() + sizeof(KeywordPair<int>));
+    }
+    e.csr = (V + 1 + W + 1 + K) * sizeof(int) + E * 2 * sizeof(int);
+
+    double row_cells = sparse ? sparse_row_cells(p, options.max_radius, std::max(1.0, K / W), degree) : V;
+    double row_bytes = sparse ? row_cells * sizeof(SparseEntry) : V * sizeof(Pair);
+
+    if (approx) {
+        e.index = 4.0 * options.n_landmarks * V * sizeof(int) + e.csr; // Four landmark tables and the reversed graph
+        e.workspaces = threads * (V * (3 * sizeof(int) + 1) + options.n_landmarks * sizeof(int));
+    } else {
+        if (!sparse) e.index = V * (4 * sizeof(int) + 1) + E * sizeof(int) + sizeof(int);
+        e.workspaces = threads * (V * (2 * sizeof(int) + 1) + row_cells * (sizeof(int) + 2 * sizeof(int)));
+    }
+
+    e.streamed = stream;
+    if (stream) {
+        // Rows in the queue, one being built by every thread and the writer's buffer
+        e.matrix = 0;
+        e.writer = (PIPELINE_QUEUE_ROWS + threads) * heap_chunk_bytes(row_bytes) + STREAM_BUFFER_ALLOWANCE;
+    } else {
+        e.matrix = W * (sizeof(void*) + heap_chunk_bytes(row_bytes));
+        double text = W * row_cells * MAX_CELL_TEXT;
+        if (output) e.writer = std::min<double>(WRITER_BATCH_BYTES, text) + threads * heap_chunk_bytes(row_bytes);
+    }
+
+    uint64_t building = e.graph + e.csr;                                        // SparseGraph converted into the CSR
+    uint64_t computing = e.csr + e.index + e.matrix + e.workspaces + (stream ? e.writer : 0);
+    uint64_t writing = e.csr + e.matrix + e.writer;
+    e.peak = std::max({building, computing, writing});
+    return e;
+}
+
+MemoryEstimate fit_memory_budget(const GraphParameters& p, const MatrixOptions& options, int threads, uint64_t budget, bool& stream, bool can_stream, bool generate, bool output) {
+    MemoryEstimate estimate = estimate_memory(p, options, threads, generate, stream, output);
+    if (budget == 0 || estimate.peak <= budget) return estimate;
+
+    std::string message = "The job needs about " + megabytes(estimate.peak) + " but the memory budget is " + megabytes(budget);
+    if (!stream && can_stream) {
+        MemoryEstimate streamed = estimate_memory(p, options, threads, generate, true);
+        if (streamed.peak <= budget) {
+            stream = true;
+            return streamed;
+        }
+        message += ", streaming the matrix would still need " + megabytes(streamed.peak);
+    }
+
+    std::ostringstream breakdown;
+    breakdown << estimate;
+    throw MemoryBudgetExceeded(message + ": " + breakdown.str());
+}
+
+uint64_t available_memory() {
+    std::ifstream meminfo("/proc/meminfo");
+    return available_memory(meminfo);
+}
+
+// One "Key: value [kB]" entry per line, some without a unit, so every line is parsed on its own
+uint64_t available_memory(std::istream& meminfo) {
+    std::string line;
+    while (std::getline(meminfo, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        uint64_t kilobytes;
+        if (fields >> key >> kilobytes && key == "MemAvailable:") return kilobytes * 1024;
+    }
+    return 0;
+}
+
+void MemoryGate::acquire(uint64_t bytes) {
+    std::unique_lock<std::mutex> guard(lock);
+    freed.wait(guard, [&] { return used == 0 || used + bytes <= budget; });
+    used += bytes;
+}
+
+void MemoryGate::release(uint64_t bytes) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        used -= bytes;
+    }
+    freed.notify_all();
+}
@@ -0,0 +1,82 @@
+#ifndef EVA_MEMORY_BUDGET
+#define EVA_MEMORY_BUDGET
+
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include "heap_model.hpp"
+
+struct GraphParameters;
+struct MatrixOptions;
+
+//! Predicted bytes of each part of a generate -> matrix -> write job
+struct MemoryEstimate {
+    uint64_t graph = 0;             //!< SparseGraph while it is generated and converted, 0 when the graph is loaded
+    uint64_t csr = 0;
+    uint64_t index = 0;             //!< Condensation of the exact engine or landmark tables of the approximate one
+    uint64_t matrix = 0;            //!< The stored matrix, 0 when it is streamed
+    uint64_t workspaces = 0;        //!< Scratch space of every worker thread
+    uint64_t writer = 0;            //!< Batch buffers of the writers or rows queued for a streaming writer
+    uint64_t peak = 0;              //!< Largest sum of the parts alive at the same time
+    bool     streamed = false;
+};
+
+std::ostream& operator<<(std::ostream& os, const MemoryEstimate& estimate);
+
+//! Thrown before any work is done when a job cannot fit its memory budget
+class MemoryBudgetExceeded : public std::runtime_error {
+public:
+    MemoryBudgetExceeded(const std::string& what) : std::runtime_error(what) {}
+};
+
+/*! Peak memory of a job from its parameters alone. Edge and keyword counts are taken at the mean of their
+ * ranges. Sparse matrices are sized by the vertices reachable within radius / min_weight hops of a
+ * keyword's holders, which overestimates graphs with heavier edges. generate is false when the graph
+ * comes from a snapshot or the cache, output is false when the matrix is not written (e.g. only cached).
+ */
+MemoryEstimate estimate_memory(const GraphParameters& params, const MatrixOptions& options, int threads, bool generate = true, bool stream = false, bool output = true);
+
+/*! Picks how a job runs within budget bytes (0 = no budget). Returns the estimate for the in-memory matrix
+ * if it fits, otherwise switches stream on and returns the streamed estimate if can_stream and that fits.
+ * Throws MemoryBudgetExceeded with the breakdown if neither does.
+ */
+MemoryEstimate fit_memory_budget(const GraphParameters& params, const MatrixOptions& options, int threads, uint64_t budget, bool& stream, bool can_stream, bool generate = true, bool output = true);
+
+uint64_t available_memory();                        //!< MemAvailable of /proc/meminfo, 0 if it cannot be read
+uint64_t available_memory(std::istream& meminfo);   //!< MemAvailable of text in the /proc/meminfo format, 0 if it has none
+
+/*! Shares one budget between jobs running at the same time: acquire() blocks until the bytes a job asked
+ * for are free. A job larger than the whole budget is let through once nothing else is running, callers
+ * reject those up front with fit_memory_budget().
+ */
+class MemoryGate {
+public:
+    MemoryGate(uint64_t budget) : budget(budget) {}
+
+    void acquire(uint64_t bytes);
+    void release(uint64_t bytes);
+
+private:
+    uint64_t                budget;
+    uint64_t                used = 0;
+    std::mutex              lock;
+    std::condition_variable freed;
+};
+
+//! Holds bytes of a MemoryGate until it goes out of scope
+class MemoryReservation {
+public:
+    MemoryReservation(MemoryGate& gate, uint64_t bytes) : gate(gate), bytes(bytes) { gate.acquire(bytes); }
+    ~MemoryReservation()                                                         { gate.release(bytes); }
+    MemoryReservation(const MemoryReservation&) = delete;
+    MemoryReservation& operator=(const MemoryReservation&) = delete;
+
+private:
+    MemoryGate& gate;
+    uint64_t    bytes;
+};
+
+#endif
@@ -0,0 +1,196 @@
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include "metrics.hpp"
+
+double steady_seconds() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int Counter::shard() {
+    static std::atomic<int> next_shard(0);
+    static thread_local int slot = next_shard.fetch_add(1, std::memory_order_relaxed) % METRICS_SHARDS;
+    return slot;
+}
+
+uint64_t Counter::value() const {
+    uint64_t sum = 0;
+    for (const Slot& s : slots) sum += s.value.load(std::memory_order_relaxed);
+    return sum;
+}
+
+void Counter::reset() {
+    for (Slot& s : slots) s.value.store(0, std::memory_order_relaxed);
+}
+
+ProgressSource::ProgressSource(std::string n, uint64_t t, uint64_t i) : name(n), total(t), id(i) {
+    started = steady_seconds();
+}
+
+Metrics& Metrics::global() {
+    static Metrics metrics;
+    return metrics;
+}
+
+Counter& Metrics::counter(const std::string& name) {
+    std::lock_guard<std::mutex> guard(lock);
+    std::unique_ptr<Counter>& c = counters[name];
+    if (!c) c = std::make_unique<Counter>();
+    return *c;
+}
+
+std::shared_ptr<ProgressSource> Metrics::start_progress(std::string name, uint64_t total) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto source = std::make_shared<ProgressSource>(name, total, next_id++);
+
+    // Finished loops are only dropped here, so the list never grows past the loops running at once
+    std::vector<std::weak_ptr<ProgressSource>> running;
+    for (auto& s : sources) {
+        if (!s.expired()) running.push_back(s);
+    }
+    running.push_back(source);
+    sources.swap(running);
+    return source;
+}
+
+std::vector<CounterSample> Metrics::sample_counters() const {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<CounterSample> samples;
+    for (auto& [name, c] : counters) samples.push_back({name, c->value()});
+    return samples;
+}
+
+std::vector<ProgressSample> Metrics::sample_progress() const {
+    std::lock_guard<std::mutex> guard(lock);
+    std::vector<ProgressSample> samples;
+    for (auto& s : sources) {
+        if (auto source = s.lock()) samples.push_back({source->name, source->id, source->done.value(), source->total, source->started});
+    }
+    return samples;
+}
+
+MetricsReporter::MetricsReporter(std::ostream& o, MetricsFormat f, double i) : os(o), format(f), interval(i > 0 ? i : METRICS_DEFAULT_INTERVAL) {}
+
+MetricsReporter::~MetricsReporter() {
+    stop();
+}
+
+MetricsFormat MetricsReporter::parse_format(std::string name) {
+    if (name == "human") return METRICS_HUMAN;
+    if (name == "json") return METRICS_JSON;
+    throw std::runtime_error("Unknown metrics format '" + name + "', expected human or json");
+}
+
+void MetricsReporter::start() {
+    if (thread.joinable()) return;
+
+    started_at = last_at = steady_seconds();
+    stopping = false;
+    thread = std::thread(&MetricsReporter::run, this);
+}
+
+void MetricsReporter::stop() {
+    if (!thread.joinable()) return;
+
+    {
+        std::lock_guard<std::mutex> guard(wake_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    thread.join();
+    report();
+}
+
+void MetricsReporter::run() {
+    std::unique_lock<std::mutex> guard(wake_lock);
+    while (!wake.wait_for(guard, std::chrono::duration<double>(interval), [this] { return stopping; })) {
+        guard.unlock();
+        report();
+        guard.lock();
+    }
+}
+
+static std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+static std::string human_count(double n) {
+    std::ostringstream ss;
+    const char* units[] = {"", "k", "M", "G", "T"};
+    int unit = 0;
+    while (n >= 1000 && unit < 4) {
+        n /= 1000;
+        unit++;
+    }
+    ss << std::fixed << std::setprecision(unit ? 1 : 0) << n << units[unit];
+    return ss.str();
+}
+
+// Rates are taken over the last interval, the ETA over the whole run of a loop so it does not jump around
+void MetricsReporter::report() {
+    std::lock_guard<std::mutex> guard(report_lock);
+    std::vector<ProgressSample> progress = Metrics::global().sample_progress();
+    std::vector<CounterSample> counters = Metrics::global().sample_counters();
+
+    double now = steady_seconds();
+    double elapsed = now - started_at;
+    double dt = now - last_at;
+    last_at = now;
+
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(3);
+    if (format == METRICS_JSON) line << "{\"elapsed\":" << elapsed << ",\"progress\":[";
+    else line << "[" << std::setprecision(1) << elapsed << "s]";
+
+    std::map<uint64_t, uint64_t> done_now;
+    for (size_t i = 0; i < progress.size(); i++) {
+        const ProgressSample& p = progress[i];
+        auto last = last_done.find(p.id);
+        double since = last == last_done.end() ? now - std::max(p.started, started_at) : dt;
+        uint64_t before = last == last_done.end() ? 0 : last->second;
+        double rate = since > 0 ? (p.done - before) / since : 0;
+        double average = now > p.started ? p.done / (now - p.started) : 0;
+        double eta = p.done >= p.total ? 0 : average > 0 ? (p.total - p.done) / average : -1;
+        double percent = p.total ? 100.0 * std::min(p.done, p.total) / p.total : 100.0;
+        done_now[p.id] = p.done;
+
+        if (format == METRICS_JSON) {
+            line << (i ? "," : "") << "{\"name\":" << json_string(p.name) << ",\"done\":" << p.done << ",\"total\":" << p.total
+                 << ",\"rate\":" << rate << ",\"eta\":" << eta << "}";
+        } else {
+            line << " " << p.name << " " << p.done << "/" << p.total << " (" << percent << "%) "
+                 << human_count(rate) << "/s ETA ";
+            if (eta < 0) line << "?";
+            else line << eta << "s";
+        }
+    }
+    last_done.swap(done_now);
+
+    if (format == METRICS_JSON) line << "],\"counters\":{";
+    bool first = true;
+    for (const CounterSample& c : counters) {
+        auto last = last_values.find(c.name);
+        uint64_t before = last == last_values.end() ? 0 : last->second;
+        double rate = dt > 0 && c.value >= before ? (c.value - before) / dt : 0;
+        last_values[c.name] = c.value;
+        if (c.value == 0) continue;
+
+        if (format == METRICS_JSON) {
+            line << (first ? "" : ",") << json_string(c.name) << ":{\"value\":" << c.value << ",\"rate\":" << rate << "}";
+        } else {
+            line << (first && !progress.empty() ? " |" : "") << " " << c.name << "=" << human_count(c.value) << " (" << human_count(rate) << "/s)";
+        }
+        first = false;
+    }
+    if (format == METRICS_JSON) line << "}}";
+
+    // Nothing running and nothing counted is not worth a line on the console
+    if (format == METRICS_HUMAN && progress.empty() && first) return;
+    os << line.str() << std::endl;
+}
@@ -0,0 +1,125 @@
+#ifndef EVA_METRICS
+#define EVA_METRICS
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+const int    METRICS_SHARDS = 64;                   //!< Slots per counter, threads beyond this share slots
+const double METRICS_DEFAULT_INTERVAL = 1.0;        //!< Seconds between two reports
+
+/*! Monotonic counter that many threads bump at once. Each thread adds to its own cache line, so an increment
+ * is one uncontended relaxed add; only reading the value walks all the slots.
+ */
+class Counter {
+public:
+    void     add(uint64_t n = 1)    { slots[shard()].value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const;
+    void     reset();
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> value{0};
+    };
+
+    static int shard();             //!< Slot of the calling thread, handed out round robin
+
+    Slot slots[METRICS_SHARDS];
+};
+
+//! One loop being watched: its name, a counter of finished items and how many there are in total
+struct ProgressSource {
+    std::string name;
+    uint64_t    total;
+    Counter     done;
+    uint64_t    id;                 //!< Unique over the life of the process, reports key rates on it
+    double      started;            //!< Seconds on the steady clock
+
+    ProgressSource(std::string name, uint64_t total, uint64_t id);
+};
+
+struct CounterSample {
+    std::string name;
+    uint64_t    value;
+};
+
+struct ProgressSample {
+    std::string name;
+    uint64_t    id;
+    uint64_t    done;
+    uint64_t    total;
+    double      started;
+};
+
+double steady_seconds();            //!< Monotonic clock shared by progress sources and reporters
+
+/*! Process wide registry of named counters and running loops. Looking a counter up takes a lock, so hot code
+ * looks it up once (e.g. into a function-local static reference) and only calls add() afterwards. Counters
+ * live as long as the registry, progress sources as long as whoever started them holds on to them.
+ */
+class Metrics {
+public:
+    static Metrics& global();
+
+    Counter& counter(const std::string& name);
+    std::shared_ptr<ProgressSource> start_progress(std::string name, uint64_t total);
+
+    std::vector<CounterSample>  sample_counters() const;   //!< Sorted by name
+    std::vector<ProgressSample> sample_progress() const;   //!< Running loops in the order they started
+
+private:
+    mutable std::mutex                               lock;
+    std::map<std::string, std::unique_ptr<Counter>>  counters;
+    std::vector<std::weak_ptr<ProgressSource>>       sources;
+    uint64_t                                         next_id = 0;
+};
+
+enum MetricsFormat {
+    METRICS_HUMAN = 1,              //!< One line per report for people watching a console
+    METRICS_JSON  = 2,              //!< One JSON object per line for scripts
+};
+
+/*! Background thread that samples Metrics::global() every interval and prints, for every running loop, its
+ * progress, throughput and estimated time left, followed by every counter and its rate. The workers never
+ * wait for it and it never touches their cache lines more than once per interval.
+ */
+class MetricsReporter {
+public:
+    MetricsReporter(std::ostream& os, MetricsFormat format = METRICS_HUMAN, double interval = METRICS_DEFAULT_INTERVAL);
+    ~MetricsReporter();                                     //!< Stops the reporter
+    MetricsReporter(const MetricsReporter&) = delete;
+    MetricsReporter& operator=(const MetricsReporter&) = delete;
+
+    void start();
+    void stop();                                            //!< Prints a last report and joins the thread
+    void report();                                          //!< Prints one report now
+
+    static MetricsFormat parse_format(std::string name);    //!< human or json, throws otherwise
+
+private:
+    void run();
+
+    std::ostream&            os;
+    MetricsFormat            format;
+    double                   interval;
+
+    std::thread              thread;
+    std::mutex               wake_lock;
+    std::condition_variable  wake;
+    bool                     stopping = false;
+
+    std::mutex               report_lock;
+    double                   started_at = 0;                //!< Seconds on the steady clock
+    double                   last_at = 0;
+    std::map<uint64_t, uint64_t>    last_done;              //!< Progress source id -> done at the last report
+    std::map<std::string, uint64_t> last_values;            //!< Counter name -> value at the last report
+};
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef EVA_ORDERED_ROW_QUEUE
+#define EVA_ORDERED_ROW_QUEUE
+
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+/*! Bounded hand-off between many producers finishing rows in arbitrary order and one consumer that
+ * needs them in index order. A producer may only run `capacity` rows ahead of the consumer: pushing
+ * row i blocks while i >= next + capacity, where next is the row the consumer is waiting for. The row
+ * the consumer needs never blocks, so as long as rows are handed out in increasing order (as an OpenMP
+ * dynamic schedule does) at most capacity + threads rows are ever held in memory.
+ */
+template <typename Row>
+class OrderedRowQueue {
+public:
+    OrderedRowQueue(int n_rows, int capacity);
+
+    bool push(int index, Row&& row);    //!< Returns false if the queue was closed
+    bool pop(Row& row);                 //!< Next row in index order, false once every row was delivered or the queue was closed
+    void close();                       //!< Wakes everybody up, later pushes and pops fail
+    int  next_index();                  //!< Index of the row pop() returns next
+
+private:
+    std::mutex              mutex;
+    std::condition_variable can_push;
+    std::condition_variable can_pop;
+    std::map<int, Row>      pending;
+    int                     next;
+    int                     n_rows;
+    int                     capacity;
+    bool                    closed;
+};
+
+template <typename Row>
+OrderedRowQueue<Row>::OrderedRowQueue(int rows, int cap) {
+    next = 0;
+    n_rows = rows;
+    capacity = cap > 0 ? cap : 1;
+    closed = false;
+}
+
+template <typename Row>
+bool OrderedRowQueue<Row>::push(int index, Row&& row) {
+    std::unique_lock<std::mutex> lock(mutex);
+    can_push.wait(lock, [&] { return closed || index < next + capacity; });
+    if (closed) return false;
+
+    pending.emplace(index, std::move(row));
+    if (index == next) can_pop.notify_one();
+    return true;
+}
+
+template <typename Row>
+bool OrderedRowQueue<Row>::pop(Row& row) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (next >= n_rows) return false;
+
+    can_pop.wait(lock, [&] { return closed || (!pending.empty() && pending.begin()->first == next); });
+    if (closed) return false;
+
+    auto it = pending.begin();
+    row = std::move(it->second);
+    pending.erase(it);
+    ++next;
+    can_push.notify_all();
+    return true;
+}
+
+template <typename Row>
+void OrderedRowQueue<Row>::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    can_push.notify_all();
+    can_pop.notify_all();
+}
+
+template <typename Row>
+int OrderedRowQueue<Row>::next_index() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return next;
+}
+
+#endif
@@ -1,28 +1,33 @@
+#include <iostream>
 #include "percent_tracker.hpp"
 
 ProgressTracker::ProgressTracker(std::string p, std::string c, int m) {
     process = p;
     completionMessage = c;
     max = m;
-    current = 0;
-    done = false;
+    control = TaskControl::current();
 }
 
-void ProgressTracker::begin() {
-    current = 0;
-    done = false;
-    std::cout << process << " starting... \n" << std::endl;
+ProgressTracker::~ProgressTracker() {
+    if (control && source) control->set_progress_source(nullptr);
 }
 
-void ProgressTracker::increment_and_print() {
-    if (current >= max && done == false) {
-        std::cout << process << " 100% complete. " << completionMessage << std::endl;
-        done = true;
-        return;
+void ProgressTracker::begin() {
+    source = Metrics::global().start_progress(process, max);
+    if (control) {
+        control->set_stage(process);
+        control->set_progress(0, max);
+        control->set_progress_source(source);
     }
+    std::cout << process << " starting..." << std::endl;
+}
 
-    int percent = (float)((float)current++ / (float)max) * 100;
-
-    std::lock_guard<std::mutex> lock(print_semaphore);
-    std::cout << "\r" << percent << "% complete...";
+void ProgressTracker::finish() {
+    if (!source) return;
+    if (control) {
+        control->set_progress(source->done.value(), max);
+        control->set_progress_source(nullptr);
+    }
+    source.reset();
+    std::cout << process << " 100% complete. " << completionMessage << std::endl;
 }
@@ -2,27 +2,36 @@
 #define EVA_PERCENT_TRACKER
 
 #include <string>
-#include <atomic>
-#include <iostream>
-#include <mutex>
-
+#include <memory>
+#include "background_task.hpp"
+#include "metrics.hpp"
+
+/*! Tracks the progress of a loop. Every increment lands in a sharded counter that a MetricsReporter samples
+ * for throughput and ETA, so the loop itself never prints or takes a lock. Created on a thread that runs a
+ * BackgroundTask, it also hands the counter to the task's TaskControl, which sums it only when the watcher
+ * polls, and lets the loop ask whether the task was cancelled.
+ */
 class ProgressTracker {
 public:
     ProgressTracker(std::string process, std::string completionMessage, int max); //!< Initializes tracker
+    ~ProgressTracker();             //!< Takes the counter back from the task of a loop left by an exception
+    ProgressTracker(const ProgressTracker&) = delete;
+    ProgressTracker& operator=(const ProgressTracker&) = delete;
 
-    void begin();
-    void increment_and_print();
+    void begin();                   //!< Registers the loop with Metrics::global(), call before increment()
+    void increment()                { source->done.add(1); }
+    void finish();                  //!< Prints the completion message and unregisters the loop
+    bool cancelled() const          { return control && control->cancelled(); }
+    void throw_if_cancelled() const { if (control) control->throw_if_cancelled(); }
 
 private:
+    TaskControl* control;           //!< Task the tracker was created in, nullptr outside of tasks
+
     std::string process;
     std::string completionMessage; 
+    int max;
 
-    std::atomic<int> max;
-    std::atomic<int> current;
-
-    bool done;
-
-    std::mutex print_semaphore;
+    std::shared_ptr<ProgressSource> source;
 };
 
 
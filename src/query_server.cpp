@@ -0,0 +1,429 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <random>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "query_server.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+const size_t MAX_PENDING_OUTPUT = 1 << 20;     // A client that does not read its responses is not read from either
+
+struct Connection {
+    int         fd = -1;
+    std::string input;
+    std::string output;
+    bool        closing = false;    //!< The client hung up, close once the output is flushed
+    bool        failed = false;     //!< Close right away
+};
+
+// Moves the next complete line out of buffer, without its newline
+static bool next_line(std::string& buffer, std::string& line) {
+    size_t end = buffer.find('\n');
+    if (end == std::string::npos) return false;
+    size_t length = end > 0 && buffer[end - 1] == '\r' ? end - 1 : end;
+    line.assign(buffer, 0, length);
+    buffer.erase(0, end + 1);
+    return true;
+}
+
+static bool send_all(int fd, const std::string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t sent = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += sent;
+    }
+    return true;
+}
+
+static sockaddr_un socket_address(const std::string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Invalid socket path '" + path + "'");
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// Splits a request into at most max words, returns how many there were (max + 1 if there are more)
+static int split_words(const std::string& line, std::string_view* words, int max) {
+    int n = 0;
+    size_t i = 0;
+    while (i < line.size()) {
+        while (i < line.size() && line[i] == ' ') i++;
+        if (i == line.size()) break;
+        size_t end = line.find(' ', i);
+        if (end == std::string::npos) end = line.size();
+        if (n == max) return max + 1;
+        words[n++] = std::string_view(line).substr(i, end - i);
+        i = end;
+    }
+    return n;
+}
+
+static bool parse_int(std::string_view word, int& x) {
+    auto [end, error] = std::from_chars(word.data(), word.data() + word.size(), x);
+    return error == std::errc() && end == word.data() + word.size();
+}
+
+static std::string distance_text(int dist) {
+    return dist == BIG_NUMBER ? "inf" : std::to_string(dist);
+}
+
+QueryServer::QueryServer(const BinaryMatrixReader& m, int threads) : matrix(m), pool(threads) {
+    W = matrix.get_size().pred;
+    V = matrix.get_size().dist;
+    if (pipe2(wake, O_CLOEXEC | O_NONBLOCK) != 0) {
+        throw std::runtime_error(std::string("Unable to create a pipe: ") + std::strerror(errno));
+    }
+}
+
+QueryServer::~QueryServer() {
+    close(wake[0]);
+    close(wake[1]);
+}
+
+void QueryServer::stop() {
+    char byte = 0;
+    ssize_t ignored = write(wake[1], &byte, 1);
+    (void)ignored;
+}
+
+std::string QueryServer::answer(const std::string& request) const {
+    std::string_view words[4];
+    int n = split_words(request, words, 3);
+    int a = 0, b = 0;
+    bool numbers = n == 3 && parse_int(words[1], a) && parse_int(words[2], b);
+
+    try {
+        if (n == 1 && words[0] == "info") {
+            return "ok " + std::to_string(W) + " " + std::to_string(V) + " " + std::to_string(matrix.get_max_radius()) + " " +
+                   (matrix.is_sparse() ? "sparse " : "dense ") +
+                   (matrix.get_dtype() == DTYPE_INT32 ? "int32" : matrix.get_dtype() == DTYPE_VARINT ? "varint" : "zstd");
+        }
+        if (n == 0) return "error empty request";
+        if (words[0] != "dist" && words[0] != "nearest" && words[0] != "path") return "error unknown request '" + std::string(words[0]) + "'";
+        if (!numbers) return "error " + std::string(words[0]) + " takes two integers";
+
+        if (words[0] == "nearest") {
+            int v = a, k = b;
+            if (v < 0 || v >= V) return "error vertex " + std::to_string(v) + " out of range";
+            if (k < 0) return "error k must not be negative";
+
+            thread_local std::vector<std::pair<int, int>> found;
+            found.clear();
+            for (int w = 0; w < W; w++) {
+                int dist = matrix(w, v).dist;
+                if (dist != BIG_NUMBER) found.push_back({dist, w});
+            }
+            size_t count = std::min<size_t>(k, found.size());
+            std::partial_sort(found.begin(), found.begin() + count, found.end());
+
+            std::string response = "ok " + std::to_string(count);
+            for (size_t i = 0; i < count; i++) {
+                response += " " + std::to_string(found[i].second) + ":" + std::to_string(found[i].first);
+            }
+            return response;
+        }
+
+        int w = a, v = b;
+        if (w < 0 || w >= W) return "error keyword " + std::to_string(w) + " out of range";
+        if (v < 0 || v >= V) return "error vertex " + std::to_string(v) + " out of range";
+        Pair cell = matrix(w, v);
+
+        if (words[0] == "dist") {
+            return "ok " + distance_text(cell.dist) + " " + std::to_string(cell.pred);
+        }
+
+        // Holders are their own predecessor, so the chain ends at the holder the distance was measured from
+        if (cell.dist == BIG_NUMBER) return "ok 0";
+        std::vector<int> path = {v};
+        for (int x = v; cell.pred != x && cell.pred >= 0; cell = matrix(w, x)) {
+            x = cell.pred;
+            path.push_back(x);
+            if ((int)path.size() > V) return "error predecessor chain of keyword " + std::to_string(w) + " has a cycle";
+        }
+
+        std::string response = "ok " + std::to_string(path.size());
+        for (auto it = path.rbegin(); it != path.rend(); ++it) {
+            response += " " + std::to_string(*it);
+        }
+        return response;
+    } catch (const std::exception& e) {
+        return std::string("error ") + e.what();
+    }
+}
+
+void QueryServer::answer_batch(const std::vector<std::string>& requests, std::vector<std::string>& responses) {
+    TRACE_ZONE("query_batch");
+    const size_t n = requests.size();
+    responses.resize(n);
+    int chunks = std::min<size_t>(pool.size(), (n + QUERY_BATCH_CHUNK - 1) / QUERY_BATCH_CHUNK);
+
+    if (chunks <= 1) {
+        for (size_t i = 0; i < n; i++) responses[i] = answer(requests[i]);
+        return;
+    }
+
+    for (int c = 0; c < chunks; c++) {
+        size_t begin = n * c / chunks, end = n * (c + 1) / chunks;
+        pool.submit(1, [&, begin, end] {
+            for (size_t i = begin; i < end; i++) responses[i] = answer(requests[i]);
+        });
+    }
+    pool.wait();
+}
+
+void QueryServer::serve(std::string socket_path) {
+    sockaddr_un address = socket_address(socket_path);
+
+    // Only a socket left behind by an earlier server is replaced, never a regular file
+    struct stat st;
+    if (lstat(socket_path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) throw std::runtime_error(socket_path + " exists and is not a socket");
+        unlink(socket_path.c_str());
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (listener < 0 || bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        std::string reason = std::strerror(errno);
+        if (listener >= 0) close(listener);
+        throw std::runtime_error("Unable to listen on " + socket_path + ": " + reason);
+    }
+    std::cout << "Serving " << W << "x" << V << " matrix on " << socket_path << std::endl;
+
+    static Counter& served = Metrics::global().counter("queries_served");
+    static Counter& batches = Metrics::global().counter("query_batches");
+    std::vector<Connection> connections;
+    std::vector<pollfd> fds;
+    std::vector<std::string> requests, responses;
+    std::vector<size_t> owners;
+    char chunk[65536];
+
+    while (true) {
+        fds.assign({{wake[0], POLLIN, 0}, {listener, POLLIN, 0}});
+        for (const Connection& c : connections) {
+            short events = (c.closing || c.output.size() >= MAX_PENDING_OUTPUT ? 0 : POLLIN) | (c.output.empty() ? 0 : POLLOUT);
+            fds.push_back({c.fd, events, 0});
+        }
+        if (poll(fds.data(), fds.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("Unable to wait for requests: ") + std::strerror(errno));
+        }
+        if (fds[0].revents) break;
+
+        if (fds[1].revents & POLLIN) {
+            int fd;
+            while ((fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                connections.emplace_back();
+                connections.back().fd = fd;
+            }
+        }
+
+        // Everything that arrived is one batch; connections accepted above were not polled yet
+        requests.clear();
+        owners.clear();
+        for (size_t i = 0; i + 2 < fds.size(); i++) {
+            Connection& c = connections[i];
+            if (!(fds[i + 2].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+            while (true) {
+                ssize_t got = read(c.fd, chunk, sizeof(chunk));
+                if (got > 0) {
+                    c.input.append(chunk, got);
+                    continue;
+                }
+                if (got < 0 && errno == EINTR) continue;
+                if (got == 0) c.closing = true;
+                else if (errno != EAGAIN && errno != EWOULDBLOCK) c.failed = true;
+                break;
+            }
+
+            std::string line;
+            while (next_line(c.input, line)) {
+                requests.push_back(line);
+                owners.push_back(i);
+            }
+            if (c.input.size() > QUERY_MAX_LINE) {
+                c.output += "error request longer than " + std::to_string(QUERY_MAX_LINE) + " bytes\n";
+                c.input.clear();
+                c.closing = true;
+            }
+        }
+
+        if (!requests.empty()) {
+            answer_batch(requests, responses);
+            for (size_t j = 0; j < requests.size(); j++) {
+                connections[owners[j]].output += responses[j];
+                connections[owners[j]].output += '\n';
+            }
+            served.add(requests.size());
+            batches.add(1);
+        }
+
+        for (Connection& c : connections) {
+            size_t done = 0;
+            while (!c.failed && done < c.output.size()) {
+                ssize_t sent = send(c.fd, c.output.data() + done, c.output.size() - done, MSG_NOSIGNAL);
+                if (sent > 0) done += sent;
+                else if (sent < 0 && errno == EINTR) continue;
+                else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                else c.failed = true;
+            }
+            c.output.erase(0, done);
+        }
+
+        auto finished = [](const Connection& c) { return c.failed || (c.closing && c.output.empty()); };
+        for (const Connection& c : connections) {
+            if (finished(c)) close(c.fd);
+        }
+        connections.erase(std::remove_if(connections.begin(), connections.end(), finished), connections.end());
+    }
+
+    for (const Connection& c : connections) close(c.fd);
+    close(listener);
+    unlink(socket_path.c_str());
+
+    char drained[16];
+    while (read(wake[0], drained, sizeof(drained)) > 0) {}
+}
+
+static int connect_socket(const std::string& path) {
+    sockaddr_un address = socket_address(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        std::string reason = std::strerror(errno);
+        if (fd >= 0) close(fd);
+        throw std::runtime_error("Unable to connect to " + path + ": " + reason);
+    }
+    return fd;
+}
+
+static void read_response(int fd, std::string& input, std::string& line) {
+    char chunk[65536];
+    while (!next_line(input, line)) {
+        ssize_t got = read(fd, chunk, sizeof(chunk));
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) throw std::runtime_error("The query server closed the connection");
+        input.append(chunk, got);
+    }
+}
+
+std::ostream& operator<<(std::ostream& os, const QueryLoadReport& r) {
+    os << r.requests << " requests in " << r.seconds << " s: " << (long)r.queries_per_second << " queries/s, latency p50 " << r.p50_us
+       << " us, p99 " << r.p99_us << " us, p99.9 " << r.p999_us << " us, max " << r.max_us << " us, " << r.errors << " errors";
+    return os;
+}
+
+// Every connection keeps depth requests in flight, sending a new one for every response
+QueryLoadReport run_query_load(std::string socket_path, const QueryLoadOptions& o) {
+    if (o.kind != "dist" && o.kind != "nearest" && o.kind != "path" && o.kind != "mix") {
+        throw std::runtime_error("Unknown request kind '" + o.kind + "'");
+    }
+
+    int W = 0, V = 0;
+    {
+        int fd = connect_socket(socket_path);
+        std::string input, line;
+        bool ok = send_all(fd, "info\n");
+        if (ok) read_response(fd, input, line);
+        close(fd);
+        char words[2][16];
+        if (!ok || std::sscanf(line.c_str(), "%15s %d %d", words[0], &W, &V) != 3 || std::strcmp(words[0], "ok") != 0 || W <= 0 || V <= 0) {
+            throw std::runtime_error("Unexpected info response '" + line + "'");
+        }
+    }
+
+    using Clock = std::chrono::steady_clock;
+    const int connections = std::max(1, o.connections);
+    std::vector<std::vector<double>> latencies(connections);
+    std::vector<long> errors(connections, 0);
+    std::vector<std::exception_ptr> failures(connections);
+    std::vector<std::thread> threads;
+
+    auto start = Clock::now();
+    for (int c = 0; c < connections; c++) {
+        threads.emplace_back([&, c] {
+            try {
+                std::mt19937_64 rng(o.seed + c);
+                std::uniform_int_distribution<int> keyword(0, W - 1), vertex(0, V - 1), mix(0, 9);
+                long quota = o.requests / connections + (c < o.requests % connections);
+                latencies[c].reserve(quota);
+
+                int fd = connect_socket(socket_path);
+                std::deque<Clock::time_point> in_flight;
+                std::string input, line, out;
+                long sent = 0;
+
+                while ((long)latencies[c].size() < quota) {
+                    out.clear();
+                    while (sent < quota && (int)in_flight.size() < std::max(1, o.depth)) {
+                        // mix is 80% dist, 10% nearest and 10% path, roughly what lookup services send
+                        std::string kind = o.kind;
+                        if (kind == "mix") {
+                            int r = mix(rng);
+                            kind = r < 8 ? "dist" : r == 8 ? "nearest" : "path";
+                        }
+                        if (kind == "nearest") out += "nearest " + std::to_string(vertex(rng)) + " " + std::to_string(o.k) + "\n";
+                        else out += kind + " " + std::to_string(keyword(rng)) + " " + std::to_string(vertex(rng)) + "\n";
+                        in_flight.push_back(Clock::now());
+                        sent++;
+                    }
+                    if (!out.empty() && !send_all(fd, out)) {
+                        close(fd);
+                        throw std::runtime_error("The query server closed the connection");
+                    }
+
+                    read_response(fd, input, line);
+                    do {
+                        latencies[c].push_back(std::chrono::duration<double, std::micro>(Clock::now() - in_flight.front()).count());
+                        in_flight.pop_front();
+                        if (line.compare(0, 5, "error") == 0) errors[c]++;
+                    } while (!in_flight.empty() && next_line(input, line));
+                }
+                close(fd);
+            } catch (...) {
+                failures[c] = std::current_exception();
+            }
+        });
+    }
+    for (std::thread& t : threads) t.join();
+    for (std::exception_ptr& failure : failures) {
+        if (failure) std::rethrow_exception(failure);
+    }
+
+    QueryLoadReport report;
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::vector<double> all;
+    for (int c = 0; c < connections; c++) {
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        report.errors += errors[c];
+    }
+    std::sort(all.begin(), all.end());
+
+    auto percentile = [&](double q) { return all.empty() ? 0.0 : all[std::min(all.size() - 1, (size_t)(q * all.size()))]; };
+    report.requests = all.size();
+    report.queries_per_second = report.seconds > 0 ? all.size() / report.seconds : 0;
+    report.p50_us = percentile(0.5);
+    report.p99_us = percentile(0.99);
+    report.p999_us = percentile(0.999);
+    report.max_us = all.empty() ? 0 : all.back();
+    return report;
+}
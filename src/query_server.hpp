@@ -0,0 +1,76 @@
+#ifndef EVA_QUERY_SERVER
+#define EVA_QUERY_SERVER
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "binary_matrix.hpp"
+#include "thread_pool.hpp"
+
+/*! Long-running lookup service over a Unix domain socket, so consumers share one memory-mapped matrix file
+ * instead of each loading the matrix. Requests and responses are single text lines and a client may send
+ * many requests before reading the responses, which come back in request order:
+ *
+ *     info                    ok <W> <V> <max_radius> <dense|sparse> <int32|varint|zstd>
+ *     dist <w> <v>            ok <dist> <pred>                   dist is inf when v cannot reach w
+ *     nearest <v> <k>         ok <n> <w>:<dist> ...              the n <= k closest keywords of v
+ *     path <w> <v>            ok <n> <v_1> ... <v_n>             from a holder of w to v, n = 0 when unreachable
+ *                             error <message>
+ *
+ * One thread multiplexes the connections. Every request that arrived since the last round is answered as one
+ * batch, split over a ThreadPool when it is large enough to be worth the hand-off, and the responses are
+ * queued back in order. Lookups on compressed matrices decode a whole row, int32 files answer dist in O(1)
+ * and nearest with one read per keyword.
+ */
+
+const int QUERY_MAX_LINE = 4096;            //!< Longer requests close the connection
+const int QUERY_BATCH_CHUNK = 64;           //!< Requests per pool task, smaller batches are answered in place
+
+class QueryServer {
+public:
+    QueryServer(const BinaryMatrixReader& matrix, int threads);
+    ~QueryServer();
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    void        serve(std::string socket_path);           //!< Blocks until stop(), replaces a stale socket file
+    void        stop();                                   //!< Async-signal-safe
+    std::string answer(const std::string& request) const; //!< Response line without its newline
+
+private:
+    void answer_batch(const std::vector<std::string>& requests, std::vector<std::string>& responses);
+
+    const BinaryMatrixReader& matrix;
+    int                       W;
+    int                       V;
+    ThreadPool                pool;
+    int                       wake[2];              //!< stop() writes to wake[1] to interrupt poll()
+};
+
+struct QueryLoadOptions {
+    int         connections = 4;
+    long        requests = 100000;          //!< Over all connections
+    int         depth = 1;                  //!< Requests in flight per connection
+    std::string kind = "mix";               //!< dist, nearest, path or mix
+    int         k = 10;                     //!< k of nearest requests
+    uint64_t    seed = 1;
+};
+
+struct QueryLoadReport {
+    long   requests = 0;
+    long   errors = 0;                      //!< error responses
+    double seconds = 0;
+    double queries_per_second = 0;
+    double p50_us = 0;
+    double p99_us = 0;
+    double p999_us = 0;
+    double max_us = 0;
+};
+
+std::ostream& operator<<(std::ostream& os, const QueryLoadReport& report);
+
+//! Load generator: random requests for keywords and vertices of the served matrix, latency is measured from send to response
+QueryLoadReport run_query_load(std::string socket_path, const QueryLoadOptions& options);
+
+#endif
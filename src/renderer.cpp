@@ -149,10 +149,10 @@ void GPUGraph::render(glm::mat4 projection) {
         glUniformMatrix4fv(glGetUniformLocation(nodeShader, "projection"),
                          1, GL_FALSE, &projection[0][0]);
         glUniform4f(glGetUniformLocation(nodeShader, "color"),
-                   params.vertex_color.x,
-                   params.vertex_color.y,
-                   params.vertex_color.z,
-                   params.vertex_color.w);
+                   style.vertex_color.x,
+                   style.vertex_color.y,
+                   style.vertex_color.z,
+                   style.vertex_color.w);
 
         // Draw all vertices
         if (!edgePoints.empty()) {
@@ -164,10 +164,10 @@ void GPUGraph::render(glm::mat4 projection) {
         glUniformMatrix4fv(glGetUniformLocation(edgeShader, "projection"),
                          1, GL_FALSE, &projection[0][0]);
         glUniform4f(glGetUniformLocation(edgeShader, "color"),
-                   params.edge_color.x, 
-                   params.edge_color.y,
-                   params.edge_color.z,
-                   params.edge_color.w);
+                   style.edge_color.x, 
+                   style.edge_color.y,
+                   style.edge_color.z,
+                   style.edge_color.w);
 
 
 
@@ -18,9 +18,15 @@ struct GPUEdge {
     float weight;
 };
 
+//! Colours the graph is drawn with, edited through the GUI
+struct RenderStyle {
+    glm::vec4 vertex_color = glm::vec4(1.0f, 1.0f, 1.0f, 1.0f);
+    glm::vec4 edge_color = glm::vec4(0.0f, 1.0f, 0.0f, 1.0f);
+};
+
 class GPUGraph {
 public:
-    GPUGraph(SparseGraph<int>& g, GraphParameters& p) : graph(g), params(p) { currentBuffer = 0; createBuffers(); loadShaders(); };
+    GPUGraph(SparseGraph<int>& g, RenderStyle& s) : graph(g), style(s) { currentBuffer = 0; createBuffers(); loadShaders(); };
 
     void createBuffers();
     void loadShaders();
@@ -41,7 +47,7 @@ private:
     GLuint currentBuffer;
 
     SparseGraph<int>& graph;
-    GraphParameters& params;
+    RenderStyle& style;
 };
 
 #endif
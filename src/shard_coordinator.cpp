@@ -0,0 +1,341 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "shard_coordinator.hpp"
+#include "graph_snapshot.hpp"
+#include "csv_writer.hpp"
+#include "matrix_pipeline.hpp"
+#include "percent_tracker.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
+
+struct WorkerProcess {
+    pid_t       pid = -1;
+    int         fd = -1;                //!< -1 once the worker is gone
+    std::string input;                  //!< Received bytes that do not form a full line yet
+    bool        ready = false;          //!< Loaded the graph
+    int         shard = -1;             //!< Shard being computed, -1 while idle
+};
+
+// MSG_NOSIGNAL turns a write to a dead worker into an error instead of a SIGPIPE
+static bool send_line(int fd, const std::string& line) {
+    std::string message = line + "\n";
+    const char* bytes = message.data();
+    size_t n = message.size();
+    while (n > 0) {
+        ssize_t sent = send(fd, bytes, n, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        bytes += sent;
+        n -= sent;
+    }
+    return true;
+}
+
+// Moves the next complete line out of buffer, without its newline
+static bool next_line(std::string& buffer, std::string& line) {
+    size_t end = buffer.find('\n');
+    if (end == std::string::npos) return false;
+    line = buffer.substr(0, end);
+    buffer.erase(0, end + 1);
+    return true;
+}
+
+// Appends what is available on fd to buffer, false once the other side hung up
+static bool receive(int fd, std::string& buffer) {
+    char chunk[4096];
+    ssize_t got;
+    do {
+        got = read(fd, chunk, sizeof(chunk));
+    } while (got < 0 && errno == EINTR);
+    if (got <= 0) return false;
+    buffer.append(chunk, got);
+    return true;
+}
+
+static std::string exit_status(int status) {
+    if (WIFEXITED(status)) return "exited with status " + std::to_string(WEXITSTATUS(status));
+    if (WIFSIGNALED(status)) return "was killed by signal " + std::to_string(WTERMSIG(status));
+    return "stopped";
+}
+
+// The command is prepared before fork(), the child only makes async-signal-safe calls until it execs
+static void start_worker(const std::vector<std::string>& command, WorkerProcess& worker) {
+    std::vector<char*> argv;
+    for (const std::string& arg : command) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) != 0) {
+        throw std::runtime_error(std::string("Unable to create a worker socket: ") + std::strerror(errno));
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(sockets[0]);
+        close(sockets[1]);
+        throw std::runtime_error(std::string("Unable to start a worker: ") + std::strerror(errno));
+    }
+    if (pid == 0) {
+        // dup2 clears close-on-exec on the copy, a socket that already is SHARD_WORKER_FD needs it cleared by hand
+        if (sockets[1] == SHARD_WORKER_FD) fcntl(sockets[1], F_SETFD, 0);
+        else dup2(sockets[1], SHARD_WORKER_FD);
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDOUT_FILENO);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    close(sockets[1]);
+    worker = WorkerProcess();
+    worker.pid = pid;
+    worker.fd = sockets[0];
+}
+
+// Returns how the worker ended. Killing first makes sure a worker that only closed its socket is gone too
+static std::string stop_worker(WorkerProcess& worker) {
+    if (worker.fd >= 0) close(worker.fd);
+    worker.fd = -1;
+    if (worker.pid < 0) return "";
+
+    kill(worker.pid, SIGKILL);
+    int status = 0;
+    while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {}
+    worker.pid = -1;
+    return exit_status(status);
+}
+
+ShardCoordinator::ShardCoordinator(std::vector<std::string> command, int n_W) {
+    worker_command = command;
+    W = n_W;
+}
+
+std::vector<ShardInfo> ShardCoordinator::run(std::string prefix) {
+    TRACE_ZONE("ShardCoordinator::run");
+    const int n = std::max(1, std::min(shard_count > 0 ? shard_count : 4 * workers, W));
+    std::vector<ShardInfo> shards(n);
+    std::vector<int> attempts(n, 0);
+    std::deque<int> pending;
+    for (int s = 0; s < n; s++) {
+        shards[s].first_keyword = (long)W * s / n;
+        shards[s].last_keyword = (long)W * (s + 1) / n;
+        shards[s].rows = shards[s].last_keyword - shards[s].first_keyword;
+        char name[64];
+        std::snprintf(name, sizeof(name), "-%05d-of-%05d.bin", s, n);
+        shards[s].file = prefix + name;
+        pending.push_back(s);
+    }
+
+    static Counter& reassigned = Metrics::global().counter("shards_reassigned");
+    ProgressTracker tracker("shard_coordinator", "All shards computed.", n);
+    tracker.begin();
+
+    std::vector<WorkerProcess> pool(std::min(workers, n));
+    int failed_starts = 0;
+    int finished = 0;
+
+    auto fail_shard = [&](int s, const std::string& reason) {
+        if (attempts[s] >= max_attempts) {
+            throw std::runtime_error("Shard " + std::to_string(s + 1) + " (keywords " + std::to_string(shards[s].first_keyword) + " to " +
+                                     std::to_string(shards[s].last_keyword - 1) + ") failed " + std::to_string(attempts[s]) + " times: " + reason);
+        }
+        std::cerr << "Shard " << s + 1 << " failed, reassigning it: " << reason << std::endl;
+        reassigned.add(1);
+        pending.push_front(s);
+    };
+
+    auto lose_worker = [&](WorkerProcess& worker, std::string reason) {
+        pid_t pid = worker.pid;
+        std::string status = stop_worker(worker);
+        if (reason.empty()) reason = "worker " + std::to_string(pid) + " " + status;
+        if (!worker.ready && ++failed_starts >= max_attempts * (int)pool.size()) {
+            throw std::runtime_error("Workers keep failing to start, the last one " + status);
+        }
+        if (worker.shard >= 0) fail_shard(worker.shard, reason);
+        worker.shard = -1;
+    };
+
+    try {
+        while (finished < n) {
+            // Dead workers are only replaced while there is work for them
+            for (WorkerProcess& worker : pool) {
+                if (worker.fd < 0 && !pending.empty()) start_worker(worker_command, worker);
+                if (worker.fd < 0 || !worker.ready || worker.shard >= 0 || pending.empty()) continue;
+
+                int s = pending.front();
+                pending.pop_front();
+                worker.shard = s;
+                attempts[s]++;
+                if (!send_line(worker.fd, "shard " + std::to_string(s) + " " + std::to_string(shards[s].first_keyword) + " " +
+                                          std::to_string(shards[s].last_keyword) + " " + shards[s].file)) {
+                    lose_worker(worker, "");
+                }
+            }
+
+            std::vector<pollfd> fds;
+            std::vector<WorkerProcess*> polled;
+            for (WorkerProcess& worker : pool) {
+                if (worker.fd < 0) continue;
+                fds.push_back({worker.fd, POLLIN, 0});
+                polled.push_back(&worker);
+            }
+            if (poll(fds.data(), fds.size(), -1) < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error(std::string("Unable to wait for the workers: ") + std::strerror(errno));
+            }
+
+            for (size_t i = 0; i < fds.size(); i++) {
+                if (!fds[i].revents) continue;
+                WorkerProcess& worker = *polled[i];
+                if (!receive(worker.fd, worker.input)) {
+                    lose_worker(worker, "");
+                    continue;
+                }
+
+                std::string line;
+                while (worker.fd >= 0 && next_line(worker.input, line)) {
+                    std::istringstream message(line);
+                    std::string kind;
+                    int s = -1;
+                    message >> kind;
+                    if (kind == "ready") {
+                        worker.ready = true;
+                        continue;
+                    }
+
+                    message >> s;
+                    if (s != worker.shard || (kind != "done" && kind != "error")) {
+                        lose_worker(worker, "worker sent '" + line + "'");
+                        continue;
+                    }
+                    worker.shard = -1;
+
+                    if (kind == "done") {
+                        message >> shards[s].checksum;
+                        struct stat st;
+                        shards[s].bytes = stat(shards[s].file.c_str(), &st) == 0 ? st.st_size : 0;
+                        finished++;
+                        tracker.increment();
+                    } else {
+                        std::string reason;
+                        std::getline(message >> std::ws, reason);
+                        fail_shard(s, reason);
+                    }
+                }
+            }
+        }
+    } catch (...) {
+        for (WorkerProcess& worker : pool) stop_worker(worker);
+        for (const ShardInfo& shard : shards) std::remove(shard.file.c_str());
+        throw;
+    }
+
+    // Closing the sockets is the signal to exit
+    for (WorkerProcess& worker : pool) {
+        if (worker.fd >= 0) close(worker.fd);
+        worker.fd = -1;
+    }
+    for (WorkerProcess& worker : pool) {
+        int status = 0;
+        if (worker.pid >= 0) while (waitpid(worker.pid, &status, 0) < 0 && errno == EINTR) {}
+    }
+
+    tracker.finish();
+    return shards;
+}
+
+// Every shard file is a complete binary matrix, so merging is a streamed copy of its rows
+void ShardCoordinator::merge(const std::vector<ShardInfo>& shards, std::string filepath, bool binary, BinaryMatrixDtype dtype) {
+    TRACE_ZONE("ShardCoordinator::merge");
+    CSVWriter csv;
+    BinaryMatrixWriter bin(binary ? dtype : DTYPE_INT32);
+    std::vector<Pair> dense;
+    std::vector<SparseEntry> sparse;
+    bool started = false;
+
+    try {
+        for (const ShardInfo& shard : shards) {
+            BinaryMatrixReader reader(shard.file);
+            if (reader.get_size().pred != shard.rows || reader.get_checksum() != shard.checksum || !reader.verify()) {
+                throw std::runtime_error("Shard file " + shard.file + " does not match what its worker reported");
+            }
+
+            if (!started) {
+                if (binary) bin.begin_stream(filepath, W, reader.get_size().dist, reader.get_max_radius());
+                else csv.begin_stream(filepath, reader.get_size().dist);
+                started = true;
+            }
+
+            for (int w = 0; w < shard.rows; w++) {
+                if (reader.is_sparse()) {
+                    reader.decode_row(w, sparse);
+                    if (binary) bin.stream_row(sparse.data(), sparse.size());
+                    else csv.stream_row(sparse.data(), sparse.size());
+                } else {
+                    reader.decode_row(w, dense);
+                    if (binary) bin.stream_row(dense.data());
+                    else csv.stream_row(dense.data());
+                }
+            }
+        }
+
+        if (binary) bin.end_stream();
+        else csv.end_stream();
+    } catch (...) {
+        std::remove(filepath.c_str());
+        throw;
+    }
+
+    for (const ShardInfo& shard : shards) std::remove(shard.file.c_str());
+}
+
+void run_shard_worker(int fd, std::string snapshot, int max_radius, BinaryMatrixDtype dtype) {
+    // Every worker maps the same snapshot, so the graph's pages are shared instead of copied into each process
+    GraphSnapshotReader reader(snapshot);
+    CSRView<int> graph = reader.view();
+    KeywordDistanceMatrix mat(graph.n_keywords, graph.n_vertices, reader.get_params().max_weight, max_radius);
+    if (!send_line(fd, "ready")) return;
+
+    std::string buffer, line;
+    while (true) {
+        while (!next_line(buffer, line)) {
+            if (!receive(fd, buffer)) {
+                close(fd);
+                return;
+            }
+        }
+
+        std::istringstream message(line);
+        std::string kind, file;
+        int s = -1, first = 0, last = 0;
+        message >> kind >> s >> first >> last;
+        std::getline(message >> std::ws, file);
+        if (kind != "shard" || file.empty()) {
+            throw std::runtime_error("Unexpected message from the coordinator: " + line);
+        }
+
+        std::string reply;
+        try {
+            uint64_t checksum = stream_matrix_range_cpu(mat, graph, first, last, file, true, dtype);
+            reply = "done " + std::to_string(s) + " " + std::to_string(checksum);
+        } catch (const std::exception& e) {
+            reply = "error " + std::to_string(s) + " " + e.what();
+            std::replace(reply.begin(), reply.end(), '\n', ' ');
+        }
+        if (!send_line(fd, reply)) return;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef EVA_SHARD_COORDINATOR
+#define EVA_SHARD_COORDINATOR
+
+#include <string>
+#include <vector>
+#include "binary_matrix.hpp"
+#include "sharded_writer.hpp"
+
+/*! Computes an exact matrix with several worker processes instead of the threads of one process, so a run
+ * can use the memory bandwidth of every socket (and later of several machines).
+ *
+ * The coordinator splits the W keywords into contiguous ranges and starts the workers, each with a stream
+ * socket to the coordinator on SHARD_WORKER_FD. Workers map the same graph snapshot, so the page cache
+ * holds the graph once. The protocol is one text line per message:
+ *
+ *     worker -> coordinator   ready
+ *     coordinator -> worker   shard <index> <first_keyword> <last_keyword> <file>
+ *     worker -> coordinator   done <index> <checksum>
+ *                             error <index> <message>
+ *
+ * A worker writes the rows of a shard as a binary matrix of its own into <file> and stays for the next
+ * shard until the coordinator closes the socket. A shard whose worker reports an error or dies is handed to
+ * another worker, a dead worker is replaced, and a shard that fails max_attempts times fails the run. The
+ * finished shards are checked against the reported checksums and merged in keyword order into one file.
+ */
+
+const int SHARD_WORKER_FD = 3;              //!< Descriptor of the coordinator socket in a worker
+const int SHARD_DEFAULT_ATTEMPTS = 3;
+
+class ShardCoordinator {
+public:
+    //! worker_command is executed for every worker, it must end up in run_shard_worker(SHARD_WORKER_FD, ...)
+    ShardCoordinator(std::vector<std::string> worker_command, int W);
+
+    std::vector<ShardInfo> run(std::string prefix);     //!< Shard files are <prefix>-<index>-of-<count>.bin
+    void merge(const std::vector<ShardInfo>& shards, std::string filepath, bool binary, BinaryMatrixDtype dtype = DTYPE_INT32); //!< Removes the shard files
+
+    void set_workers(int n)         { workers = n;      }
+    void set_shard_count(int n)     { shard_count = n;  } //!< 0 = four per worker, so faster workers pick up more
+    void set_max_attempts(int n)    { max_attempts = n; }
+
+private:
+    std::vector<std::string> worker_command;
+    int                      W;
+    int                      workers = 1;
+    int                      shard_count = 0;
+    int                      max_attempts = SHARD_DEFAULT_ATTEMPTS;
+};
+
+//! Worker side: serves shards of the graph in snapshot over fd until the coordinator hangs up
+void run_shard_worker(int fd, std::string snapshot, int max_radius, BinaryMatrixDtype dtype);
+
+#endif
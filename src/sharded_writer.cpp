@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include "sharded_writer.hpp"
+#include "csv_writer.hpp"
+#include "thread_config.hpp"
+#include "trace.hpp"
+
+static int digits(long x) {
+    int n = 1;
+    while (x >= 10) {
+        x /= 10;
+        ++n;
+    }
+    return n;
+}
+
+static std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+ShardedMatrixWriter::ShardedMatrixWriter(std::string dir, std::string name) {
+    directory = dir.empty() ? "." : dir;
+    prefix = name;
+}
+
+std::string ShardedMatrixWriter::manifest_path() const {
+    return (std::filesystem::path(directory) / (prefix + ".manifest.json")).string();
+}
+
+// With a size target the bytes of a row are estimated from its number of cells, which is close enough for
+// balancing and avoids formatting every row twice
+std::vector<int> ShardedMatrixWriter::plan_shards(const KeywordDistanceMatrix& mat) const {
+    Pair p = mat.get_size();
+    const int W = p.pred;
+    const int V = p.dist;
+    std::vector<int> bounds = {0};
+
+    if (target_shard_bytes == 0) {
+        int n = std::max(1, std::min(shard_count, W));
+        for (int s = 1; s <= n; s++) {
+            bounds.push_back((long)W * s / n);
+        }
+        return bounds;
+    }
+
+    double cell_bytes;
+    if (!binary) cell_bytes = mat.is_sparse() ? 2 * digits(V) + 5 : digits(V) + 4;
+    else if (dtype == DTYPE_INT32) cell_bytes = mat.is_sparse() ? sizeof(SparseEntry) : 2 * sizeof(int32_t);
+    else cell_bytes = mat.is_sparse() ? 5 : 4;
+
+    double size = 0;
+    for (int w = 0; w < W; w++) {
+        size += cell_bytes * (mat.is_sparse() ? mat.sparse_row(w).size() : V);
+        if (size >= target_shard_bytes && w + 1 < W) {
+            bounds.push_back(w + 1);
+            size = 0;
+        }
+    }
+    bounds.push_back(W);
+    return bounds;
+}
+
+void ShardedMatrixWriter::write_shard(const KeywordDistanceMatrix& mat, ShardInfo& shard) const {
+    TRACE_ZONE("ShardedMatrixWriter::write_shard");
+    const int V = mat.get_size().dist;
+    std::string path = (std::filesystem::path(directory) / shard.file).string();
+
+    if (binary) {
+        BinaryMatrixWriter writer(dtype);
+        writer.begin_stream(path, shard.last_keyword - shard.first_keyword, V, mat.get_max_radius());
+        for (int w = shard.first_keyword; w < shard.last_keyword; w++) {
+            if (mat.is_sparse()) writer.stream_row(mat.sparse_row(w).data(), mat.sparse_row(w).size());
+            else writer.stream_row(mat.dense_row(w));
+        }
+        writer.end_stream();
+        shard.checksum = writer.stream_checksum();
+    } else {
+        CSVWriter writer;
+        writer.begin_stream(path, V);
+        for (int w = shard.first_keyword; w < shard.last_keyword; w++) {
+            if (mat.is_sparse()) writer.stream_row(mat.sparse_row(w).data(), mat.sparse_row(w).size());
+            else writer.stream_row(mat.dense_row(w));
+        }
+        writer.end_stream();
+        shard.checksum = writer.stream_checksum();
+    }
+
+    shard.rows = shard.last_keyword - shard.first_keyword;
+    shard.bytes = std::filesystem::file_size(path);
+}
+
+// Each shard is written sequentially by one thread; the shards themselves are written concurrently
+std::vector<ShardInfo> ShardedMatrixWriter::write(const KeywordDistanceMatrix& mat) {
+    std::filesystem::create_directories(directory);
+
+    std::vector<int> bounds = plan_shards(mat);
+    const int n = bounds.size() - 1;
+    std::vector<ShardInfo> shards(n);
+    std::vector<std::string> errors(n);
+
+    #pragma omp parallel for num_threads(get_num_threads()) schedule(dynamic)
+    for (int s = 0; s < n; s++) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "-%05d-of-%05d.%s", s, n, binary ? "bin" : "csv");
+        shards[s].file = prefix + name;
+        shards[s].first_keyword = bounds[s];
+        shards[s].last_keyword = bounds[s + 1];
+
+        try {
+            write_shard(mat, shards[s]);
+        } catch (const std::exception& e) {
+            errors[s] = e.what();
+        }
+    }
+
+    for (const std::string& error : errors) {
+        if (!error.empty()) throw std::runtime_error(error);
+    }
+
+    write_manifest(mat, shards);
+    return shards;
+}
+
+void ShardedMatrixWriter::write_manifest(const KeywordDistanceMatrix& mat, const std::vector<ShardInfo>& shards) const {
+    const char* dtype_names[] = {"", "int32", "varint", "varint_zstd"};
+    Pair p = mat.get_size();
+
+    std::string path = manifest_path();
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Unable to create file " + path);
+    }
+
+    out << "{\n"
+        << "  \"format\": \"" << (binary ? "binary" : "csv") << "\",\n"
+        << "  \"dtype\": \"" << (binary ? dtype_names[dtype] : "text") << "\",\n"
+        << "  \"layout\": \"" << (mat.is_sparse() ? "sparse" : "dense") << "\",\n"
+        << "  \"keywords\": " << p.pred << ",\n"
+        << "  \"vertices\": " << p.dist << ",\n"
+        << "  \"max_radius\": " << mat.get_max_radius() << ",\n"
+        << "  \"shards\": [\n";
+
+    for (size_t s = 0; s < shards.size(); s++) {
+        char checksum[19];
+        std::snprintf(checksum, sizeof(checksum), "0x%016llx", (unsigned long long)shards[s].checksum);
+        out << "    {\"file\": " << json_string(shards[s].file)
+            << ", \"first_keyword\": " << shards[s].first_keyword
+            << ", \"last_keyword\": " << shards[s].last_keyword
+            << ", \"rows\": " << shards[s].rows
+            << ", \"bytes\": " << shards[s].bytes
+            << ", \"checksum\": \"" << checksum << "\"}"
+            << (s + 1 < shards.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+
+    if (!out) {
+        throw std::runtime_error("Unable to write to file " + path);
+    }
+    std::cout << "Successfully wrote " << path << " with " << shards.size() << " shards" << std::endl;
+}
@@ -0,0 +1,51 @@
+#ifndef EVA_SHARDED_WRITER
+#define EVA_SHARDED_WRITER
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "keyword_distance_matrix.hpp"
+#include "binary_matrix.hpp"
+
+//! One output file of a sharded matrix, holding keyword rows [first_keyword, last_keyword)
+struct ShardInfo {
+    std::string file;           //!< File name relative to the manifest
+    int         first_keyword;
+    int         last_keyword;
+    long        rows;
+    uint64_t    bytes;
+    uint64_t    checksum;       //!< Binary header checksum, or fnv1a64 over the hash_block() of every CSV line
+};
+
+/*! Writes a matrix as several files that downstream workers can ingest in parallel. Rows are split into
+ * contiguous keyword ranges, either a fixed number of equal ranges or ranges of roughly a target size,
+ * and the shards are written concurrently. Every binary shard is a complete matrix file of its own rows.
+ * Next to the shards goes <prefix>.manifest.json listing the shards with their keyword ranges, row counts,
+ * sizes and checksums. Shard files are named <prefix>-<index>-of-<count>.<csv|bin>.
+ */
+class ShardedMatrixWriter {
+public:
+    ShardedMatrixWriter(std::string directory, std::string prefix = "keyword_distance_matrix");
+
+    std::vector<ShardInfo> write(const KeywordDistanceMatrix& matrix);
+
+    void set_shard_count(int n)                    { shard_count = n;            } //!< Equal keyword ranges
+    void set_target_shard_bytes(uint64_t bytes)    { target_shard_bytes = bytes; } //!< Overrides the shard count when > 0, sizes are estimated
+    void set_binary(bool b, BinaryMatrixDtype d = DTYPE_INT32) { binary = b; dtype = d; }
+
+    std::string manifest_path() const;
+
+private:
+    std::vector<int> plan_shards(const KeywordDistanceMatrix& matrix) const;
+    void write_shard(const KeywordDistanceMatrix& matrix, ShardInfo& shard) const;
+    void write_manifest(const KeywordDistanceMatrix& matrix, const std::vector<ShardInfo>& shards) const;
+
+    std::string       directory;
+    std::string       prefix;
+    int               shard_count = 1;
+    uint64_t          target_shard_bytes = 0;
+    bool              binary = false;
+    BinaryMatrixDtype dtype = DTYPE_INT32;
+};
+
+#endif
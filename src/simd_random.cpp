@@ -17,10 +17,11 @@ CachedPhiloxAVX2::CachedPhiloxAVX2(uint64_t seed) {
 }
 
 uint32_t CachedPhiloxAVX2::operator()() {
+    // Refilled in place: a background refill raced with the reads below, so the same seed did not give the same
+    // sequence, and cached graphs are only reusable if it does
     if (cursor >= cache_size - 1) { 
         cursor = 0;
-        std::thread thread(generateTable, std::ref(counter), std::ref(keys[0]), std::ref(keys[1]), std::ref(cache), cache_size);
-        thread.detach();
+        generateTable(counter, keys[0], keys[1], cache, cache_size);
     }
     return cache[cursor++];
 }
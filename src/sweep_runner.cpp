@@ -0,0 +1,305 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include "sweep_runner.hpp"
+#include "graph_generator.hpp"
+#include "csr_graph.hpp"
+#include "keyword_distance_matrix.hpp"
+#include "csv_writer.hpp"
+#include "binary_matrix.hpp"
+#include "thread_config.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+
+static std::string trim(const std::string& s) {
+    size_t first = s.find_first_not_of(" \t\r");
+    if (first == std::string::npos) return "";
+    size_t last = s.find_last_not_of(" \t\r");
+    return s.substr(first, last - first + 1);
+}
+
+static long long parse_number(const std::string& text, const std::string& where) {
+    size_t used = 0;
+    long long n = 0;
+    try {
+        n = std::stoll(text, &used);
+    } catch (const std::exception&) {
+        used = 0;
+    }
+    if (used == 0 || used != text.size() || n < 0) {
+        throw std::runtime_error("Invalid number '" + text + "' " + where);
+    }
+    return n;
+}
+
+// A comma separated list of numbers and inclusive first:last[:step] ranges
+static std::vector<long long> parse_values(const std::string& text, const std::string& where) {
+    std::vector<long long> values;
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        item = trim(item);
+        std::vector<long long> range;
+        std::stringstream parts(item);
+        std::string part;
+        while (std::getline(parts, part, ':')) {
+            range.push_back(parse_number(trim(part), where));
+        }
+
+        if (range.size() == 1) {
+            values.push_back(range[0]);
+        } else if (range.size() == 2 || range.size() == 3) {
+            long long step = range.size() == 3 ? range[2] : 1;
+            if (step <= 0 || range[0] > range[1]) {
+                throw std::runtime_error("Invalid range '" + item + "' " + where);
+            }
+            for (long long v = range[0]; v <= range[1]; v += step) values.push_back(v);
+        } else {
+            throw std::runtime_error("Invalid value '" + item + "' " + where);
+        }
+    }
+
+    if (values.empty()) {
+        throw std::runtime_error("No values " + where);
+    }
+    return values;
+}
+
+static std::vector<int> to_ints(const std::vector<long long>& values, const std::string& where) {
+    std::vector<int> ints;
+    for (long long v : values) {
+        if (v > 0x7FFFFFFF) throw std::runtime_error("Value " + std::to_string(v) + " too large " + where);
+        ints.push_back((int)v);
+    }
+    return ints;
+}
+
+SweepSpec::SweepSpec() {
+    GraphParameters p;
+    vertices = {p.n_vertices};
+    keywords = {p.n_keywords};
+    min_degree = {p.min_degree};
+    max_degree = {p.max_degree};
+    min_keywords = {p.min_keywords};
+    max_keywords = {p.max_keywords};
+    min_weight = {p.min_weight};
+    max_weight = {p.max_weight};
+    seeds = {1};
+}
+
+SweepSpec SweepSpec::parse(std::string filepath) {
+    std::ifstream file(filepath);
+    if (!file) {
+        throw std::runtime_error("Unable to open sweep spec " + filepath);
+    }
+
+    SweepSpec spec;
+    std::vector<int>* lists[8] = {&spec.vertices, &spec.keywords, &spec.min_degree, &spec.max_degree,
+                                  &spec.min_keywords, &spec.max_keywords, &spec.min_weight, &spec.max_weight};
+    const char* names[8] = {"vertices", "keywords", "min_degree", "max_degree", "min_keywords", "max_keywords", "min_weight", "max_weight"};
+
+    std::string line;
+    for (int line_number = 1; std::getline(file, line); line_number++) {
+        line = trim(line);
+        if (line.empty() || line[0] == '#') continue;
+
+        std::string where = "on line " + std::to_string(line_number) + " of " + filepath;
+        size_t equals = line.find('=');
+        if (equals == std::string::npos) {
+            throw std::runtime_error("Expected name = values " + where);
+        }
+        std::string name = trim(line.substr(0, equals));
+        std::string value = trim(line.substr(equals + 1));
+
+        int list = std::find(names, names + 8, name) - names;
+        if (list < 8) {
+            *lists[list] = to_ints(parse_values(value, where), where);
+        } else if (name == "seeds") {
+            std::vector<long long> seeds = parse_values(value, where);
+            if (*std::max_element(seeds.begin(), seeds.end()) > 0xFFFFFFFFLL) throw std::runtime_error("Seeds must fit in 32 bits " + where);
+            spec.seeds.assign(seeds.begin(), seeds.end());
+        } else if (name == "engine") {
+            if (value == "cpu") spec.matrix.engine = ENGINE_CPU;
+            else if (value == "approx") spec.matrix.engine = ENGINE_APPROX;
+            else throw std::runtime_error("Unknown engine '" + value + "' " + where);
+        } else if (name == "landmarks") {
+            spec.matrix.n_landmarks = to_ints({parse_number(value, where)}, where)[0];
+        } else if (name == "radius") {
+            spec.matrix.max_radius = to_ints({parse_number(value, where)}, where)[0];
+        } else if (name == "output") {
+            if (value != "none" && value != "csv" && value != "bin") throw std::runtime_error("Unknown output '" + value + "' " + where);
+            spec.output = value;
+        } else if (name == "output_dir") {
+            spec.output_directory = value;
+        } else {
+            throw std::runtime_error("Unknown setting '" + name + "' " + where);
+        }
+    }
+
+    if (spec.matrix.engine == ENGINE_APPROX && spec.matrix.n_landmarks <= 0) {
+        throw std::runtime_error("The approx engine needs landmarks > 0 in " + filepath);
+    }
+    return spec;
+}
+
+std::vector<SweepJob> SweepSpec::jobs() const {
+    std::vector<SweepJob> jobs;
+    GraphParameters p;
+    for (int v : vertices) for (int k : keywords)
+    for (int d0 : min_degree) for (int d1 : max_degree)
+    for (int k0 : min_keywords) for (int k1 : max_keywords)
+    for (int w0 : min_weight) for (int w1 : max_weight) {
+        if (v <= 0 || k <= 0 || d0 > d1 || k0 > k1 || w0 > w1) continue;
+        p.n_vertices = v;
+        p.n_keywords = k;
+        p.min_degree = d0;
+        p.max_degree = d1;
+        p.min_keywords = k0;
+        p.max_keywords = k1;
+        p.min_weight = w0;
+        p.max_weight = w1;
+        for (uint64_t seed : seeds) {
+            jobs.push_back({(int)jobs.size(), p, seed});
+        }
+    }
+    return jobs;
+}
+
+SweepRunner::SweepRunner(int threads) {
+    n_threads = std::max(1, threads);
+}
+
+// Generation is serial, so a run only earns extra threads for its matrix and write phases, in proportion to the matrix size
+int SweepRunner::threads_for(const SweepJob& job) const {
+    double cells = (double)job.params.n_vertices * job.params.n_keywords;
+    return std::clamp((int)std::ceil(cells / SWEEP_CELLS_PER_THREAD), 1, n_threads);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Runs on one thread of the pool and only takes its share for the parallel phases. The thread is lent out
+// while the run waits for its memory, so a run blocked on the gate keeps no core idle
+void SweepRunner::run_job(const SweepSpec& spec, SweepResult& result, ThreadPool& pool, MemoryGate* gate) const {
+    TRACE_ZONE("SweepRunner::run_job");
+    const GraphParameters& p = result.job.params;
+    const uint64_t seed = result.job.seed;
+    result.threads = threads_for(result.job);
+
+    bool stream = false;
+    MemoryEstimate estimate = fit_memory_budget(p, spec.matrix, result.threads, memory_budget, stream, false, true, spec.output != "none");
+    result.estimated_bytes = estimate.peak;
+    std::unique_ptr<MemoryReservation> reservation;
+    if (gate) {
+        ThreadShare waiting(pool, 0);
+        reservation = std::make_unique<MemoryReservation>(*gate, estimate.peak);
+    }
+
+    std::unique_ptr<GraphCache> cache;
+    if (!cache_directory.empty()) cache = std::make_unique<GraphCache>(cache_directory, cache_bytes);
+
+    auto start = std::chrono::steady_clock::now();
+    CSRGraph<int> csr;
+    std::unique_ptr<GraphSnapshotReader> stored_graph;
+    if (cache) stored_graph = cache->find_graph(p, seed);
+
+    if (stored_graph) {
+        csr = stored_graph->to_csr();
+        result.graph_cached = true;
+    } else {
+        GraphGenerator<int> gen(seed, 5, 5);
+        SparseGraph<int>* graph = gen.generate(p.n_vertices, p.n_keywords, p.min_keywords, p.max_keywords, p.min_degree, p.max_degree, p.min_weight, p.max_weight);
+        csr = CSRGraph<int>(*graph, p.n_keywords);
+        delete graph;
+        if (cache) cache->store_graph(csr, p, seed);
+    }
+    result.edges = csr.n_edges();
+    result.generate_seconds = seconds_since(start);
+
+    ThreadShare share(pool, result.threads);
+    auto matrix_start = std::chrono::steady_clock::now();
+    KeywordDistanceMatrix mat(p.n_keywords, p.n_vertices, p.max_weight, spec.matrix.max_radius);
+    std::unique_ptr<BinaryMatrixReader> stored_matrix;
+    if (cache) stored_matrix = cache->find_matrix(p, seed, spec.matrix);
+
+    if (stored_matrix) {
+        mat.load_matrix(*stored_matrix);
+        result.matrix_cached = true;
+    } else {
+        if (spec.matrix.engine == ENGINE_APPROX) mat.calculate_matrix_approx(csr, spec.matrix.n_landmarks);
+        else mat.calculate_matrix_cpu(csr);
+        if (cache) cache->store_matrix(mat, p, seed, spec.matrix);
+    }
+    result.matrix_seconds = seconds_since(matrix_start);
+
+    if (spec.output != "none") {
+        auto write_start = std::chrono::steady_clock::now();
+        std::string name = "run-" + std::to_string(result.job.index) + "." + spec.output;
+        result.output = (std::filesystem::path(spec.output_directory) / name).string();
+        if (spec.output == "bin") BinaryMatrixWriter().write(result.output, mat);
+        else CSVWriter().write(result.output, mat);
+        result.write_seconds = seconds_since(write_start);
+    }
+
+    result.total_seconds = seconds_since(start);
+}
+
+std::vector<SweepResult> SweepRunner::run(const SweepSpec& spec) {
+    std::vector<SweepJob> jobs = spec.jobs();
+    std::vector<SweepResult> results(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++) results[i].job = jobs[i];
+
+    if (spec.output != "none") {
+        std::filesystem::create_directories(spec.output_directory);
+    }
+
+    std::vector<int> order(jobs.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    auto cells = [&](int i) { return (double)jobs[i].params.n_vertices * jobs[i].params.n_keywords; };
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return cells(a) > cells(b); });
+
+    // A failing run is recorded in its result and does not stop the others
+    std::unique_ptr<MemoryGate> gate;
+    if (memory_budget) gate = std::make_unique<MemoryGate>(memory_budget);
+    ThreadPool pool(n_threads);
+    for (int i : order) {
+        pool.submit(1, [this, &spec, &results, &pool, &gate, i] {
+            try {
+                run_job(spec, results[i], pool, gate.get());
+            } catch (const std::exception& e) {
+                results[i].error = e.what();
+            }
+        });
+    }
+    pool.wait();
+
+    return results;
+}
+
+static std::string csv_field(const std::string& s) {
+    if (s.find_first_of(",\"\n") == std::string::npos) return s;
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"') out += '"';
+        out += c;
+    }
+    return out + "\"";
+}
+
+void SweepRunner::write_results(std::ostream& os, const std::vector<SweepResult>& results) {
+    os << "run,vertices,keywords,min_degree,max_degree,min_keywords,max_keywords,min_weight,max_weight,seed,"
+       << "threads,estimated_mb,edges,generate_s,matrix_s,write_s,total_s,graph_cached,matrix_cached,output,error\n";
+    for (const SweepResult& r : results) {
+        const GraphParameters& p = r.job.params;
+        os << r.job.index << ',' << p.n_vertices << ',' << p.n_keywords << ',' << p.min_degree << ',' << p.max_degree << ','
+           << p.min_keywords << ',' << p.max_keywords << ',' << p.min_weight << ',' << p.max_weight << ',' << r.job.seed << ','
+           << r.threads << ',' << r.estimated_bytes / 1048576.0 << ',' << r.edges << ',' << r.generate_seconds << ',' << r.matrix_seconds << ',' << r.write_seconds << ','
+           << r.total_seconds << ',' << r.graph_cached << ',' << r.matrix_cached << ',' << csv_field(r.output) << ',' << csv_field(r.error) << '\n';
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef EVA_SWEEP_RUNNER
+#define EVA_SWEEP_RUNNER
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "graph.hpp"
+#include "graph_cache.hpp"
+#include "memory_budget.hpp"
+#include "thread_pool.hpp"
+
+const double SWEEP_CELLS_PER_THREAD = 4e6;  //!< Matrix cells that justify one more thread for a run
+
+//! One generate -> matrix -> write run of a sweep
+struct SweepJob {
+    int             index;
+    GraphParameters params;
+    uint64_t        seed;
+};
+
+struct SweepResult {
+    SweepJob    job;
+    int         threads = 0;            //!< Share of the pool the matrix and write phases got
+    long        edges = 0;
+    double      generate_seconds = 0;
+    double      matrix_seconds = 0;
+    double      write_seconds = 0;
+    double      total_seconds = 0;      //!< Wall time from start to finish of the run
+    bool        graph_cached = false;
+    bool        matrix_cached = false;
+    uint64_t    estimated_bytes = 0;    //!< Predicted peak memory of the run
+    std::string output;                 //!< Matrix file written, empty without output
+    std::string error;                  //!< Empty if the run succeeded
+};
+
+/*! A sweep spec is a text file of `name = values` lines, where values is a comma separated list of numbers
+ * and inclusive ranges `first:last` or `first:last:step`. Graph parameters are vertices, keywords,
+ * min_degree, max_degree, min_keywords, max_keywords, min_weight and max_weight; seeds lists the seeds.
+ * Every combination of the lists is one run, combinations where a minimum exceeds its maximum are skipped.
+ * The matrix is set with engine (cpu or approx), landmarks and radius, the output with output (none, csv
+ * or bin) and output_dir. Lines starting with # are comments.
+ */
+struct SweepSpec {
+    std::vector<int>      vertices;
+    std::vector<int>      keywords;
+    std::vector<int>      min_degree;
+    std::vector<int>      max_degree;
+    std::vector<int>      min_keywords;
+    std::vector<int>      max_keywords;
+    std::vector<int>      min_weight;
+    std::vector<int>      max_weight;
+    std::vector<uint64_t> seeds;
+    MatrixOptions         matrix;
+    std::string           output = "none";
+    std::string           output_directory = ".";
+
+    SweepSpec();
+    static SweepSpec parse(std::string filepath);
+    std::vector<SweepJob> jobs() const;
+};
+
+/*! Runs every job of a sweep on one shared ThreadPool instead of one process per run. A run generates its
+ * graph on a single thread and only then takes a share of the pool that grows with its matrix size for the
+ * matrix and write phases. The runs are started largest first and smaller ones fill the threads the running
+ * ones leave free, so the serial generation phase of one run overlaps the parallel matrix phase of another.
+ */
+class SweepRunner {
+public:
+    SweepRunner(int n_threads);
+
+    void set_cache(std::string directory, uint64_t max_bytes) { cache_directory = directory; cache_bytes = max_bytes; } //!< Share graphs and matrices between runs and sweeps
+    void set_memory_budget(uint64_t bytes)                    { memory_budget = bytes; } //!< Runs that fit start only while the running ones leave room, larger runs fail up front. 0 = no budget
+
+    std::vector<SweepResult> run(const SweepSpec& spec);            //!< Results in job order
+    static void write_results(std::ostream& os, const std::vector<SweepResult>& results); //!< CSV table, one line per run
+
+private:
+    int  threads_for(const SweepJob& job) const;
+    void run_job(const SweepSpec& spec, SweepResult& result, ThreadPool& pool, MemoryGate* gate) const;
+
+    int         n_threads;
+    std::string cache_directory;        //!< Empty disables the cache
+    uint64_t    cache_bytes = GRAPH_CACHE_DEFAULT_BYTES;
+    uint64_t    memory_budget = 0;
+};
+
+#endif
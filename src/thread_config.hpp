@@ -0,0 +1,36 @@
+#ifndef EVA_THREAD_CONFIG
+#define EVA_THREAD_CONFIG
+
+#include <atomic>
+
+/*! Number of threads every OpenMP section of the matrix, loader and writer code runs with. It defaults
+ * to the 10 threads the code was tuned with and can be changed at any time, a section picks up the
+ * value when it starts. A thread can override the process-wide value for itself with ScopedThreadCount,
+ * which is how ThreadPool gives every task its own share of the cores.
+ */
+inline std::atomic<int>& thread_count_setting() {
+    static std::atomic<int> n(10);
+    return n;
+}
+
+inline int& thread_count_override() {
+    thread_local int n = 0;
+    return n;
+}
+
+inline int  get_num_threads()      { return thread_count_override() > 0 ? thread_count_override() : thread_count_setting().load(); }
+inline void set_num_threads(int n) { thread_count_setting() = n > 0 ? n : 1; }
+
+//! Overrides get_num_threads() on the calling thread until it goes out of scope
+class ScopedThreadCount {
+public:
+    ScopedThreadCount(int n) : previous(thread_count_override()) { thread_count_override() = n > 0 ? n : 1; }
+    ~ScopedThreadCount()                                          { thread_count_override() = previous;     }
+    ScopedThreadCount(const ScopedThreadCount&) = delete;
+    ScopedThreadCount& operator=(const ScopedThreadCount&) = delete;
+
+private:
+    int previous;
+};
+
+#endif
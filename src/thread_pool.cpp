@@ -0,0 +1,107 @@
+#include <algorithm>
+#include "thread_pool.hpp"
+#include <stdexcept>
+#include "thread_config.hpp"
+
+// The pool whose task the calling thread runs and the threads that task holds, for ThreadShare
+static thread_local ThreadPool* current_pool = nullptr;
+static thread_local int         held_threads = 0;
+
+ThreadPool::ThreadPool(int n) {
+    n_threads = std::max(1, n);
+    free_threads = n_threads;
+    running = 0;
+    stopping = false;
+
+    // One worker per thread of the budget, as that many single-threaded tasks may run side by side
+    for (int i = 0; i < n_threads; i++) {
+        workers.emplace_back(&ThreadPool::worker, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return pending.empty() && running == 0; });
+        stopping = true;
+    }
+    changed.notify_all();
+
+    for (std::thread& t : workers) {
+        t.join();
+    }
+}
+
+void ThreadPool::submit(int threads, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back({std::clamp(threads, 1, n_threads), std::move(task)});
+    }
+    changed.notify_all();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [&] { return pending.empty() && running == 0; });
+
+    if (error) {
+        std::exception_ptr e = error;
+        error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void ThreadPool::worker() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        std::deque<Task>::iterator next;
+        changed.wait(lock, [&] {
+            next = std::find_if(pending.begin(), pending.end(), [&](const Task& t) { return t.threads <= free_threads; });
+            return stopping || next != pending.end();
+        });
+        if (stopping) return;
+
+        Task task = std::move(*next);
+        pending.erase(next);
+        free_threads -= task.threads;
+        ++running;
+        lock.unlock();
+
+        try {
+            ScopedThreadCount scope(task.threads);
+            current_pool = this;
+            held_threads = task.threads;
+            task.run();
+        } catch (...) {
+            std::lock_guard<std::mutex> error_lock(mutex);
+            if (!error) error = std::current_exception();
+        }
+
+        current_pool = nullptr;
+        lock.lock();
+        free_threads += task.threads;
+        --running;
+        changed.notify_all();
+    }
+}
+
+void ThreadPool::exchange(int held, int threads) {
+    std::unique_lock<std::mutex> lock(mutex);
+    free_threads += held;
+    changed.notify_all();
+    changed.wait(lock, [&] { return threads <= free_threads; });
+    free_threads -= threads;
+}
+
+ThreadShare::ThreadShare(ThreadPool& p, int n) : pool(p), threads(std::clamp(n, 0, p.size())), previous(held_threads), scope(threads) {
+    if (current_pool != &pool) {
+        throw std::runtime_error("A thread share must be taken inside a task of its pool");
+    }
+    pool.exchange(previous, threads);
+    held_threads = threads;
+}
+
+ThreadShare::~ThreadShare() {
+    pool.exchange(threads, previous);
+    held_threads = previous;
+}
@@ -0,0 +1,72 @@
+#ifndef EVA_THREAD_POOL
+#define EVA_THREAD_POOL
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "thread_config.hpp"
+
+/*! Fixed set of worker threads that runs tasks which are themselves parallel. Every task asks for a number
+ * of threads and only starts once that many of the pool's threads are free; while it runs, OpenMP sections
+ * inside it use exactly that many threads (see ScopedThreadCount). Tasks start in submission order except
+ * that a task which fits may overtake one that does not, so submitting the largest tasks first lets small
+ * ones fill the cores a large one leaves idle. The total never exceeds the pool size. A task whose phases
+ * need different numbers of threads starts with one and takes a ThreadShare for its parallel phases.
+ */
+class ThreadPool {
+public:
+    ThreadPool(int n_threads);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void submit(int threads, std::function<void()> task);  //!< threads is clamped to [1, size()]
+    void wait();                                            //!< Blocks until every task finished, rethrows the first exception a task threw
+    int  size() const { return n_threads; }
+
+private:
+    friend class ThreadShare;
+
+    struct Task {
+        int                   threads;
+        std::function<void()> run;
+    };
+
+    void worker();
+    void exchange(int held, int threads);                   //!< Hands back held threads, then waits until threads are free and takes them
+
+    std::mutex               mutex;
+    std::condition_variable  changed;
+    std::deque<Task>         pending;
+    std::vector<std::thread> workers;
+    std::exception_ptr       error;
+    int                      n_threads;
+    int                      free_threads;
+    int                      running;
+    bool                     stopping;
+};
+
+/*! Changes the number of pool threads the calling task holds until it goes out of scope, e.g. to take
+ * more threads for a parallel phase than the serial phases around it need. The task's threads are handed
+ * back while it waits, so tasks blocked on a share never hold threads that another task could run on, and
+ * a share of 0 threads lends them out during a wait on something else. Must be taken inside a task of pool.
+ */
+class ThreadShare {
+public:
+    ThreadShare(ThreadPool& pool, int threads);             //!< threads is clamped to [0, pool.size()]
+    ~ThreadShare();
+    ThreadShare(const ThreadShare&) = delete;
+    ThreadShare& operator=(const ThreadShare&) = delete;
+
+private:
+    ThreadPool&       pool;
+    int               threads;
+    int               previous;
+    ScopedThreadCount scope;
+};
+
+#endif
@@ -0,0 +1,129 @@
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <unistd.h>
+#include "trace.hpp"
+
+std::atomic<bool> Trace::active(false);
+
+// Written only by its own thread. head counts every event ever recorded, the slot of an event is its count
+// modulo the capacity, so a reader knows how many were overwritten without talking to the writer
+struct TraceBuffer {
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t>   head{0};
+    std::atomic<uint64_t>   generation{0};     //!< Trace::start() call the events belong to
+    int                     tid;
+
+    TraceBuffer(int id) : events(TRACE_BUFFER_EVENTS), tid(id) {}
+};
+
+// Buffers are shared with the registry, so the events of threads that already exited still get written
+static std::mutex buffers_lock;
+static std::vector<std::shared_ptr<TraceBuffer>> buffers;
+static std::atomic<uint64_t> generation(0);
+static std::atomic<int64_t> epoch(0);                  //!< Steady clock nanoseconds at Trace::start()
+
+static TraceBuffer& thread_buffer() {
+    static thread_local std::shared_ptr<TraceBuffer> buffer;
+    if (!buffer) {
+        std::lock_guard<std::mutex> guard(buffers_lock);
+        buffer = std::make_shared<TraceBuffer>(buffers.size() + 1);
+        buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+static int64_t steady_nanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::start() {
+    active = false;
+    epoch = steady_nanoseconds();
+    generation++;
+    active = TRACE_COMPILED;
+}
+
+void Trace::stop() {
+    active = false;
+}
+
+uint64_t Trace::now() {
+    return steady_nanoseconds() - epoch.load(std::memory_order_relaxed);
+}
+
+void Trace::record(const char* name, uint64_t begin, uint64_t end) {
+    if (end < begin) return; // The zone straddled a restart of the trace
+    TraceBuffer& buffer = thread_buffer();
+
+    // A buffer left over from an earlier trace starts over instead of mixing two time bases
+    uint64_t current = generation.load(std::memory_order_relaxed);
+    if (buffer.generation.load(std::memory_order_relaxed) != current) {
+        buffer.head.store(0, std::memory_order_relaxed);
+        buffer.generation.store(current, std::memory_order_relaxed);
+    }
+
+    uint64_t h = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[h % TRACE_BUFFER_EVENTS] = {name, begin, end};
+    buffer.head.store(h + 1, std::memory_order_release);
+}
+
+static void write_name(std::ostream& os, const char* name) {
+    os << '"';
+    for (const char* c = name; *c; c++) {
+        if (*c == '"' || *c == '\\') os << '\\';
+        os << *c;
+    }
+    os << '"';
+}
+
+// Trace-event timestamps are in microseconds; three decimals keep the nanoseconds
+static void write_micros(std::ostream& os, uint64_t ns) {
+    os << ns / 1000 << '.' << std::setw(3) << std::setfill('0') << ns % 1000 << std::setfill(' ');
+}
+
+void Trace::write(std::string filepath) {
+    std::ofstream file(filepath);
+    if (!file) {
+        throw std::runtime_error("Unable to create file " + filepath);
+    }
+
+    int pid = getpid();
+    uint64_t current = generation.load();
+    uint64_t dropped = 0;
+    bool first = true;
+
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    std::lock_guard<std::mutex> guard(buffers_lock);
+    for (auto& buffer : buffers) {
+        if (buffer->generation.load() != current) continue;
+
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        uint64_t tail = head > TRACE_BUFFER_EVENTS ? head - TRACE_BUFFER_EVENTS : 0;
+        dropped += tail;
+
+        file << (first ? "" : ",\n") << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pid << ",\"tid\":" << buffer->tid
+             << ",\"args\":{\"name\":\"thread " << buffer->tid << "\"}}";
+        first = false;
+
+        for (uint64_t i = tail; i < head; i++) {
+            const TraceEvent& e = buffer->events[i % TRACE_BUFFER_EVENTS];
+            file << ",\n{\"ph\":\"X\",\"name\":";
+            write_name(file, e.name);
+            file << ",\"pid\":" << pid << ",\"tid\":" << buffer->tid << ",\"ts\":";
+            write_micros(file, e.begin);
+            file << ",\"dur\":";
+            write_micros(file, e.end - e.begin);
+            file << "}";
+        }
+    }
+    file << "\n],\"otherData\":{\"dropped_events\":" << dropped << "}}\n";
+
+    if (!file) {
+        throw std::runtime_error("Unable to write to file " + filepath);
+    }
+}
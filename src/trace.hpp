@@ -0,0 +1,68 @@
+#ifndef EVA_TRACE
+#define EVA_TRACE
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/*! Scoped timing zones exported as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+ *
+ *     void f() {
+ *         TRACE_FUNCTION();
+ *         for (...) { TRACE_ZONE("row"); ... }
+ *     }
+ *
+ * A zone records its begin and end into a ring buffer owned by the calling thread, so threads never share a
+ * cache line or a lock while tracing; only the first zone of a thread registers its buffer. Zones cost one
+ * relaxed load while no trace is being recorded, and nothing at all in builds without GRAPHGEN_TRACING,
+ * where the macros expand to nothing. Zone names must outlive the trace (string literals or __func__).
+ */
+
+const int TRACE_BUFFER_EVENTS = 1 << 16;    //!< Events kept per thread, older ones are overwritten
+
+struct TraceEvent {
+    const char* name;
+    uint64_t    begin;                      //!< Nanoseconds since Trace::start()
+    uint64_t    end;
+};
+
+class Trace {
+public:
+    static void start();                    //!< Drops what was recorded before and starts recording
+    static void stop();
+    static bool recording()                 { return active.load(std::memory_order_relaxed); }
+    static void write(std::string filepath);//!< Chrome trace-event JSON of everything recorded, call once the traced work is done
+
+    static uint64_t now();                  //!< Nanoseconds since start()
+    static void     record(const char* name, uint64_t begin, uint64_t end);
+
+private:
+    static std::atomic<bool> active;
+};
+
+//! Records the time from its construction to its destruction as one zone
+class TraceZone {
+public:
+    TraceZone(const char* n) : name(Trace::recording() ? n : nullptr), begin(name ? Trace::now() : 0) {}
+    ~TraceZone()                            { if (name) Trace::record(name, begin, Trace::now()); }
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+
+private:
+    const char* name;                       //!< nullptr if the zone started while not recording
+    uint64_t    begin;
+};
+
+#ifdef GRAPHGEN_TRACING
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+#define TRACE_FUNCTION() TRACE_ZONE(__func__)
+const bool TRACE_COMPILED = true;
+#else
+#define TRACE_ZONE(name)
+#define TRACE_FUNCTION()
+const bool TRACE_COMPILED = false;          //!< Trace::start() records nothing in this build
+#endif
+
+#endif
@@ -0,0 +1,37 @@
+#include "test_util.hpp"
+#include "keyword_distance_matrix.hpp"
+
+// calculate_matrix_approx against the exact engine: every finite cell is an upper bound, the bounded
+// search makes small graphs exact, and cells missed without it are reported as unresolved
+
+int main() {
+    const int V = 2000, W = 20;
+    CSRGraph<int> graph = test_graph(V, W, 3, 11);
+    KeywordDistanceMatrix exact(W, V, 10);
+    exact.calculate_matrix_cpu(graph);
+
+    for (int budget : {0, 1024, 4096}) {
+        KeywordDistanceMatrix approx(W, V, 10);
+        approx.set_approx_search_budget(budget);
+        ApproximationReport bounds = approx.calculate_matrix_approx(graph, 8);
+        ApproximationReport report = approx.validate_approximation(exact);
+
+        for (int w = 0; w < W; w++) {
+            for (int v = 0; v < V; v++) {
+                CHECK(approx(w, v).dist >= exact(w, v).dist);
+            }
+        }
+        CHECK(report.missed_cells <= bounds.unresolved_cells);
+        if (bounds.unresolved_cells) CHECK_EQ(bounds.max_relative_gap, 1.0);
+
+        if (budget >= V) {
+            CHECK_EQ(report.missed_cells, 0L);
+            CHECK_EQ(report.max_relative_error, 0.0);
+            CHECK_EQ(bounds.exact_cells, bounds.finite_cells);
+        } else if (budget > 0) {
+            CHECK(report.mean_relative_error < 0.3);
+        }
+    }
+
+    return test_result("approximation");
+}
@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <unistd.h>
+#include "test_util.hpp"
+#include "binary_matrix.hpp"
+#include "keyword_distance_matrix.hpp"
+
+// BinaryMatrixReader reads back what the writer wrote and rejects dense headers whose rows would reach
+// past the mapping
+
+static std::string scratch(const std::string& name) {
+    return (std::filesystem::temp_directory_path() / ("test_binary_matrix_" + std::to_string(getpid()) + "_" + name)).string();
+}
+
+static bool rejected(const std::string& path) {
+    try {
+        BinaryMatrixReader reader(path);
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+// Copy of the file at path with its header changed by corrupt
+static std::string corrupted(const std::string& path, const std::string& name, std::function<void(BinaryMatrixHeader&)> corrupt) {
+    std::ifstream in(path, std::ios::binary);
+    std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    BinaryMatrixHeader header;
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    corrupt(header);
+    std::memcpy(&bytes[0], &header, sizeof(header));
+
+    std::string copy = scratch(name);
+    std::ofstream out(copy, std::ios::binary);
+    out.write(bytes.data(), bytes.size());
+    return copy;
+}
+
+int main() {
+    const int V = 500, W = 8;
+    CSRGraph<int> graph = test_graph(V, W, 3, 3);
+    KeywordDistanceMatrix mat(W, V, 10);
+    mat.calculate_matrix_cpu(graph);
+    std::string path = scratch("dense.bin");
+    BinaryMatrixWriter(DTYPE_INT32).write(path, mat);
+
+    {
+        BinaryMatrixReader reader(path);
+        for (int w = 0; w < W; w++) {
+            for (int v = 0; v < V; v++) {
+                CHECK_EQ(reader(w, v).dist, mat(w, v).dist);
+                CHECK_EQ(reader(w, v).pred, mat(w, v).pred);
+            }
+        }
+    }
+
+    std::vector<std::string> bad = {
+        corrupted(path, "stride0.bin", [](BinaryMatrixHeader& h) { h.row_stride = 0; h.V = 1 << 20; }),
+        corrupted(path, "short_stride.bin", [](BinaryMatrixHeader& h) { h.row_stride = h.V * sizeof(int32_t); }),
+        corrupted(path, "offset0.bin", [](BinaryMatrixHeader& h) { h.data_offset = 0; }),
+        corrupted(path, "rows.bin", [](BinaryMatrixHeader& h) { h.W += 1; }),
+        corrupted(path, "overflow.bin", [](BinaryMatrixHeader& h) { h.W = 1ULL << 62; }),
+    };
+    for (const std::string& file : bad) {
+        CHECK(rejected(file));
+        std::remove(file.c_str());
+    }
+    std::remove(path.c_str());
+
+    return test_result("binary_matrix");
+}
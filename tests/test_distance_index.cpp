@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <queue>
+#include <unistd.h>
+#include "test_util.hpp"
+#include "distance_index.hpp"
+#include "keyword_distance_matrix.hpp"
+
+// PrunedLandmarkLabeling and ALTIndex against Dijkstra and the exact matrix engine
+
+static std::vector<int> dijkstra(const CSRGraph<int>& graph, int s) {
+    std::vector<int> dist(graph.n_vertices, BIG_NUMBER);
+    std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<std::pair<int, int>>> heap;
+    dist[s] = 0;
+    heap.push({0, s});
+    while (!heap.empty()) {
+        auto [d, v] = heap.top();
+        heap.pop();
+        if (d > dist[v]) continue;
+        for (int e = graph.edges_begin(v); e < graph.edges_end(v); e++) {
+            int u = graph.targets[e];
+            if (d + graph.weights[e] < dist[u]) {
+                dist[u] = d + graph.weights[e];
+                heap.push({dist[u], u});
+            }
+        }
+    }
+    return dist;
+}
+
+int main() {
+    const int V = 400, W = 12;
+    CSRGraph<int> graph = test_graph(V, W, 3, 7);
+    std::string scratch = (std::filesystem::temp_directory_path() / ("test_distance_index_" + std::to_string(getpid()))).string();
+
+    PrunedLandmarkLabeling pll;
+    pll.build(graph);
+    pll.build_keyword_labels(graph);
+    pll.save(scratch);
+    PrunedLandmarkLabeling loaded;
+    loaded.load(scratch);
+    std::remove(scratch.c_str());
+
+    ALTIndex alt;
+    alt.build(graph, 8);
+    alt.save(scratch);
+    ALTIndex alt_loaded;
+    alt_loaded.load(scratch);
+    std::remove(scratch.c_str());
+
+    for (int s = 0; s < V; s += 7) {
+        std::vector<int> exact = dijkstra(graph, s);
+        for (int t = 0; t < V; t++) {
+            CHECK_EQ(pll.query(s, t), exact[t]);
+            CHECK_EQ(loaded.query(s, t), exact[t]);
+            CHECK_EQ(alt.query(graph, s, t), exact[t]);
+            CHECK(alt.estimate(s, t) >= exact[t]);
+            CHECK(alt.lower_bound(s, t) <= exact[t]);
+            CHECK_EQ(alt_loaded.estimate(s, t), alt.estimate(s, t));
+        }
+    }
+
+    KeywordDistanceMatrix mat(W, V, 10);
+    mat.calculate_matrix_cpu(graph);
+    CHECK_EQ(loaded.n_keywords(), W);
+    for (int w = 0; w < W; w++) {
+        for (int v = 0; v < V; v++) {
+            CHECK_EQ(pll.keyword_distance(w, v), mat(w, v).dist);
+            CHECK_EQ(loaded.keyword_distance(w, v), mat(w, v).dist);
+        }
+    }
+
+    return test_result("distance_index");
+}
@@ -0,0 +1,50 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+#include "test_util.hpp"
+#include "graph_snapshot.hpp"
+#include "keyword_distance_matrix.hpp"
+
+// The in-place view of a snapshot against its heap copy: same arrays, and the exact engine computes the
+// same dense and sparse matrices on both
+
+int main() {
+    const int V = 1500, W = 12;
+    CSRGraph<int> graph = test_graph(V, W, 3, 5);
+    GraphParameters params;
+    params.n_vertices = V;
+    params.n_keywords = W;
+    std::string path = (std::filesystem::temp_directory_path() / ("test_graph_snapshot_" + std::to_string(getpid()) + ".snap")).string();
+    GraphSnapshotWriter().write(path, graph, params, 5);
+
+    {
+        GraphSnapshotReader reader(path);
+        CSRView<int> view = reader.view();
+        CSRGraph<int> copy = reader.to_csr();
+        CHECK_EQ(view.n_vertices, V);
+        CHECK_EQ(view.n_keywords, W);
+        CHECK_EQ(view.n_edges(), graph.n_edges());
+        CHECK(std::equal(graph.offsets.begin(), graph.offsets.end(), view.offsets));
+        CHECK(std::equal(graph.targets.begin(), graph.targets.end(), view.targets));
+        CHECK(std::equal(graph.weights.begin(), graph.weights.end(), view.weights));
+        CHECK(std::equal(graph.keyword_offsets.begin(), graph.keyword_offsets.end(), view.keyword_offsets));
+        CHECK(std::equal(graph.keyword_vertices.begin(), graph.keyword_vertices.end(), view.keyword_vertices));
+
+        for (int radius : {0, 15}) {
+            KeywordDistanceMatrix from_view(W, V, 10, radius), from_copy(W, V, 10, radius);
+            from_view.calculate_matrix_cpu(view);
+            from_copy.calculate_matrix_cpu(copy);
+            for (int w = 0; w < W; w++) {
+                for (int v = 0; v < V; v++) {
+                    CHECK_EQ(from_view(w, v).dist, from_copy(w, v).dist);
+                    CHECK_EQ(from_view(w, v).pred, from_copy(w, v).pred);
+                }
+            }
+        }
+    }
+    std::remove(path.c_str());
+
+    return test_result("graph_snapshot");
+}
@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <unistd.h>
+#include "test_util.hpp"
+#include "keyword_search.hpp"
+
+// Threshold-algorithm and SIMD-scan keyword search on every kind of matrix against a brute-force sum of
+// distances, and the result trees against the graph
+
+static std::vector<std::pair<long, int>> brute_force(const KeywordDistanceMatrix& exact, const std::vector<int>& keywords, int k, int radius) {
+    std::vector<std::pair<long, int>> costs;
+    for (int v = 0; v < exact.get_size().dist; v++) {
+        long cost = 0;
+        bool reachable = true;
+        for (int w : keywords) {
+            int d = exact(w, v).dist;
+            if (d == BIG_NUMBER || (radius > 0 && d > radius)) reachable = false;
+            cost += d;
+        }
+        if (reachable) costs.push_back({cost, v});
+    }
+    std::sort(costs.begin(), costs.end());
+    if ((int)costs.size() > k) costs.resize(k);
+    return costs;
+}
+
+static bool has_edge(const CSRGraph<int>& graph, int a, int b) {
+    for (int e = graph.edges_begin(a); e < graph.edges_end(a); e++) {
+        if (graph.targets[e] == b) return true;
+    }
+    return false;
+}
+
+static void check_engine(const KeywordSearchEngine& engine, const KeywordDistanceMatrix& exact, const CSRGraph<int>& graph, int radius) {
+    std::mt19937 rng(3);
+    const int W = exact.get_size().pred;
+    std::vector<std::vector<int>> batch;
+    size_t answered = 0;
+
+    for (int trial = 0; trial < 60; trial++) {
+        std::vector<int> keywords(1 + trial % 4);
+        for (int& w : keywords) w = rng() % W;
+        int k = 1 + trial % 10;
+        std::vector<std::pair<long, int>> expected = brute_force(exact, keywords, k, radius);
+
+        for (bool scan : {false, true}) {
+            std::vector<SearchResult> found = scan ? engine.query_scan(keywords, k) : engine.query(keywords, k);
+            CHECK_EQ(found.size(), expected.size());
+            answered += found.size();
+            for (size_t i = 0; i < std::min(found.size(), expected.size()); i++) {
+                CHECK_EQ(found[i].cost, expected[i].first);
+                CHECK_EQ(found[i].root, expected[i].second);
+                for (const VerboseEdge<int>& e : found[i].tree) CHECK(has_edge(graph, e.start, e.end));
+            }
+        }
+        batch.push_back(keywords);
+    }
+
+    CHECK(answered > 100);
+
+    std::vector<std::vector<SearchResult>> results;
+    BatchStats stats = engine.query_batch(batch, 5, results);
+    CHECK_EQ(stats.queries, (long)batch.size());
+    for (size_t i = 0; i < batch.size(); i++) {
+        std::vector<std::pair<long, int>> expected = brute_force(exact, batch[i], 5, radius);
+        CHECK_EQ(results[i].size(), expected.size());
+        if (!results[i].empty() && !expected.empty()) CHECK_EQ(results[i][0].cost, expected[0].first);
+    }
+}
+
+int main() {
+    const int V = 1203, W = 16, radius = 12; // V not a multiple of 8 to reach the scalar tails
+    CSRGraph<int> graph = test_graph(V, W, 3, 5);
+    std::string scratch = (std::filesystem::temp_directory_path() / ("test_keyword_search_" + std::to_string(getpid()))).string();
+
+    KeywordDistanceMatrix dense(W, V, 10);
+    dense.calculate_matrix_cpu(graph);
+    KeywordDistanceMatrix sparse(W, V, 10, radius);
+    sparse.calculate_matrix_cpu(graph);
+
+    check_engine(KeywordSearchEngine(dense), dense, graph, 0);
+    check_engine(KeywordSearchEngine(sparse), dense, graph, radius);
+
+    BinaryMatrixWriter(DTYPE_INT32).write(scratch, dense);
+    {
+        BinaryMatrixReader file(scratch);
+        check_engine(KeywordSearchEngine(file), dense, graph, 0);
+    }
+    BinaryMatrixWriter(DTYPE_INT32).write(scratch, sparse);
+    {
+        BinaryMatrixReader file(scratch);
+        check_engine(KeywordSearchEngine(file), dense, graph, radius);
+    }
+    BinaryMatrixWriter(DTYPE_VARINT).write(scratch, dense);
+    {
+        BinaryMatrixReader file(scratch);
+        bool thrown = false;
+        try {
+            KeywordSearchEngine engine(file);
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+    std::remove(scratch.c_str());
+
+    return test_result("keyword_search");
+}
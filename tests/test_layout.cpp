@@ -0,0 +1,95 @@
+#include <cmath>
+#include <map>
+#include <random>
+#include <vector>
+#include "test_util.hpp"
+#include "force_directed_layout.hpp"
+
+// Barnes-Hut repulsion against the brute-force sum: theta = 0 opens every cell and must match it up to
+// float rounding, both for the quadtree alone and for a full layout iteration; larger theta stays close
+
+static bool close(float a, float b) {
+    return std::fabs(a - b) <= 1e-3f + 1e-4f * std::fabs(b);
+}
+
+static void brute_force(const std::vector<float>& xs, const std::vector<float>& ys, float k, int i, float& fx, float& fy) {
+    fx = fy = 0.0f;
+    for (size_t j = 0; j < xs.size(); j++) {
+        if ((int)j == i) continue;
+        float dx = xs[j] - xs[i];
+        float dy = ys[j] - ys[i];
+        float distance = std::hypot(dx, dy) + 0.01f;
+        float force = k / (distance * distance);
+        fx -= (dx / distance) * force;
+        fy -= (dy / distance) * force;
+    }
+}
+
+int main() {
+    const int N = 2000;
+    const float k = 2000.0f;
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coordinate(0.0f, 1000.0f);
+    std::vector<float> xs(N), ys(N);
+    for (int i = 0; i < N; i++) {
+        xs[i] = coordinate(rng);
+        ys[i] = coordinate(rng);
+    }
+
+    RepulsionQuadtree tree;
+    tree.build(xs, ys);
+    std::vector<int> stack;
+    double error = 0;
+    for (int i = 0; i < N; i++) {
+        float fx, fy, bx, by, ax, ay;
+        brute_force(xs, ys, k, i, bx, by);
+        tree.force(i, k, 0.0f, stack, fx, fy);
+        CHECK(close(fx, bx) && close(fy, by));
+        tree.force(i, k, 0.5f, stack, ax, ay);
+        error += std::hypot(ax - bx, ay - by) / std::hypot(bx, by);
+    }
+    CHECK(error / N < 0.05);
+
+    // One iteration of the layout from known positions against the same update done by hand
+    CSRGraph<int> csr = test_graph(300, 4, 3, 9);
+    std::unique_ptr<SparseGraph<int>> graph(csr.to_sparse_graph());
+    ForceDirectedParams params;
+    params.repulsion = REPULSION_BARNES_HUT;
+    params.theta = 0.0f;
+    params.max_iterations = 1;
+
+    ForceDirectedLayout<int> layout;
+    layout.initialize_positions(*graph, params);
+    std::map<int, std::pair<float, float>> before = layout.get_positions();
+    layout.calculate(*graph, params);
+    const std::map<int, std::pair<float, float>>& after = layout.get_positions();
+
+    const int V = csr.n_vertices;
+    std::vector<float> px(V), py(V), fx(V), fy(V);
+    for (int v = 0; v < V; v++) {
+        px[v] = before.at(v).first;
+        py[v] = before.at(v).second;
+    }
+    for (int v = 0; v < V; v++) brute_force(px, py, params.k_repulsion, v, fx[v], fy[v]);
+    for (int v = 0; v < V; v++) {
+        for (int e = csr.edges_begin(v); e < csr.edges_end(v); e++) {
+            int t = csr.targets[e];
+            float dx = px[t] - px[v];
+            float dy = py[t] - py[v];
+            float distance = std::hypot(dx, dy) + 0.01f;
+            float force = (distance - params.ideal_length) * params.k_attraction * csr.weights[e];
+            fx[v] += (dx / distance) * force;
+            fy[v] += (dy / distance) * force;
+            fx[t] -= (dx / distance) * force;
+            fy[t] -= (dy / distance) * force;
+        }
+    }
+    CHECK_EQ((int)after.size(), V);
+    for (int v = 0; v < V; v++) {
+        float x = std::max(0.0f, std::min(params.width, px[v] + fx[v] * params.time_step));
+        float y = std::max(0.0f, std::min(params.height, py[v] + fy[v] * params.time_step));
+        CHECK(close(after.at(v).first, x) && close(after.at(v).second, y));
+    }
+
+    return test_result("layout");
+}
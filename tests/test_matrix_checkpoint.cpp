@@ -0,0 +1,100 @@
+#include <cstdio>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <string>
+#include <unistd.h>
+#include "test_util.hpp"
+#include "matrix_checkpoint.hpp"
+#include "matrix_pipeline.hpp"
+#include "thread_config.hpp"
+
+// MatrixCheckpoint: a resumed run equals an uninterrupted one, records appended after the last commit
+// are cut from the rows file, and a row that fails while streaming makes the run throw instead of hang
+
+static std::string scratch(const std::string& name) {
+    return (std::filesystem::temp_directory_path() / ("test_matrix_checkpoint_" + std::to_string(getpid()) + "_" + name)).string();
+}
+
+static void check_equal(const KeywordDistanceMatrix& a, const KeywordDistanceMatrix& b, int W, int V) {
+    int different = 0;
+    for (int w = 0; w < W; w++) {
+        for (int v = 0; v < V; v++) {
+            different += a(w, v).dist != b(w, v).dist || a(w, v).pred != b(w, v).pred;
+        }
+    }
+    CHECK_EQ(different, 0);
+}
+
+int main() {
+    const int V = 3000, W = 32;
+    set_num_threads(8);
+    CSRGraph<int> graph = test_graph(V, W, 3, 21);
+    KeywordDistanceMatrix reference(W, V, 10);
+    reference.calculate_matrix_cpu(graph);
+    const uint64_t record_bytes = sizeof(MatrixCheckpointRecord) + 2 * sizeof(int32_t) * V;
+
+    // An interrupted run: rows 0 to 9 committed, rows 10 and 11 added after the last commit, and a record
+    // cut short by the kill
+    std::string path = scratch("resume.ckpt");
+    {
+        MatrixCheckpoint checkpoint(path, graph, 0, 21, false);
+        for (int w = 0; w < 10; w++) checkpoint.add_row(w, reference.dense_row(w));
+        checkpoint.commit();
+        for (int w = 10; w < 12; w++) checkpoint.add_row(w, reference.dense_row(w));
+    }
+    {
+        std::ofstream rows(path + ".rows", std::ios::binary | std::ios::app);
+        rows << "partial record";
+    }
+    {
+        MatrixCheckpoint checkpoint(path, graph, 0, 21, true);
+        CHECK_EQ(checkpoint.resumed_rows(), 10);
+        CHECK_EQ((uint64_t)std::filesystem::file_size(path + ".rows"), 10 * record_bytes);
+        CHECK(checkpoint.has_row(9) && !checkpoint.has_row(10));
+
+        KeywordDistanceMatrix resumed(W, V, 10);
+        resumed.set_checkpoint(&checkpoint);
+        resumed.calculate_matrix_cpu(graph);
+        check_equal(resumed, reference, W, V);
+        checkpoint.remove();
+    }
+    CHECK(!std::filesystem::exists(path) && !std::filesystem::exists(path + ".rows"));
+
+    // A resumed row that fails its hash while rows stream through a one-row queue
+    std::string broken = scratch("broken.ckpt");
+    {
+        MatrixCheckpoint checkpoint(broken, graph, 0, 21, false);
+        checkpoint.add_row(8, reference.dense_row(8));
+        checkpoint.commit();
+    }
+    {
+        std::fstream rows(broken + ".rows", std::ios::binary | std::ios::in | std::ios::out);
+        rows.seekp(sizeof(MatrixCheckpointRecord) + 16);
+        rows.put('\x7f');
+    }
+    std::string output = scratch("broken.bin");
+    auto run = std::async(std::launch::async, [&] {
+        MatrixCheckpoint checkpoint(broken, graph, 0, 21, true);
+        KeywordDistanceMatrix mat(W, V, 10);
+        mat.set_checkpoint(&checkpoint);
+        try {
+            stream_matrix_cpu(mat, graph, output, true, DTYPE_INT32, 1);
+        } catch (const std::runtime_error&) {
+            checkpoint.remove();
+            return true;
+        }
+        checkpoint.remove();
+        return false;
+    });
+    if (run.wait_for(std::chrono::seconds(60)) != std::future_status::ready) {
+        std::cerr << "Streaming with a failing checkpoint row hangs" << std::endl;
+        std::_Exit(1);
+    }
+    CHECK(run.get());
+    CHECK(!std::filesystem::exists(output));
+
+    return test_result("matrix_checkpoint");
+}
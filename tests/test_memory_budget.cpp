@@ -0,0 +1,26 @@
+#include <sstream>
+#include "test_util.hpp"
+#include "memory_budget.hpp"
+
+// available_memory on /proc/meminfo text, where some lines have no unit
+
+int main() {
+    std::istringstream meminfo("MemTotal:       16314344 kB\n"
+                               "MemFree:         1022396 kB\n"
+                               "HugePages_Total:       0\n"
+                               "HugePages_Free:        0\n"
+                               "MemAvailable:    9876543 kB\n"
+                               "Hugepagesize:       2048 kB\n");
+    CHECK_EQ(available_memory(meminfo), 9876543ULL * 1024);
+
+    std::istringstream missing("MemTotal:       16314344 kB\n"
+                               "HugePages_Total:       0\n");
+    CHECK_EQ(available_memory(missing), 0ULL);
+
+    std::istringstream empty("");
+    CHECK_EQ(available_memory(empty), 0ULL);
+
+    CHECK(available_memory() > 0);
+
+    return test_result("memory_budget");
+}
@@ -0,0 +1,35 @@
+#include <stdexcept>
+#include "test_util.hpp"
+#include "background_task.hpp"
+#include "percent_tracker.hpp"
+
+// A ProgressTracker inside a task: increments only touch the counter, the TaskControl reads it when polled
+// and keeps the final count once the loop is finished or left by an exception
+
+int main() {
+    TaskControl control;
+    ScopedTaskControl scope(&control);
+
+    {
+        ProgressTracker tracker("test_progress", "Done.", 8);
+        tracker.begin();
+        CHECK_EQ(control.get_stage(), std::string("test_progress"));
+        CHECK_EQ(control.get_progress(), 0.0f);
+        #pragma omp parallel for num_threads(4)
+        for (int i = 0; i < 4; i++) tracker.increment();
+        CHECK_EQ(control.get_progress(), 0.5f);
+        for (int i = 0; i < 4; i++) tracker.increment();
+        tracker.finish();
+    }
+    CHECK_EQ(control.get_progress(), 1.0f);
+
+    try {
+        ProgressTracker tracker("test_progress", "Done.", 4);
+        tracker.begin();
+        tracker.increment();
+        throw std::runtime_error("left");
+    } catch (const std::runtime_error&) {}
+    CHECK_EQ(control.get_progress(), 0.0f);   // The stage's own progress, the abandoned counter is dropped
+
+    return test_result("progress");
+}
@@ -0,0 +1,54 @@
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include "test_util.hpp"
+#include "thread_pool.hpp"
+#include "thread_config.hpp"
+
+// Thread accounting of ThreadPool and ThreadShare: the threads held by running tasks never exceed the
+// pool, a share sets the task's thread count, and a share of 0 lets another task use the waiting one's thread
+
+int main() {
+    const int N = 4;
+    ThreadPool pool(N);
+    std::atomic<int> held(0), most(0);
+    auto hold = [&](int n) {
+        int now = held += n;
+        for (int seen = most; now > seen && !most.compare_exchange_weak(seen, now);) {}
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        held -= n;
+    };
+
+    for (int i = 0; i < 32; i++) {
+        pool.submit(1, [&, i] {
+            hold(1);
+            ThreadShare share(pool, 1 + i % N);
+            CHECK_EQ(get_num_threads(), 1 + i % N);
+            hold(1 + i % N);
+        });
+    }
+    pool.wait();
+    CHECK(most <= N);
+    CHECK_EQ(held.load(), 0);
+
+    // The second task needs the whole pool, so it only runs while the first one lends its thread
+    std::atomic<bool> ran(false);
+    pool.submit(1, [&] {
+        ThreadShare waiting(pool, 0);
+        for (int i = 0; i < 5000 && !ran; i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        CHECK(ran);
+    });
+    pool.submit(N, [&] { ran = true; });
+    pool.wait();
+
+    bool thrown = false;
+    try {
+        ThreadShare outside(pool, 1);
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+
+    return test_result("thread_pool");
+}
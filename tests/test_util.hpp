@@ -0,0 +1,51 @@
+#ifndef EVA_TEST_UTIL
+#define EVA_TEST_UTIL
+
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include "graph_generator.hpp"
+#include "csr_graph.hpp"
+
+/*! Checks shared by the test programs. Every test is a plain executable registered with ctest: failed
+ * checks are printed with their location and the program exits with 1 once all of them ran
+ */
+
+inline int& test_failures() {
+    static int n = 0;
+    return n;
+}
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+        test_failures()++; \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    auto a_ = (a); \
+    auto b_ = (b); \
+    if (!(a_ == b_)) { \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #a ", " #b ") failed: " << a_ << " != " << b_ << std::endl; \
+        test_failures()++; \
+    } \
+} while (0)
+
+//! Small generated graph, the generator's console output is swallowed
+inline CSRGraph<int> test_graph(int V, int W, int degree, unsigned seed) {
+    std::ostringstream sink;
+    std::streambuf* previous = std::cout.rdbuf(sink.rdbuf());
+    GraphGenerator<int> gen(seed, 5, 5);
+    std::unique_ptr<SparseGraph<int>> graph(gen.generate(V, W, 1, 3, degree / 2, degree + degree / 2, 1, 10));
+    std::cout.rdbuf(previous);
+    return CSRGraph<int>(*graph, W);
+}
+
+inline int test_result(const char* name) {
+    if (test_failures()) std::cerr << name << ": " << test_failures() << " checks failed" << std::endl;
+    else std::cout << name << ": all checks passed" << std::endl;
+    return test_failures() ? 1 : 0;
+}
+
+#endif